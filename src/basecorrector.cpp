@@ -59,6 +59,13 @@ int BaseCorrector::correctByOverlapAnalysis(Read* r1, Read* r2, FilterResult* fr
         }
     }
 
+    // bases are changed in place, so the records parsed from input are stale now
+    if(r1Corrected){
+        r1->raw = NULL;
+    }
+    if(r2Corrected){
+        r2->raw = NULL;
+    }
     if(corrected > 0 && fr){
         if(r1Corrected && r2Corrected){
             fr->incCorrectedReads(2);
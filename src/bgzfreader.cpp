@@ -0,0 +1,222 @@
+#include "bgzfreader.h"
+
+BgzfReader::BgzfReader(const std::string& filename, int threads){
+    mFileName = filename;
+    mFile = std::fopen(mFileName.c_str(), "rb");
+    if(mFile == NULL){
+        util::errorExit("Failed to open file: " + mFileName);
+    }
+    mThreads = std::max(1, threads);
+    // keep a few blocks per thread in flight so inflating never waits for the consumer
+    mSlotNum = mThreads * 4;
+    mSlots = new BgzfBlock[mSlotNum];
+    for(size_t i = 0; i < mSlotNum; ++i){
+        mSlots[i].cdata = new char[MAX_BLOCK_SIZE];
+        mSlots[i].udata = new char[MAX_BLOCK_SIZE];
+        mSlots[i].clen = 0;
+        mSlots[i].ulen = 0;
+        mSlots[i].blockSize = 0;
+        mSlots[i].crc = 0;
+        mSlots[i].seq = 0;
+        mSlots[i].ready = false;
+    }
+    mNextFetchSeq = 0;
+    mConsumeSeq = 0;
+    mConsumePos = 0;
+    mInputDone = false;
+    mStop = false;
+    mConsumedBytes = 0;
+    mWorkers = new std::thread*[mThreads];
+    for(int t = 0; t < mThreads; ++t){
+        mWorkers[t] = new std::thread(&BgzfReader::inflateTask, this);
+    }
+}
+
+BgzfReader::~BgzfReader(){
+    {
+        std::lock_guard<std::mutex> lk(mMtx);
+        mStop = true;
+    }
+    mFreeCV.notify_all();
+    mReadyCV.notify_all();
+    for(int t = 0; t < mThreads; ++t){
+        mWorkers[t]->join();
+        delete mWorkers[t];
+    }
+    delete[] mWorkers;
+    for(size_t i = 0; i < mSlotNum; ++i){
+        delete[] mSlots[i].cdata;
+        delete[] mSlots[i].udata;
+    }
+    delete[] mSlots;
+    if(mFile){
+        std::fclose(mFile);
+        mFile = NULL;
+    }
+}
+
+bool BgzfReader::fetchBlock(BgzfBlock* block){
+    // fixed part of gzip member header: ID1 ID2 CM FLG MTIME(4) XFL OS XLEN(2)
+    unsigned char header[12];
+    size_t n = std::fread(header, 1, 12, mFile);
+    if(n == 0){
+        return false;
+    }
+    if(n < 12 || header[0] != 31 || header[1] != 139 || header[2] != 8 || !(header[3] & 4)){
+        util::errorExit("Malformed BGZF block header in file: " + mFileName);
+    }
+    size_t xlen = header[10] | (header[11] << 8);
+    unsigned char extra[MAX_BLOCK_SIZE];
+    if(std::fread(extra, 1, xlen, mFile) != xlen){
+        util::errorExit("Truncated BGZF block header in file: " + mFileName);
+    }
+    // look for the BC subfield which stores total block size - 1
+    size_t bsize = 0;
+    bool found = false;
+    size_t p = 0;
+    while(p + 4 <= xlen){
+        size_t slen = extra[p + 2] | (extra[p + 3] << 8);
+        if(extra[p] == 'B' && extra[p + 1] == 'C' && slen == 2 && p + 6 <= xlen){
+            bsize = (extra[p + 4] | (extra[p + 5] << 8)) + 1;
+            found = true;
+            break;
+        }
+        p += 4 + slen;
+    }
+    if(!found || bsize < 12 + xlen + 8){
+        util::errorExit("Not a BGZF block(BC subfield missing) in file: " + mFileName);
+    }
+    block->blockSize = bsize;
+    block->clen = bsize - 12 - xlen - 8;
+    unsigned char footer[8];
+    if(std::fread(block->cdata, 1, block->clen, mFile) != block->clen || std::fread(footer, 1, 8, mFile) != 8){
+        util::errorExit("Truncated BGZF block in file: " + mFileName);
+    }
+    block->crc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | ((uint32_t)footer[3] << 24);
+    block->ulen = footer[4] | (footer[5] << 8) | (footer[6] << 16) | ((uint32_t)footer[7] << 24);
+    if(block->ulen > MAX_BLOCK_SIZE){
+        util::errorExit("BGZF block larger than 64KB in file: " + mFileName);
+    }
+    return true;
+}
+
+void BgzfReader::inflateBlock(z_stream* zs, BgzfBlock* block){
+    size_t isize = block->ulen;
+    inflateReset(zs);
+    zs->next_in = (Bytef*)block->cdata;
+    zs->avail_in = block->clen;
+    zs->next_out = (Bytef*)block->udata;
+    zs->avail_out = MAX_BLOCK_SIZE;
+    int ret = inflate(zs, Z_FINISH);
+    if(ret != Z_STREAM_END){
+        util::errorExit("Failed to inflate BGZF block in file: " + mFileName);
+    }
+    block->ulen = MAX_BLOCK_SIZE - zs->avail_out;
+    if(block->ulen != isize || crc32(0L, (Bytef*)block->udata, block->ulen) != block->crc){
+        util::errorExit("BGZF block checksum mismatch in file: " + mFileName);
+    }
+}
+
+void BgzfReader::inflateTask(){
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(z_stream));
+    // negative window bits for raw deflate data, gzip header/footer parsed by fetchBlock
+    if(inflateInit2(&zs, -15) != Z_OK){
+        util::errorExit("Failed to initialize inflating stream");
+    }
+    while(true){
+        BgzfBlock* block = NULL;
+        {
+            std::unique_lock<std::mutex> lk(mMtx);
+            mFreeCV.wait(lk, [this]{return mStop || mInputDone || mNextFetchSeq < mConsumeSeq + mSlotNum;});
+            if(mStop || mInputDone){
+                break;
+            }
+            block = &mSlots[mNextFetchSeq % mSlotNum];
+            if(!fetchBlock(block)){
+                mInputDone = true;
+                mReadyCV.notify_all();
+                mFreeCV.notify_all();
+                break;
+            }
+            block->seq = mNextFetchSeq;
+            block->ready = false;
+            ++mNextFetchSeq;
+        }
+        inflateBlock(&zs, block);
+        {
+            std::lock_guard<std::mutex> lk(mMtx);
+            block->ready = true;
+        }
+        mReadyCV.notify_all();
+    }
+    inflateEnd(&zs);
+}
+
+int BgzfReader::read(char* buf, int len){
+    int total = 0;
+    while(total < len){
+        std::unique_lock<std::mutex> lk(mMtx);
+        BgzfBlock* block = &mSlots[mConsumeSeq % mSlotNum];
+        mReadyCV.wait(lk, [this, block]{return (mConsumeSeq < mNextFetchSeq && block->ready) || (mInputDone && mConsumeSeq >= mNextFetchSeq);});
+        if(mConsumeSeq >= mNextFetchSeq){
+            break;
+        }
+        lk.unlock();
+        // the slot will not be reused until mConsumeSeq moves on, so copy without lock
+        size_t n = std::min((size_t)(len - total), block->ulen - mConsumePos);
+        std::memcpy(buf + total, block->udata + mConsumePos, n);
+        mConsumePos += n;
+        total += n;
+        if(mConsumePos == block->ulen){
+            lk.lock();
+            block->ready = false;
+            mConsumedBytes += block->blockSize;
+            mConsumePos = 0;
+            ++mConsumeSeq;
+            lk.unlock();
+            mFreeCV.notify_all();
+        }
+    }
+    return total;
+}
+
+bool BgzfReader::eof(){
+    std::lock_guard<std::mutex> lk(mMtx);
+    return mInputDone && mConsumeSeq >= mNextFetchSeq;
+}
+
+size_t BgzfReader::compressedOffset(){
+    return mConsumedBytes;
+}
+
+bool BgzfReader::isBgzf(const std::string& filename){
+    // peeking a pipe would eat the data, it is inflated as an ordinary gzip stream
+    if(!util::isfile(filename)){
+        return false;
+    }
+    FILE* fp = std::fopen(filename.c_str(), "rb");
+    if(fp == NULL){
+        return false;
+    }
+    unsigned char header[12];
+    bool ret = false;
+    if(std::fread(header, 1, 12, fp) == 12 && header[0] == 31 && header[1] == 139 && header[2] == 8 && (header[3] & 4)){
+        size_t xlen = header[10] | (header[11] << 8);
+        unsigned char* extra = new unsigned char[xlen];
+        if(std::fread(extra, 1, xlen, fp) == xlen){
+            size_t p = 0;
+            while(p + 4 <= xlen){
+                size_t slen = extra[p + 2] | (extra[p + 3] << 8);
+                if(extra[p] == 'B' && extra[p + 1] == 'C' && slen == 2){
+                    ret = true;
+                    break;
+                }
+                p += 4 + slen;
+            }
+        }
+        delete[] extra;
+    }
+    std::fclose(fp);
+    return ret;
+}
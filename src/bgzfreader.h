@@ -0,0 +1,103 @@
+#ifndef BGZF_READER_H
+#define BGZF_READER_H
+
+#include <zlib.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include "util.h"
+
+/** struct to hold one BGZF block, compressed payload in and inflated data out */
+struct BgzfBlock{
+    char* cdata;          ///< raw deflate payload of the block(header stripped)
+    size_t clen;          ///< length of raw deflate payload
+    size_t blockSize;     ///< total length of this block in the compressed file(header and footer included)
+    char* udata;          ///< inflated data of this block
+    size_t ulen;          ///< length of inflated data
+    uint32_t crc;         ///< crc32 of inflated data recorded in the block footer
+    size_t seq;           ///< sequence number of this block in the file
+    bool ready;           ///< udata is filled and can be consumed if true
+};
+
+/** Class to inflate BGZF(blocked gzip) file with a pool of threads\n
+ * each BGZF block is an independent gzip member with its compressed size recorded in the BC extra field,\n
+ * so blocks can be located without inflating and inflated concurrently, then handed out in file order
+ */
+class BgzfReader{
+    public:
+        /** construct a BgzfReader and start inflating threads
+         * @param filename BGZF file name
+         * @param threads number of inflating threads
+         */
+        BgzfReader(const std::string& filename, int threads = 1);
+
+        /** destroy a BgzfReader, stop inflating threads and free resources */
+        ~BgzfReader();
+
+        /** read at most len bytes of inflated data into buf in file order\n
+         * buf will be filled fully unless the end of file reached
+         * @param buf buffer to store inflated data
+         * @param len buffer length
+         * @return number of bytes read into buf, 0 if eof reached
+         */
+        int read(char* buf, int len);
+
+        /** tell whether all inflated data has been consumed
+         * @return true if eof reached
+         */
+        bool eof();
+
+        /** get the compressed bytes consumed so far
+         * @return compressed offset of the first block not consumed yet
+         */
+        size_t compressedOffset();
+
+        /** tell whether a file is in BGZF format by checking its first block header
+         * @param filename file name
+         * @return true if the file starts with a gzip member with BC extra subfield
+         */
+        static bool isBgzf(const std::string& filename);
+
+    private:
+        /** task run by each inflating thread, fetch next block from file and inflate it into its slot */
+        void inflateTask();
+
+        /** fetch the next block from mFile into block, must be called with mMtx locked
+         * @param block pointer to BgzfBlock to store the compressed payload
+         * @return false if no more block available
+         */
+        bool fetchBlock(BgzfBlock* block);
+
+        /** inflate a block with z_stream zs
+         * @param zs pointer to a z_stream initialized for raw inflating
+         * @param block pointer to BgzfBlock to inflate
+         */
+        void inflateBlock(z_stream* zs, BgzfBlock* block);
+
+    public:
+        static const size_t MAX_BLOCK_SIZE = 65536; ///< maximum compressed/inflated size of a BGZF block
+
+    private:
+        std::string mFileName;             ///< BGZF file name
+        FILE* mFile;                       ///< file handler of the BGZF file
+        int mThreads;                      ///< number of inflating threads
+        size_t mSlotNum;                   ///< number of slots in ring mSlots
+        BgzfBlock* mSlots;                 ///< ring of blocks being inflated or waiting to be consumed
+        std::thread** mWorkers;            ///< inflating threads
+        std::mutex mMtx;                   ///< mutex to protect file reading and slot states
+        std::condition_variable mReadyCV;  ///< notified when a block is inflated or input exhausted
+        std::condition_variable mFreeCV;   ///< notified when a slot is released by consumer
+        size_t mNextFetchSeq;              ///< sequence number of the next block to fetch from file
+        size_t mConsumeSeq;                ///< sequence number of the block being consumed
+        size_t mConsumePos;                ///< bytes already consumed in the block being consumed
+        bool mInputDone;                   ///< all blocks have been fetched from file if true
+        bool mStop;                        ///< inflating threads should quit if true
+        std::atomic<size_t> mConsumedBytes;///< compressed bytes of blocks fully consumed
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <mutex>
+
+/** Class to recycle output buffers\n
+ * workers serialize reads into a buffer, hand it to a WriterThread as a whole,\n
+ * and the WriterThread gives it back after written, so the capacity grown by earlier packs is reused
+ */
+class BufferPool{
+    public:
+        /** construct a BufferPool */
+        BufferPool(){}
+
+        /** destroy a BufferPool and all buffers recycled in it */
+        ~BufferPool(){
+            for(auto& b: mFree){
+                delete b;
+            }
+        }
+
+        /** get an empty buffer, reuse a recycled one if possible
+         * @param reserve bytes the buffer is expected to hold
+         * @return pointer to an empty buffer
+         */
+        std::string* acquire(size_t reserve = 0){
+            std::string* buf = NULL;
+            mMtx.lock();
+            if(!mFree.empty()){
+                buf = mFree.back();
+                mFree.pop_back();
+            }
+            mMtx.unlock();
+            if(!buf){
+                buf = new std::string();
+            }
+            buf->reserve(reserve);
+            return buf;
+        }
+
+        /** give a buffer back to the pool, NULL is ignored
+         * @param buf pointer to the buffer
+         */
+        void release(std::string* buf){
+            if(!buf){
+                return;
+            }
+            buf->clear();
+            std::lock_guard<std::mutex> lk(mMtx);
+            mFree.push_back(buf);
+        }
+
+    private:
+        std::vector<std::string*> mFree; ///< buffers ready to be reused
+        std::mutex mMtx;                 ///< mutex to protect mFree
+};
+
+#endif
@@ -14,6 +14,7 @@ namespace COMMONCONST{
     static const int FAIL_TOO_LONG = 17;        ///< 010001
     static const int FAIL_QUALITY = 20;         ///< 010100
     static const int FAIL_COMPLEXITY = 24;      ///< 011000
+    static const int FAIL_DUPLICATE = 28;       ///< 011100
     
     // how many types in total we support
     static const int FILTER_RESULT_TYPES = 32;  ///< 100000
@@ -26,7 +27,7 @@ namespace COMMONCONST{
         "failed_too_short", "failed_too_long", "", "",
         "failed_quality_filter", "", "", "",
         "failed_low_complexity", "", "", "",
-        "", "", "", ""
+        "failed_duplicated", "", "", ""
     };
 }
 
@@ -0,0 +1,264 @@
+#include "deduplicator.h"
+
+Deduplicator::Deduplicator(Options* opt){
+    mOptions = opt;
+    size_t bytes = (size_t)mOptions->dedup.memMBytes << 20;
+    mCapacity = 1024;
+    while(mCapacity * 2 * sizeof(std::atomic<ReadFingerprint>) <= bytes){
+        mCapacity *= 2;
+    }
+    // anonymous pages are zeroed lazily by the kernel, huge pages cut the page faults of random probes
+    static_assert(zeroableAtomic<ReadFingerprint>(), "ReadFingerprint atomics can not be zero initialized");
+    mSlots = (std::atomic<ReadFingerprint>*)::mmap(NULL, getMemoryBytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mSlots == MAP_FAILED){
+        util::errorExit("can not allocate " + std::to_string(mOptions->dedup.memMBytes) + "MB for dedup table");
+    }
+#ifdef MADV_HUGEPAGE
+    ::madvise(mSlots, getMemoryBytes(), MADV_HUGEPAGE);
+#endif
+    // linear probing slows down quickly above 70% load
+    mMaxFill = mCapacity / 10 * 7;
+    mFill = 0;
+    mFull = false;
+    mSpilled = 0;
+    mTurn = 0;
+    for(int i = 0; i < PARTITIONS; ++i){
+        mParts[i].file = NULL;
+    }
+}
+
+Deduplicator::~Deduplicator(){
+    for(int i = 0; i < PARTITIONS; ++i){
+        if(mParts[i].file){
+            std::fclose(mParts[i].file);
+            std::remove(mParts[i].path.c_str());
+        }
+    }
+    ::munmap(mSlots, getMemoryBytes());
+}
+
+size_t Deduplicator::getMemoryBytes() const{
+    return sizeof(std::atomic<ReadFingerprint>) * mCapacity;
+}
+
+size_t Deduplicator::getSpilled() const{
+    return mSpilled.load();
+}
+
+ReadFingerprint Deduplicator::fingerprint(Read* r1, Read* r2){
+    ReadFingerprint fp;
+    fp.h1 = DupHashTable::hashOf(r1->seq.seqStr.c_str(), r1->length(), 0);
+    fp.h2 = DupHashTable::hashOf(r1->seq.seqStr.c_str(), r1->length(), 0x9e3779b97f4a7c15ULL);
+    if(r2){
+        fp.h1 = DupHashTable::hashOf(r2->seq.seqStr.c_str(), r2->length(), fp.h1);
+        fp.h2 = DupHashTable::hashOf(r2->seq.seqStr.c_str(), r2->length(), fp.h2);
+    }
+    // an h1 of 0 marks an empty slot, such a read would never be found
+    if(fp.h1 == 0){
+        fp.h1 = 1;
+    }
+    return fp;
+}
+
+int Deduplicator::check(const ReadFingerprint& fp){
+    size_t mask = mCapacity - 1;
+    // h1 picks the partition, h2 picks the slot
+    for(size_t i = fp.h2 & mask; ; i = (i + 1) & mask){
+        std::atomic<ReadFingerprint>& slot = mSlots[i];
+        ReadFingerprint cur = slot.load(std::memory_order_relaxed);
+        while(true){
+            if(cur.h1 == fp.h1 && cur.h2 == fp.h2){
+                return DUPLICATE;
+            }
+            if(cur.h1 != 0){
+                break;
+            }
+            if(mFull.load(std::memory_order_relaxed)){
+                return DEFERRED;
+            }
+            // on failure cur is reloaded and checked again, it may be the same read put by another thread
+            if(slot.compare_exchange_weak(cur, fp, std::memory_order_relaxed)){
+                if(++mFill >= mMaxFill && !mFull.exchange(true)){
+                    util::loginfo("dedup table full with " + std::to_string(mFill.load()) + " reads, new reads are spilled to " + mOptions->dedup.tmpDir, mOptions->logmtx);
+                }
+                return UNIQUE;
+            }
+        }
+    }
+}
+
+void Deduplicator::checkInOrder(size_t order, Read* reads1, Read* reads2, int begin, int end, std::vector<int>& results, std::vector<std::string>& buffers){
+    // hashing needs no turn
+    std::vector<ReadFingerprint> fps(end - begin);
+    for(int i = begin; i < end; ++i){
+        fps[i - begin] = fingerprint(&reads1[i], reads2 ? &reads2[i] : NULL);
+    }
+    results.resize(end - begin);
+    std::unique_lock<std::mutex> lk(mTurnMtx);
+    mTurnCV.wait(lk, [this, order]{return mTurn == order;});
+    for(int i = begin; i < end; ++i){
+        results[i - begin] = check(fps[i - begin]);
+        if(results[i - begin] == DEFERRED){
+            spill(fps[i - begin], &reads1[i], reads2 ? &reads2[i] : NULL, buffers);
+        }
+    }
+    // reads of later packs must land after these in the partitions
+    flush(buffers);
+    ++mTurn;
+    lk.unlock();
+    mTurnCV.notify_all();
+}
+
+bool Deduplicator::contains(const ReadFingerprint& fp) const{
+    size_t mask = mCapacity - 1;
+    for(size_t i = fp.h2 & mask; ; i = (i + 1) & mask){
+        ReadFingerprint cur = mSlots[i].load(std::memory_order_relaxed);
+        if(cur.h1 == fp.h1 && cur.h2 == fp.h2){
+            return true;
+        }
+        if(cur.h1 == 0){
+            return false;
+        }
+    }
+}
+
+void Deduplicator::serialize(std::string& buf, Read* r){
+    const std::string* fields[4] = {&r->name, &r->seq.seqStr, &r->strand, &r->quality};
+    for(int i = 0; i < 4; ++i){
+        uint32_t len = fields[i]->size();
+        buf.append((const char*)&len, sizeof(len));
+        buf.append(*fields[i]);
+    }
+    buf.push_back(r->hasQuality ? 1 : 0);
+}
+
+void Deduplicator::deserialize(const char* data, size_t& pos, Read& r){
+    std::string* fields[4] = {&r.name, &r.seq.seqStr, &r.strand, &r.quality};
+    for(int i = 0; i < 4; ++i){
+        uint32_t len = 0;
+        std::memcpy(&len, data + pos, sizeof(len));
+        pos += sizeof(len);
+        fields[i]->assign(data + pos, len);
+        pos += len;
+    }
+    r.hasQuality = data[pos++] != 0;
+}
+
+void Deduplicator::spill(const ReadFingerprint& fp, Read* r1, Read* r2, std::vector<std::string>& buffers){
+    int partition = fp.h1 >> 58;
+    std::string& buf = buffers[partition];
+    buf.append((const char*)&fp, sizeof(fp));
+    serialize(buf, r1);
+    if(r2){
+        serialize(buf, r2);
+    }
+    ++mSpilled;
+    if(buf.size() >= FLUSH_BYTES){
+        write(partition, buf);
+    }
+}
+
+void Deduplicator::flush(std::vector<std::string>& buffers){
+    for(int i = 0; i < PARTITIONS; ++i){
+        if(!buffers[i].empty()){
+            write(i, buffers[i]);
+        }
+    }
+}
+
+void Deduplicator::write(int partition, std::string& buf){
+    Partition& part = mParts[partition];
+    std::lock_guard<std::mutex> lk(part.mtx);
+    if(!part.file){
+        std::string tpl = util::joinpath(mOptions->dedup.tmpDir, "fqtool_dedup_XXXXXX");
+        std::vector<char> path(tpl.begin(), tpl.end());
+        path.push_back('\0');
+        int fd = mkstemp(path.data());
+        if(fd < 0 || !(part.file = fdopen(fd, "w+b"))){
+            util::errorExit("can not create dedup temp file in " + mOptions->dedup.tmpDir);
+        }
+        part.path = path.data();
+    }
+    if(std::fwrite(buf.c_str(), 1, buf.size(), part.file) != buf.size()){
+        util::errorExit("can not write dedup temp file " + part.path);
+    }
+    buf.clear();
+}
+
+bool Deduplicator::hasSpilled(){
+    return mSpilled.load() > 0;
+}
+
+size_t Deduplicator::resolve(int partition, std::vector<Read>& reads1, std::vector<Read>& reads2){
+    Partition& part = mParts[partition];
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lk(part.mtx);
+        if(!part.file){
+            return 0;
+        }
+        std::fseek(part.file, 0, SEEK_END);
+        data.resize(std::ftell(part.file));
+        std::rewind(part.file);
+        if(std::fread(&data[0], 1, data.size(), part.file) != data.size()){
+            util::errorExit("can not read dedup temp file " + part.path);
+        }
+        std::fclose(part.file);
+        std::remove(part.path.c_str());
+        part.file = NULL;
+    }
+    bool paired = mOptions->isPaired();
+    // fingerprints of the partition first seen, a small table of its own sized by the number of records
+    size_t cap = 1024;
+    std::vector<ReadFingerprint> seen;
+    std::vector<Read> dups1;
+    std::vector<Read> dups2;
+    std::vector<size_t> starts;
+    for(size_t pos = 0; pos < data.size(); ){
+        starts.push_back(pos);
+        pos += sizeof(ReadFingerprint);
+        // skip 4 fields and the quality flag of each read
+        for(int m = 0; m < (paired ? 8 : 4); ++m){
+            uint32_t len = 0;
+            std::memcpy(&len, data.c_str() + pos, sizeof(len));
+            pos += sizeof(len) + len + (m % 4 == 3 ? 1 : 0);
+        }
+    }
+    while(cap < starts.size() * 2){
+        cap *= 2;
+    }
+    seen.assign(cap, ReadFingerprint{0, 0});
+    // Read has no move constructor, so avoid copying reads when the vectors grow
+    reads1.reserve(starts.size());
+    dups1.reserve(starts.size());
+    if(paired){
+        reads2.reserve(starts.size());
+        dups2.reserve(starts.size());
+    }
+    for(size_t s: starts){
+        ReadFingerprint fp;
+        std::memcpy(&fp, data.c_str() + s, sizeof(fp));
+        size_t pos = s + sizeof(fp);
+        bool dup = contains(fp);
+        if(!dup){
+            size_t i = fp.h2 & (cap - 1);
+            while(seen[i].h1 != 0 && !(seen[i].h1 == fp.h1 && seen[i].h2 == fp.h2)){
+                i = (i + 1) & (cap - 1);
+            }
+            dup = seen[i].h1 != 0;
+            seen[i] = fp;
+        }
+        std::vector<Read>& out1 = dup ? dups1 : reads1;
+        std::vector<Read>& out2 = dup ? dups2 : reads2;
+        out1.emplace_back();
+        deserialize(data.c_str(), pos, out1.back());
+        if(paired){
+            out2.emplace_back();
+            deserialize(data.c_str(), pos, out2.back());
+        }
+    }
+    size_t uniques = reads1.size();
+    std::move(dups1.begin(), dups1.end(), std::back_inserter(reads1));
+    std::move(dups2.begin(), dups2.end(), std::back_inserter(reads2));
+    return uniques;
+}
@@ -0,0 +1,161 @@
+#ifndef DEDUPLICATOR_H
+#define DEDUPLICATOR_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "options.h"
+#include "read.h"
+#include "util.h"
+#include "duphashtable.h"
+
+/** struct to hold a 128 bit fingerprint of a read(or pair), h1 is never 0 so an all zero fingerprint marks an empty slot */
+struct ReadFingerprint{
+    uint64_t h1; ///< hash of the sequence
+    uint64_t h2; ///< hash of the sequence with another seed
+};
+
+/** Class to drop duplicated reads(or pairs) by their exact sequence\n
+ * fingerprints of reads seen are kept in an open addressing table of dedup.memMBytes updated by 16 bytes CAS(through libatomic),\n
+ * the first copy of a read is unique and all copies after it are duplicates\n
+ * once the table is full reads not found in it are deferred: they are spilled to PARTITIONS temp files by fingerprint,\n
+ * and each partition is resolved on its own at the end(reads found in the table or seen before in the partition are duplicates)\n
+ * which threads fill the table first depends on timing, with ordered output packs are checked one after another by checkInOrder,\n
+ * so the copy kept and the reads spilled are the same in every run
+ */
+class Deduplicator{
+    public:
+        /** construct a Deduplicator
+         * @param opt pointer to Options
+         */
+        Deduplicator(Options* opt);
+
+        /** destroy a Deduplicator, remove temp files left */
+        ~Deduplicator();
+
+        /** calculate the fingerprint of a read or a pair
+         * @param r1 pointer to read1
+         * @param r2 pointer to read2, NULL if single end
+         * @return fingerprint of the sequences
+         */
+        static ReadFingerprint fingerprint(Read* r1, Read* r2);
+
+        /** check a read against reads seen and record it if new, safe to call from many threads
+         * @param fp fingerprint of the read
+         * @return UNIQUE if first seen, DUPLICATE if seen before, DEFERRED if not seen but the table is full
+         */
+        int check(const ReadFingerprint& fp);
+
+        /** check the reads of a task once all packs before it in input order are checked, spill the deferred ones and write out the buffers,\n
+         * so the table fills up and the partitions are written in input order
+         * @param order order of the pack in input
+         * @param reads1 read1 of the pack
+         * @param reads2 read2 of the pack, NULL if single end
+         * @param begin index of the first read to check
+         * @param end index after the last read to check
+         * @param results to store the result of check for each read from begin
+         * @param buffers PARTITIONS buffers owned by the caller
+         */
+        void checkInOrder(size_t order, Read* reads1, Read* reads2, int begin, int end, std::vector<int>& results, std::vector<std::string>& buffers);
+
+        /** serialize a deferred read into the buffer of its partition, the buffer is written out once big enough
+         * @param fp fingerprint of the read
+         * @param r1 pointer to read1
+         * @param r2 pointer to read2, NULL if single end
+         * @param buffers PARTITIONS buffers owned by the caller
+         */
+        void spill(const ReadFingerprint& fp, Read* r1, Read* r2, std::vector<std::string>& buffers);
+
+        /** write out all buffers of a caller
+         * @param buffers PARTITIONS buffers owned by the caller
+         */
+        void flush(std::vector<std::string>& buffers);
+
+        /** test whether any read has been spilled, should be called after all buffers flushed
+         * @return true if some partition is not empty
+         */
+        bool hasSpilled();
+
+        /** load the reads spilled to a partition and remove its temp file, should be called after all buffers flushed
+         * @param partition index of the partition
+         * @param reads1 to store read1 of the unique reads followed by the duplicates
+         * @param reads2 to store read2 in the same order if paired
+         * @return number of unique reads at the front of reads1
+         */
+        size_t resolve(int partition, std::vector<Read>& reads1, std::vector<Read>& reads2);
+
+        /** get bytes of the table
+         * @return bytes of mSlots
+         */
+        size_t getMemoryBytes() const;
+
+        /** get the number of reads spilled
+         * @return number of reads spilled
+         */
+        size_t getSpilled() const;
+
+    public:
+        static const int UNIQUE = 0;                   ///< first copy of a read
+        static const int DUPLICATE = 1;                ///< copy of a read seen before
+        static const int DEFERRED = 2;                 ///< not in the table and the table is full
+        static const int PARTITIONS = 64;              ///< number of temp files reads are spilled to
+        static const size_t FLUSH_BYTES = 1UL << 20;   ///< bytes of a spill buffer written out at once
+
+    private:
+        /** test whether a fingerprint is in the table, only valid when no thread is calling check
+         * @param fp fingerprint to find
+         * @return true if found
+         */
+        bool contains(const ReadFingerprint& fp) const;
+
+        /** append a buffer to the temp file of a partition and clear it
+         * @param partition index of the partition
+         * @param buf buffer to write
+         */
+        void write(int partition, std::string& buf);
+
+        /** append a read to a spill buffer
+         * @param buf buffer to append to
+         * @param r pointer to the read
+         */
+        static void serialize(std::string& buf, Read* r);
+
+        /** parse a read from a spill buffer
+         * @param data pointer to the buffer
+         * @param pos position to parse from, moved after the read
+         * @param r Read to fill
+         */
+        static void deserialize(const char* data, size_t& pos, Read& r);
+
+    private:
+        /** struct to hold the temp file of one partition */
+        struct Partition{
+            std::FILE* file;   ///< temp file, NULL if nothing spilled
+            std::string path;  ///< path of the temp file
+            std::mutex mtx;    ///< mutex to protect file
+        };
+
+        Options* mOptions;                    ///< pointer to Options
+        std::atomic<ReadFingerprint>* mSlots; ///< open addressing slots of fingerprints seen
+        size_t mCapacity;                     ///< number of slots, power of 2
+        size_t mMaxFill;                      ///< number of fingerprints the table holds before it is full
+        std::atomic<size_t> mFill;            ///< number of fingerprints in the table
+        std::atomic<bool> mFull;              ///< no more fingerprints added if true
+        std::atomic<size_t> mSpilled;         ///< number of reads spilled
+        Partition mParts[PARTITIONS];         ///< temp files reads are spilled to
+        size_t mTurn;                         ///< order of the next pack checkInOrder lets in
+        std::mutex mTurnMtx;                  ///< mutex to protect mTurn
+        std::condition_variable mTurnCV;      ///< condition variable to wait for mTurn
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "duphashtable.h"
+
+DupHashTable::DupHashTable(size_t bytes){
+    mCapacity = MAX_PROBE;
+    while(mCapacity * 2 * sizeof(std::atomic<DupHashSlot>) <= bytes){
+        mCapacity *= 2;
+    }
+    mSlots = new std::atomic<DupHashSlot>[mCapacity];
+    static_assert(zeroableAtomic<DupHashSlot>(), "DupHashSlot atomics can not be zero initialized");
+    std::memset((void*)mSlots, 0, sizeof(std::atomic<DupHashSlot>) * mCapacity);
+    mLevel = 0;
+}
+
+DupHashTable::~DupHashTable(){
+    delete[] mSlots;
+}
+
+size_t DupHashTable::getMemoryBytes() const{
+    return sizeof(std::atomic<DupHashSlot>) * mCapacity;
+}
+
+int DupHashTable::getLevel() const{
+    return mLevel.load();
+}
+
+bool DupHashTable::sampledAt(uint64_t hash, int level){
+    return level == 0 || (hash >> (64 - level)) == 0;
+}
+
+bool DupHashTable::sampled(uint64_t hash) const{
+    return sampledAt(hash, mLevel.load(std::memory_order_relaxed));
+}
+
+uint64_t DupHashTable::hashOf(const char* cstr, int len, uint64_t seed){
+    // MurmurHash64A
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ ((uint64_t)len * m);
+    int i = 0;
+    for(; i + 8 <= len; i += 8){
+        uint64_t k;
+        std::memcpy(&k, cstr + i, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    if(i < len){
+        uint64_t k = 0;
+        for(int j = 0; i + j < len; ++j){
+            k |= (uint64_t)(unsigned char)cstr[i + j] << (8 * j);
+        }
+        h ^= k;
+        h *= m;
+    }
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    // 0 marks an empty slot
+    return h == 0 ? 1 : h;
+}
+
+bool DupHashTable::tryAdd(uint64_t hash, uint8_t gc, int level){
+    size_t mask = mCapacity - 1;
+    // the top bits decide sampling, the low bits are still uniform among sampled hashes
+    size_t home = hash & mask;
+    for(int i = 0; i < MAX_PROBE; ++i){
+        std::atomic<DupHashSlot>& slot = mSlots[(home + i) & mask];
+        DupHashSlot cur = slot.load(std::memory_order_relaxed);
+        DupHashSlot next;
+        while(true){
+            if(cur.hash == hash){
+                next = cur;
+                ++next.count;
+            }else if(cur.hash == 0 || !sampledAt(cur.hash, level)){
+                next.hash = hash;
+                next.count = 1;
+                next.gc = gc;
+            }else{
+                break;
+            }
+            if(slot.compare_exchange_weak(cur, next, std::memory_order_relaxed)){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void DupHashTable::add(uint64_t hash, uint8_t gc){
+    int level = mLevel.load(std::memory_order_relaxed);
+    while(sampledAt(hash, level)){
+        if(tryAdd(hash, gc, level)){
+            return;
+        }
+        // on failure level is updated to the one raised by another thread
+        if(level < 63 && mLevel.compare_exchange_strong(level, level + 1)){
+            ++level;
+        }
+    }
+}
+
+double DupHashTable::statAll(size_t* hist, double* meanGC, size_t histSize, double& error){
+    int level = mLevel.load();
+    // a read racing with a level change can be recorded in two slots of its chain, so records are merged by hash
+    std::vector<DupHashSlot> recs;
+    for(size_t i = 0; i < mCapacity; ++i){
+        DupHashSlot rec = mSlots[i].load(std::memory_order_relaxed);
+        if(rec.hash != 0 && sampledAt(rec.hash, level)){
+            recs.push_back(rec);
+        }
+    }
+    std::sort(recs.begin(), recs.end(), [](const DupHashSlot& a, const DupHashSlot& b){return a.hash < b.hash;});
+    size_t n = 0;
+    for(size_t i = 0; i < recs.size(); ++i){
+        if(n > 0 && recs[n - 1].hash == recs[i].hash){
+            recs[n - 1].count += recs[i].count;
+        }else{
+            recs[n++] = recs[i];
+        }
+    }
+    recs.resize(n);
+
+    size_t totalNum = 0;
+    size_t* distinctNum = new size_t[histSize];
+    std::memset(distinctNum, 0, sizeof(size_t) * histSize);
+    for(auto& rec: recs){
+        totalNum += rec.count;
+        size_t idx = std::min((size_t)rec.count, histSize - 1);
+        ++distinctNum[idx];
+        meanGC[idx] += rec.gc;
+    }
+    double scale = std::ldexp(1.0, level);
+    for(size_t i = 0; i < histSize; ++i){
+        if(distinctNum[i] > 0){
+            meanGC[i] = meanGC[i] / 255.0 / distinctNum[i];
+        }
+        hist[i] = (size_t)std::llround(distinctNum[i] * scale);
+    }
+    delete[] distinctNum;
+
+    error = 0.0;
+    if(totalNum == 0){
+        return 0.0;
+    }
+    // distinct reads are sampled independently with p = 2^-level, the rate is 1 - distinct/total,
+    // variance of the ratio estimator is (1 - p) * sum((1 - ratio * count)^2) / total^2 over sampled distinct reads
+    double ratio = (double)recs.size() / (double)totalNum;
+    if(level > 0){
+        double p = 1.0 / scale;
+        double var = 0.0;
+        for(auto& rec: recs){
+            double d = 1.0 - ratio * rec.count;
+            var += d * d;
+        }
+        error = std::sqrt((1.0 - p) * var) / (double)totalNum;
+    }
+    return 1.0 - ratio;
+}
@@ -0,0 +1,112 @@
+#ifndef DUP_HASH_TABLE_H
+#define DUP_HASH_TABLE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+/** test whether an array of std::atomic<T> can be zero initialized as raw memory, the slot tables take all zero bits as an empty slot\n
+ * atomics of 16 bytes slots are not lock free, libatomic guards them by a lock table of its own hashed by address,\n
+ * so they are valid as long as the atomic holds nothing but the trivially copyable value
+ * @return true if zeroed memory is a valid std::atomic<T> holding an all zero T
+ */
+template<typename T>
+constexpr bool zeroableAtomic(){
+    return sizeof(std::atomic<T>) == sizeof(T) && std::is_trivially_copyable<T>::value;
+}
+
+/** struct to hold the record of one distinct read(or pair) in a DupHashTable, updated as a whole by one CAS */
+struct DupHashSlot{
+    uint64_t hash;  ///< 64 bit hash of the read, 0 if the slot is empty
+    uint32_t count; ///< the number of reads with this hash
+    uint32_t gc;    ///< the GC ratio * 255.0 of the first read with this hash
+};
+
+/** Class to count duplicated reads by a 64 bit hash of the whole read in a fixed size open addressing table\n
+ * a read is sampled if the top mLevel bits of its hash are zero, so all copies of a read are either counted or not,\n
+ * the level starts at 0(all reads counted) and goes up by one whenever a probe chain is full of sampled records,\n
+ * which halves the sampling rate and turns half of the records stale, and stale slots are reused by new records\n
+ * the table never grows, the duplication rate and histogram are estimated from the reads sampled at the final level\n
+ * add is thread safe(may take a libatomic lock)
+ */
+class DupHashTable{
+    public:
+        /** construct a DupHashTable
+         * @param bytes max bytes of the table
+         */
+        DupHashTable(size_t bytes);
+
+        /** destroy a DupHashTable */
+        ~DupHashTable();
+
+        /** test whether a read is sampled at the current level, reads not sampled need not be added
+         * @param hash hash of the read
+         * @return true if sampled
+         */
+        bool sampled(uint64_t hash) const;
+
+        /** add a read to the table, raise the level if no slot is left in its probe chain
+         * @param hash hash of the read
+         * @param gc GC ratio * 255.0 of the read
+         */
+        void add(uint64_t hash, uint8_t gc);
+
+        /** estimate duplication of all reads from the records sampled at the final level, should be called after all reads added
+         * @param hist hist[i] is the estimated number of distinct reads seen i times, if greater than histSize - 1 just keep it in histSize - 1
+         * @param meanGC meanGC[i] is the average gc ratio of distinct reads in hist[i]
+         * @param histSize the length of hist/meanGC array
+         * @param error to store the standard error of the duplication rate caused by sampling, 0 if all reads counted
+         * @return estimated duplication rate of all reads
+         */
+        double statAll(size_t* hist, double* meanGC, size_t histSize, double& error);
+
+        /** get bytes of the table
+         * @return bytes of mSlots
+         */
+        size_t getMemoryBytes() const;
+
+        /** get the current sampling level
+         * @return level, reads are sampled at rate 2^-level
+         */
+        int getLevel() const;
+
+        /** calculate a 64 bit hash of a sequence, never 0
+         * @param cstr pointer to the sequence
+         * @param len length of the sequence
+         * @param seed seed of the hash, hash of the mate to hash a pair
+         * @return hash of the sequence
+         */
+        static uint64_t hashOf(const char* cstr, int len, uint64_t seed);
+
+    public:
+        static const int MAX_PROBE = 64; ///< max number of slots probed before the level is raised
+
+    private:
+        /** test whether a hash is sampled at a level
+         * @param hash hash to test
+         * @param level sampling level
+         * @return true if the top level bits of hash are zero
+         */
+        static bool sampledAt(uint64_t hash, int level);
+
+        /** add a read to its probe chain, stale records at level are reused
+         * @param hash hash of the read
+         * @param gc GC ratio * 255.0 of the read
+         * @param level sampling level seen by the caller
+         * @return false if all slots in the chain hold other records sampled at level
+         */
+        bool tryAdd(uint64_t hash, uint8_t gc, int level);
+
+    private:
+        std::atomic<DupHashSlot>* mSlots; ///< open addressing slots
+        size_t mCapacity;                 ///< number of slots, power of 2
+        std::atomic<int> mLevel;          ///< sampling level
+};
+
+#endif
@@ -4,18 +4,37 @@ Duplicate::Duplicate(Options* opt){
     mOptions = opt;
     mKeyLenInBase = mOptions->duplicate.keylen;
     mKeyLenInBit = (1UL << (2 * mKeyLenInBase));
-    mDups = new uint64_t[mKeyLenInBit];
-    std::memset(mDups, 0, sizeof(uint64_t) * mKeyLenInBit);
-    mCounts = new uint32_t[mKeyLenInBit];
-    std::memset(mCounts, 0, sizeof(uint32_t) * mKeyLenInBit);
-    mGC = new uint8_t[mKeyLenInBit];
-    std::memset(mGC, 0, sizeof(uint8_t) * mKeyLenInBit);
+    mSlots = NULL;
+    mTable = NULL;
+    if(mOptions->duplicate.sparse){
+        mTable = new DupHashTable((size_t)mOptions->duplicate.memMBytes << 20);
+        return;
+    }
+    mSlots = new std::atomic<DupSlot>[mKeyLenInBit];
+    static_assert(zeroableAtomic<DupSlot>(), "DupSlot atomics can not be zero initialized");
+    std::memset((void*)mSlots, 0, sizeof(std::atomic<DupSlot>) * mKeyLenInBit);
 }
 
 Duplicate::~Duplicate(){
-    delete[] mDups;
-    delete[] mCounts;
-    delete[] mGC;
+    if(mSlots){
+        delete[] mSlots;
+        mSlots = NULL;
+    }
+    if(mTable){
+        delete mTable;
+        mTable = NULL;
+    }
+}
+
+size_t Duplicate::getMemoryBytes(){
+    if(mTable){
+        return mTable->getMemoryBytes();
+    }
+    return sizeof(std::atomic<DupSlot>) * mKeyLenInBit;
+}
+
+bool Duplicate::isEmpty(uint32_t key){
+    return mSlots[key].load(std::memory_order_relaxed).count == 0;
 }
 
 uint64_t Duplicate::seq2int(const char* cstr, int start, int keylen, bool& valid){
@@ -44,21 +63,21 @@ uint64_t Duplicate::seq2int(const char* cstr, int start, int keylen, bool& valid
 }
 
 void Duplicate::addRecord(uint32_t key, uint64_t kmer32, uint8_t gc){
-    mAddLock.lock();
-    if(mCounts[key] == 0){
-        mCounts[key] = 1;
-        mDups[key] = kmer32;
-        mGC[key] = gc;
-    }else{
-        if(mDups[key] == kmer32){
-            ++mCounts[key];
-        }else if(mDups[key] > kmer32){
-            mDups[key] = kmer32;
-            mCounts[key] = 1;
-            mGC[key] = gc;
+    std::atomic<DupSlot>& slot = mSlots[key];
+    DupSlot cur = slot.load(std::memory_order_relaxed);
+    DupSlot next;
+    do{
+        if(cur.count == 0 || cur.kmer > kmer32){
+            next.kmer = kmer32;
+            next.count = 1;
+            next.gc = gc;
+        }else if(cur.kmer == kmer32){
+            next = cur;
+            ++next.count;
+        }else{
+            return;
         }
-    }
-    mAddLock.unlock();
+    }while(!slot.compare_exchange_weak(cur, next, std::memory_order_relaxed));
 }
 
 void Duplicate::statRead(Read* r){
@@ -70,6 +89,13 @@ void Duplicate::statRead(Read* r){
     int start2 = std::max(0, r->length() - 32 - 5);
 
     const char* cstr = r->seq.seqStr.c_str();
+    if(mTable){
+        uint64_t hash = DupHashTable::hashOf(cstr, r->length(), 0);
+        if(mTable->sampled(hash)){
+            mTable->add(hash, std::round(255.0 * gcCount(cstr, r->length()) / (double) r->length()));
+        }
+        return;
+    }
     bool valid = true;
     uint64_t ret = seq2int(cstr, start1, mKeyLenInBase, valid);
     uint32_t key = (uint32_t)ret;
@@ -81,7 +107,7 @@ void Duplicate::statRead(Read* r){
         return;
     }
     uint8_t gc = 0;
-    if(mCounts[key] == 0){
+    if(isEmpty(key)){
         for(int i = 0; i < r->length(); ++i){
             if(cstr[i] == 'C' || cstr[i] == 'G'){
                 ++gc;
@@ -98,6 +124,14 @@ void Duplicate::statPair(Read* r1, Read* r2){
     }
     const char* cstr1 = r1->seq.seqStr.c_str();
     const char* cstr2 = r2->seq.seqStr.c_str();
+    if(mTable){
+        uint64_t hash = DupHashTable::hashOf(cstr2, r2->length(), DupHashTable::hashOf(cstr1, r1->length(), 0));
+        if(mTable->sampled(hash)){
+            int gc = gcCount(cstr1, r1->length()) + gcCount(cstr2, r2->length());
+            mTable->add(hash, std::round(255.0 * gc / (double)(r1->length() + r2->length())));
+        }
+        return;
+    }
     bool valid = true;
 
     uint64_t ret = seq2int(cstr1, 0, mKeyLenInBase, valid);
@@ -111,7 +145,7 @@ void Duplicate::statPair(Read* r1, Read* r2){
     }
 
     uint8_t gc = 0;
-    if(mCounts[key] == 0){
+    if(isEmpty(key)){
         for(int i = 0; i < r1->length(); ++i){
             if(cstr1[i] == 'C' || cstr1[i] == 'G'){
                 ++gc;
@@ -128,18 +162,35 @@ void Duplicate::statPair(Read* r1, Read* r2){
     addRecord(key, kmer32, gc);
 }
 
-double Duplicate::statAll(size_t* hist, double* meanGC, size_t histSize){
+int Duplicate::gcCount(const char* cstr, int len){
+    int gc = 0;
+    for(int i = 0; i < len; ++i){
+        if(cstr[i] == 'C' || cstr[i] == 'G'){
+            ++gc;
+        }
+    }
+    return gc;
+}
+
+double Duplicate::statAll(size_t* hist, double* meanGC, size_t histSize, double& error){
+    if(mTable){
+        double rate = mTable->statAll(hist, meanGC, histSize, error);
+        util::loginfo("duplication analysis sampled 1/" + std::to_string(1UL << mTable->getLevel()) + " of distinct reads, rate error " + std::to_string(error), mOptions->logmtx);
+        return rate;
+    }
+    error = 0.0;
     size_t totalNum = 0;
     size_t dupNum = 0;
     int* gcStatNum = new int[histSize];
     std::memset(gcStatNum, 0, sizeof(int) * histSize);
     for(uint64_t key = 0; key < mKeyLenInBit; ++key){
-        uint32_t count = mCounts[key];
-        uint8_t gc = mGC[key];
+        DupSlot rec = mSlots[key].load(std::memory_order_relaxed);
+        uint32_t count = rec.count;
+        uint8_t gc = rec.gc;
         if(count > 0){
             totalNum += count;
             dupNum += count - 1;
-            if(count > histSize){
+            if(count >= histSize){
                 ++hist[histSize - 1];
                 meanGC[histSize - 1] += gc;
                 ++gcStatNum[histSize - 1];
@@ -5,13 +5,30 @@
 #include <cstdlib>
 #include <string>
 #include <memory>
-#include <mutex>
+#include <atomic>
 #include <cmath>
 #include "options.h"
 #include "read.h"
 #include "overlapanalysis.h"
+#include "duphashtable.h"
 
-/** Class to do reads duplication analysis */
+/** struct to hold the record of one key, updated as a whole by one 16 bytes CAS\n
+ * the kmer32 takes 64 bits, so the record can not be packed into 8 bytes
+ */
+struct DupSlot{
+    uint64_t kmer;  ///< the smallest kmer32 encountered with the key
+    uint32_t count; ///< the number of reads with the key and this kmer32, 0 if the key not encountered yet
+    uint32_t gc;    ///< the GC ratio * 255.0 of the read recorded with this kmer32
+};
+
+/** Class to do reads duplication analysis\n
+ * workers update the records without a lock of their own: each record is one 16 bytes slot swapped by a CAS loop,\n
+ * so reads with different keys never contend and reads with the same key only retry on conflict\n
+ * std::atomic<DupSlot> is not lock free in libstdc++, its operations are calls into libatomic(-latomic in configure.ac),\n
+ * which uses cmpxchg16b where the CPU has it and falls back to a table of locks hashed by address otherwise\n
+ * if duplicate.sparse is set, records are kept by a hash of the whole read(or pair) in a DupHashTable of fixed size instead,\n
+ * which samples reads by hash once the table fills up
+ */
 class Duplicate{
     public:
         /** Construct a Duplicate object and allocate resources */
@@ -35,20 +52,23 @@ class Duplicate{
          */
         void statPair(Read* r1, Read* r2);
 
-        /** Add duplicate statistical items to record array\n
-         * mDups[key] = (the kmer32 to key with the highest GC encountered)\n
-         * mCounts[key] = (the number of kmer32 with the same key)\n
-         * mGC[key] = (the GC ratio * 255.0 of the kmer32 to key)\n
+        /** Add duplicate statistical items to record array, thread safe(may take a libatomic lock)\n
+         * mSlots[key].kmer = (the smallest kmer32 with the key encountered)\n
+         * mSlots[key].count = (the number of reads with the key and this kmer32)\n
+         * mSlots[key].gc = (the GC ratio * 255.0 of the first read recorded with this kmer32)\n
+         * kmer and count do not depend on the order reads are added, but gc does: among reads with the key and the\n
+         * smallest kmer32 the one recorded first is kept, so MeanGC may differ between runs with several threads
          */
         void addRecord(uint32_t key, uint64_t kmer32, uint8_t gc);
         
         /** Do analysis of all reads\n
-         * @param hist hist[i] is corresponding the mCounts value i, if greater than histSize just keep it in histSize - 1
-         * @param meanGC meanGC[i] is the corresponding average gc ratio of all keys with hist[i] mCounts value
+         * @param hist hist[i] is corresponding the count value i, if greater than histSize - 1 just keep it in histSize - 1
+         * @param meanGC meanGC[i] is the corresponding average gc ratio of all keys with hist[i] count value
          * @param histSize the length of hist/meanGC array 
+         * @param error to store the standard error of the result caused by sampling, 0 if all reads counted
          * @return total duplicate ratio of all reads
          */
-        double statAll(size_t* hist, double* meanGC, size_t histSize);
+        double statAll(size_t* hist, double* meanGC, size_t histSize, double& error);
         
         /** Convert an sequence consists of ATCG in to integer
          * @param cstr a C string pointer
@@ -57,15 +77,32 @@ class Duplicate{
          * @param valid if true the convert is valid, invalidate conversion only will happen if any N in cstr[start]...cstr[start + keylen - 1]
          */ 
         uint64_t seq2int(const char* cstr, int start, int keylen, bool& valid);
+
+        /** get bytes of the duplicate tables
+         * @return bytes of mSlots or mTable
+         */
+        size_t getMemoryBytes();
+
+    private:
+        /** test whether a key has not been encountered yet
+         * @param key key to test
+         * @return true if no read with the key added
+         */
+        bool isEmpty(uint32_t key);
+
+        /** count G and C bases of a sequence
+         * @param cstr pointer to the sequence
+         * @param len length of the sequence
+         * @return number of G and C bases
+         */
+        static int gcCount(const char* cstr, int len);
     
     private: 
-        Options* mOptions;     ///< Options Object to provide duplicate analysis options
-        int mKeyLenInBase;     ///< the length of the key in bases
-        uint64_t mKeyLenInBit; ///< the bits number needed to represent all kinds of keys
-        uint64_t* mDups;       ///< mDups[key] = (the kmer32 with the highest GC encountered)
-        uint32_t* mCounts;     ///< mCounts[key] = (the same kmer32 number eccountered)
-        uint8_t* mGC;          ///< mGC[key] = (the GC ratio * 255.0 of the kmer32)
-        std::mutex mAddLock;   ///< lock used to add record
+        Options* mOptions;              ///< Options Object to provide duplicate analysis options
+        int mKeyLenInBase;              ///< the length of the key in bases
+        uint64_t mKeyLenInBit;          ///< the bits number needed to represent all kinds of keys
+        std::atomic<DupSlot>* mSlots;   ///< mSlots[key] = (the record of reads with the key), NULL if sparse
+        DupHashTable* mTable;           ///< records of reads by hash if sparse, NULL otherwise
 };
         
 #endif
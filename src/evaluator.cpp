@@ -1,6 +1,10 @@
 #include "evaluator.h"
 
 int Evaluator::seq2int(const std::string& seq, int pos, int keylen, int lastVal){
+    return seq2int(seq.c_str(), pos, keylen, lastVal);
+}
+
+int Evaluator::seq2int(const char* seq, int pos, int keylen, int lastVal){
     if(lastVal >= 0){
         const int mask = (1 << (keylen * 2)) - 1;
         int key = (lastVal << 2) & mask;
@@ -60,86 +64,115 @@ std::string Evaluator::int2seq(size_t val, int seqLen){
     return ret;
 }
 
-void Evaluator::evaluateTwoColorSystem(){
-    FqReader fqr(mOptions->in1);
-    Read* r = fqr.read();
-
-    if(!r){
-        mOptions->est.twoColorSystem = false;
+void Evaluator::prescan(){
+    if(mSample1){
         return;
     }
+    mSample1 = new PrescanSample();
+    mSample2 = new PrescanSample();
+    // read2 is decoded in another thread while read1 decoded in this one
+    std::thread t(&PrescanSample::load, mSample2, mOptions->in2, mOptions->inflateThread);
+    mSample1->load(mOptions->in1, mOptions->inflateThread);
+    t.join();
+}
+
+void Evaluator::initInStream(){
+    mSample1 = new PrescanSample();
+    mSample2 = new PrescanSample();
+}
+
+bool Evaluator::addInStream(ReadPack* pack){
+    for(int i = 0; i < pack->count && !mSample1->isFull(); ++i){
+        mSample1->add(&pack->data[i]);
+    }
+    return mSample1->isFull();
+}
+
+bool Evaluator::addInStream(ReadPairPack* pack){
+    for(int i = 0; i < pack->count && !(mSample1->isFull() && mSample2->isFull()); ++i){
+        mSample1->add(&pack->left[i]);
+        mSample2->add(&pack->right[i]);
+    }
+    return mSample1->isFull() && mSample2->isFull();
+}
+
+void Evaluator::evaluateInStream(){
+    evaluateReadLen();
+    if(mOptions->overRepAna.enabled){
+        evaluateOverRepSeqs();
+    }
+    if(mOptions->adapter.enableDetectForPE){
+        evaluateAdapterSeq();
+    }
+}
+
+void Evaluator::evaluateTwoColorSystem(){
+    prescan();
+    const std::string& name = mSample1->firstName();
     // NEXTSEQ500, NEXTSEQ 550, NOVASEQ are two color system and with specific fastq read name pattern
-    if(util::startsWith(r->name, "@NS") || 
-       util::startsWith(r->name, "@NB") || 
-       util::startsWith(r->name, "@A0")){
-       delete r;
+    if(util::startsWith(name, "@NS") || 
+       util::startsWith(name, "@NB") || 
+       util::startsWith(name, "@A0")){
        mOptions->est.twoColorSystem = true;
        return;
     }
     
-    delete r;
     mOptions->est.twoColorSystem = false;
 }
 
 void Evaluator::evaluateReadLen(){
+    prescan();
     if(!mOptions->in1.empty()){
-        mOptions->est.seqLen1 = Evaluator::computeReadLen(mOptions->in1);
+        mOptions->est.seqLen1 = Evaluator::computeReadLen(mSample1);
     }
     if(!mOptions->in2.empty()){
-        mOptions->est.seqLen2 = Evaluator::computeReadLen(mOptions->in2);
+        mOptions->est.seqLen2 = Evaluator::computeReadLen(mSample2);
     }
 }
 
-int Evaluator::computeReadLen(const std::string& filename){
-    FqReader fqr(filename);
-    size_t records = 0;
-    Read* r = NULL;
-
+int Evaluator::computeReadLen(const PrescanSample* sample){
+    size_t records = std::min(sample->size(), (size_t)1000);
     int seqLen = 0;
-    while(records < 1000){
-        r = fqr.read();
-        if(!r){
-            break;
-        }
-        seqLen  = std::max(seqLen, r->length());
-        ++records;
-        delete r;
+    for(size_t i = 0; i < records; ++i){
+        seqLen  = std::max(seqLen, sample->length(i));
     }
     return seqLen;
 }
 
 void Evaluator::evaluateOverRepSeqs(){
+    prescan();
+    std::thread* t = NULL;
+    if(!mOptions->in2.empty()){
+        t = new std::thread(&Evaluator::computeOverRepSeq, this, mSample2, std::ref(mOptions->overRepAna.overRepSeqCountR2));
+    }
     if(!mOptions->in1.empty()){
-        computeOverRepSeq(mOptions->in1, mOptions->overRepAna.overRepSeqCountR1);
+        computeOverRepSeq(mSample1, mOptions->overRepAna.overRepSeqCountR1);
     }
-    if(!mOptions->in2.empty()){
-        computeOverRepSeq(mOptions->in2, mOptions->overRepAna.overRepSeqCountR2);
+    if(t){
+        t->join();
+        delete t;
     }
 }
 
-void Evaluator::computeOverRepSeq(const std::string& filename, std::map<std::string, size_t>& hotSeqs){
-    FqReader fqr(filename);
+void Evaluator::computeOverRepSeq(const PrescanSample* sample, std::map<std::string, size_t>& hotSeqs){
     std::map<std::string, size_t> seqCounts;
     const size_t BASE_LIMIT = 151 * 10000;
     size_t records = 0;
     size_t bases = 0;
-    Read* r = NULL;
+    const char* rseq = NULL;
     int rlen = 0;
     std::set<int> steps = {10, 20, 40, 100, std::min(150, 151 - 2)};
     std::string seq;
     size_t count;
 
-    while(bases < BASE_LIMIT){
-        r = fqr.read();
-        if(!r){
-            break;
-        }
-        rlen = r->length();
+    while(bases < BASE_LIMIT && records < sample->size()){
+        rseq = sample->seq(records);
+        rlen = sample->length(records);
         bases += rlen;
         ++records;
         for(auto& step: steps){
             for(int i = 0; i < rlen - step; ++i){
-                seq = r->seq.seqStr.substr(i, step);
+                seq.assign(rseq + i, step);
                 if(seqCounts.count(seq) > 0){
                     ++seqCounts[seq];
                 }else{
@@ -147,7 +180,6 @@ void Evaluator::computeOverRepSeq(const std::string& filename, std::map<std::str
                 }
             }
         }
-        delete r;
     }
 
     for(auto& e: seqCounts){
@@ -189,71 +221,44 @@ void Evaluator::computeOverRepSeq(const std::string& filename, std::map<std::str
 }
 
 void Evaluator::evaluateReadNum(){
-    FqReader fqr(mOptions->in1);
-    const size_t READ_LIMIT = 512 * 1024;
-    const size_t BASE_LIMIT = 151 * 512 * 1024;
-    size_t records = 0;
-    size_t bases = 0;
+    prescan();
+    // at most PrescanSample::SCAN_READ_LIMIT reads or PrescanSample::SCAN_BASE_LIMIT bases scanned
+    size_t records = mSample1->scannedReads();
     size_t firstReadPos = 0;
     size_t bytesRead;
     size_t bytesTotal;
-    bool reachedEOF = false;
-    bool first = true;
-    Read* r = NULL;
-    while(records < READ_LIMIT && bases < BASE_LIMIT){
-        r = fqr.read();
-        if(!r){
-            reachedEOF = true;
-            break;
-        }
-        if(first){
-            fqr.getBytes(bytesRead, bytesTotal);
-            firstReadPos = bytesRead;
-            first = false;
-        }
-        ++records;
-        bases += r->length();
-        delete r;
-    }
+    mSample1->getBytes(firstReadPos, bytesRead, bytesTotal);
     mOptions->est.readsNum = 0;
-    if(reachedEOF){
+    if(mSample1->reachedEOF()){
         mOptions->est.readsNum = records; 
     }else if(records > 1){
-        fqr.getBytes(bytesRead, bytesTotal);
         double bytesPerRead = (double)(bytesRead - firstReadPos) / (double) (records - 1);
         // bytesPerRead is a little over estimated due to some reasons unknown
         mOptions->est.readsNum = (size_t)(bytesTotal * 1.01 / bytesPerRead);
     }
 }
 
+void Evaluator::evaluateAdapterSeq(){
+    prescan();
+    std::thread t(static_cast<void (Evaluator::*)(bool)>(&Evaluator::evaluateAdapterSeq), this, true);
+    evaluateAdapterSeq(false);
+    t.join();
+}
+
 void Evaluator::evaluateAdapterSeq(bool isR2){
-    std::string filename = mOptions->in1;
-    if(isR2){
-        filename = mOptions->in2;
-    }
-    FqReader fqr (filename);
+    prescan();
+    const PrescanSample* sample = isR2 ? mSample2 : mSample1;
     const size_t READ_LIMIT = 256 * 1024;
     const size_t BASE_LIMIT = 151 * READ_LIMIT;
     size_t records = 0;
     size_t bases = 0;
-    Read** loadedReads = new Read*[READ_LIMIT];
-    std::memset(loadedReads, 0, sizeof(Read*) * READ_LIMIT);
 
-    while(records < READ_LIMIT && bases < BASE_LIMIT){
-        Read* r = fqr.read();
-        if(!r){
-            break;
-        }
-        bases += r->length();
-        loadedReads[records] = r;
+    while(records < READ_LIMIT && bases < BASE_LIMIT && records < sample->size()){
+        bases += sample->length(records);
         ++records;
     }
 
     if(records < 10000){
-        for(size_t i = 0; i < records; ++i){
-            delete loadedReads[i];
-            loadedReads[i] = NULL;
-        }
         if(isR2){
             mOptions->adapter.detectedAdapterSeqR2 = "";
         }else{
@@ -268,13 +273,13 @@ void Evaluator::evaluateAdapterSeq(bool isR2){
     size_t size = 1 << (keylen * 2);
     size_t* counts = new size_t[size];
     std::memset(counts, 0, sizeof(size_t) * size);
-    Read* r = NULL;
     int key = -1;
     for(size_t i = 0; i < records; ++i){
-        r = loadedReads[i];
+        const char* rseq = sample->seq(i);
+        int rlen = sample->length(i);
         key = -1;
-        for(int pos = 20; pos <= r->length() - keylen - shiftTail; ++pos){
-            key = seq2int(r->seq.seqStr, pos, keylen, key);
+        for(int pos = 20; pos <= rlen - keylen - shiftTail; ++pos){
+            key = seq2int(rseq, pos, keylen, key);
             if(key >= 0){
                 ++counts[key];
             }
@@ -358,14 +363,9 @@ void Evaluator::evaluateAdapterSeq(bool isR2){
         if(diff < 3){
             continue;
         }
-        std::string estAdapter = getAdapterWithSeed(key, loadedReads, records, keylen, mOptions->trim.tail1);
+        std::string estAdapter = getAdapterWithSeed(key, sample, records, keylen, mOptions->trim.tail1);
         if(!estAdapter.empty()){
             delete[] counts;
-            for(size_t r = 0; r < records; ++r){
-                delete loadedReads[r];
-                loadedReads[r] = NULL;
-            }
-            delete[] loadedReads;
             if(isR2){
                 mOptions->adapter.detectedAdapterSeqR2 = estAdapter;
             }else{
@@ -376,11 +376,6 @@ void Evaluator::evaluateAdapterSeq(bool isR2){
     }
             
     delete[] counts;
-    for(size_t r = 0; r < records; ++r){
-        delete loadedReads[r];
-        loadedReads[r] = NULL;
-    }
-    delete[] loadedReads;
 
     if(isR2){
         mOptions->adapter.detectedAdapterSeqR2 = "";
@@ -389,18 +384,19 @@ void Evaluator::evaluateAdapterSeq(bool isR2){
     }
 }
 
-std::string Evaluator::getAdapterWithSeed(int seed, Read** loadedReads, long records, int keylen, int trim){
+std::string Evaluator::getAdapterWithSeed(int seed, const PrescanSample* sample, long records, int keylen, int trim){
     const int shiftTail = std::max(1, trim);
     NucleotideTree forwardTree, backwardTree;
     //construct trees
     for(int i = 0; i < records; ++i){
-        Read* r = loadedReads[i];
+        const char* rseq = sample->seq(i);
+        int rlen = sample->length(i);
         int key = -1;
-        for(int pos = 20; pos <= r->length() - keylen - shiftTail; ++pos){
-            key = seq2int(r->seq.seqStr, pos, keylen, key);
+        for(int pos = 20; pos <= rlen - keylen - shiftTail; ++pos){
+            key = seq2int(rseq, pos, keylen, key);
             if(key == seed){
-                forwardTree.addSeq(r->seq.seqStr.substr(pos + keylen, r->length() - keylen - shiftTail - pos));
-                backwardTree.addSeq(util::reverse(r->seq.seqStr.substr(0, pos)));
+                forwardTree.addSeq(std::string(rseq + pos + keylen, rlen - keylen - shiftTail - pos));
+                backwardTree.addSeq(util::reverse(std::string(rseq, pos)));
             }
         }
     }
@@ -413,7 +409,7 @@ std::string Evaluator::getAdapterWithSeed(int seed, Read** loadedReads, long rec
     }
     std::string matchedAdapter = matchKnownAdapter(adapter);
     if(!matchedAdapter.empty()){
-        std::map<std::string, std::string> knownAdapters = getKnownAdapter();
+        std::lock_guard<std::mutex> lk(mEstMtx);
         mOptions->est.illuminaAdapter = true;
         return matchedAdapter;
     }else{
@@ -7,9 +7,13 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <thread>
+#include <mutex>
 #include "read.h"
 #include "util.h"
 #include "fqreader.h"
+#include "prescan.h"
+#include "readpack.h"
 #include "options.h"
 #include "knownadapters.h"
 #include "nucleotidetree.h"
@@ -20,10 +24,38 @@ class Evaluator{
         /** Construct a evaluator
          * @param opt pointer to Options object
          */
-        Evaluator(Options* opt) : mOptions(opt){}
+        Evaluator(Options* opt) : mOptions(opt), mSample1(NULL), mSample2(NULL){}
         
         /** Destroy a evaluator */
-        ~Evaluator(){}
+        ~Evaluator(){
+            delete mSample1;
+            delete mSample2;
+        }
+
+        /** decode the head of read1/2 once into PrescanSamples shared by all evaluations\n
+         * read1 and read2 are decoded concurrently, evaluations call it on demand if not called before
+         */
+        void prescan();
+
+        /** start estimating from the first packs flowing through the pipeline instead of a prescan\n
+         * needed for streaming input which can not be rewound after a prescan
+         */
+        void initInStream();
+
+        /** add reads of a pack to the read1 sample
+         * @param pack pointer to ReadPack
+         * @return true if the sample is full and evaluateInStream can be called
+         */
+        bool addInStream(ReadPack* pack);
+
+        /** add pairs of a pack to the read1/read2 samples
+         * @param pack pointer to ReadPairPack
+         * @return true if the samples are full and evaluateInStream can be called
+         */
+        bool addInStream(ReadPairPack* pack);
+
+        /** evaluate read length, over represented sequences and adapter sequences on the samples added */
+        void evaluateInStream();
 
         /** evaluate number of reads in fastq file 
          * based on at most 512 * 1024 reads and at most 151 * 512 * 1024 bytes read
@@ -34,16 +66,16 @@ class Evaluator{
          * to estimate adapter sequence, there must be at least 10000 valid records read in
          * @param isR2 the evaluated fq is read2 if true
          */
-        void evaluateAdapterSeq(bool isR2 = false);
+        void evaluateAdapterSeq(bool isR2);
         
         /** Evaluate the max read length of read1/2 */
         void evaluateReadLen();
 
         /** Compute the maximum read length based on the first 1000 reads
-         * @param filename fastq file name
+         * @param sample pointer to PrescanSample of a fastq file
          * @return the maximum read length ovserved
          */
-        int computeReadLen(const std::string& filename);
+        int computeReadLen(const PrescanSample* sample);
        
         /** Evaluate the over represented sequences of read1/2 */
         void evaluateOverRepSeqs();
@@ -54,10 +86,10 @@ class Evaluator{
          * (length >= 151 - 1 && count >= 3) || (length >= 100 && count >= 5) || 
          * (length >= 40 && count >= 20) || (length >= 20 && count >= 100 || (length >= 10 && count >= 500)
          * remove substrings in the map if the count of substring is less than 10 * count of the string contains it
-         * @param filename fastq file to evaluate ORS
+         * @param sample pointer to PrescanSample of the fastq file to evaluate ORS
          * @param hotSeqs map to store over represented sequences
          */ 
-        void computeOverRepSeq(const std::string& filename, std::map<std::string, size_t>& hotSeqs);
+        void computeOverRepSeq(const PrescanSample* sample, std::map<std::string, size_t>& hotSeqs);
 
         /** Match a sequence seq agains known illumina adapters stored in knownadapters.h
          * seq length must be equal or greater than the matched adapter 
@@ -88,9 +120,22 @@ class Evaluator{
          */
         static int seq2int(const std::string& seq, int pos, int seqLen, int lastVal = -1);
 
+        /** convert the substring started at pos to pos + seqLen - 1 of a char array to int, the same as seq2int of string
+         * @param seq pointer to the whole sequence
+         * @param pos ini position of substring of seq
+         * @param seqLen length of substring to be converted
+         * @param lastVal the int representation of  substring started at pos - 1 to pos + seqLen - 2 of seq
+         * @return int representation of the substring started at pos to pos + seqLen - 1 of seq, may be -1
+         */
+        static int seq2int(const char* seq, int pos, int seqLen, int lastVal = -1);
+
         Options * mOptions;         ///< pointer to Options object
+        PrescanSample* mSample1;    ///< head of read1 decoded by prescan
+        PrescanSample* mSample2;    ///< head of read2 decoded by prescan
+        std::mutex mEstMtx;         ///< mutex to protect estimations shared by read1 and read2
 
-        /** evaluate the adapter sequences based on at most 256*1024 reads or 151 * 256 * 1024 bytes read in
+        /** evaluate the adapter sequences of read1 and read2 concurrently
+         * based on at most 256*1024 reads or 151 * 256 * 1024 bytes read in
          * to estimate adapter sequence, there must be at least 10000 valid records read in
          */
         void evaluateAdapterSeq();
@@ -105,13 +150,13 @@ class Evaluator{
          * and its in the top10 counts(excluding low complexity, high GC, GGGG** seq, count < 10 
          * or count < n * p ( n = FOLD_THRESHOLD, p = total/size) 
          * @param seed int representation of the seed sequence
-         * @param loadedReads loaded Reads to get the seed 
-         * @param records number of Reads loaded
+         * @param sample PrescanSample holding loaded reads to get the seed 
+         * @param records number of reads of sample used
          * @param keyLen length of subsquence
          * @param trim trim length of read from 3' end
          * @return adapter sequence detected
          */
-        std::string getAdapterWithSeed(int seed, Read** loadedReads, long records, int keyLen, int trim);
+        std::string getAdapterWithSeed(int seed, const PrescanSample* sample, long records, int keyLen, int trim);
 };
 
 #endif
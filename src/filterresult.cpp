@@ -190,6 +190,9 @@ std::ostream& operator<<(std::ostream& os, FilterResult* re){
     if(mOptions->complexityFilter.enabled){
         os << "reads failed due to low complexity: " << re->mFilterReadStats[COMMONCONST::FAIL_COMPLEXITY] << "\n";
     }
+    if(mOptions->dedup.enabled){
+        os << "reads dropped as duplicated: " << re->mFilterReadStats[COMMONCONST::FAIL_DUPLICATE] << "\n";
+    }
     if(mOptions->adapter.enableTriming){
         os << "reads with adapter trimmed: " << re->mTrimmedAdapterReads << "\n";
         os << "bases trimmed due to adapters: " << re->mTrimmedAdapterBases << "\n";
@@ -212,6 +215,9 @@ void FilterResult::reportJsonBasic(jsn::json& j){
     if(mOptions->complexityFilter.enabled){
         j["LowComplexityReads"] = mFilterReadStats[COMMONCONST::FAIL_COMPLEXITY];
     }
+    if(mOptions->dedup.enabled){
+        j["DuplicatedReads"] = mFilterReadStats[COMMONCONST::FAIL_DUPLICATE];
+    }
     if(mOptions->lengthFilter.enabled){
         j["TooShortReads"] = mFilterReadStats[COMMONCONST::FAIL_LENGTH];
         if(mOptions->lengthFilter.maxReadLength > 0){
@@ -232,6 +238,9 @@ CTML::Node FilterResult::reportHtmlBasic(size_t totalReads, size_t totalBases){
     if(mOptions->complexityFilter.enabled){
         table.AppendChild(htmlutil::make2ColRowNode("Low Complexity Reads", std::to_string(mFilterReadStats[COMMONCONST::FAIL_COMPLEXITY]) + "(" + std::to_string(mFilterReadStats[COMMONCONST::FAIL_COMPLEXITY] * 100.0 / totalReads) + "%)"));
     }
+    if(mOptions->dedup.enabled){
+        table.AppendChild(htmlutil::make2ColRowNode("Duplicated Reads", std::to_string(mFilterReadStats[COMMONCONST::FAIL_DUPLICATE]) + "(" + std::to_string(mFilterReadStats[COMMONCONST::FAIL_DUPLICATE] * 100.0 / totalReads) + "%)"));
+    }
     if(mOptions->lengthFilter.enabled){
         table.AppendChild(htmlutil::make2ColRowNode("Too Short Reads", std::to_string(mFilterReadStats[COMMONCONST::FAIL_LENGTH]) + "(" + std::to_string(mFilterReadStats[COMMONCONST::FAIL_LENGTH] * 100.0 / totalReads) + "%)"));
         if(mOptions->lengthFilter.maxReadLength > 0){
@@ -1,53 +1,220 @@
 #include "fqreader.h"
 
-FqReader::FqReader(const std::string& filename, const bool& hasQuality, const bool& phread64){
+FqReader::FqReader(const std::string& filename, const bool& hasQuality, const bool& phread64, const int& inflateThreads){
+    setDefaults(filename, hasQuality, phread64);
+    mInflateThreads = inflateThreads;
+    init();
+}
+
+FqReader::FqReader(const std::string& filename, const GzIndex* index, size_t startRecord, size_t endRecord,
+                   const bool& hasQuality, const bool& phread64){
+    setDefaults(filename, hasQuality, phread64);
+    mGzIndex = index;
+    mStartRecord = startRecord;
+    mEndRecord = endRecord;
+    init();
+}
+
+void FqReader::setDefaults(const std::string& filename, const bool& hasQuality, const bool& phread64){
     mFileName = filename;
     mGzipFile = NULL;
+    mBgzfReader = NULL;
+    mGzRange = NULL;
+    mGzIndex = NULL;
+    mStartRecord = 0;
+    mEndRecord = 0;
     mFile = NULL;
     mStdinMode = false;
     mPhread64 = phread64;
     mHasQuality = hasQuality;
     mFqBufSize = (1 << 20);
-    mBuf = new char[mFqBufSize];
+    mBuf = NULL;
+    mMapped = false;
+    mMapLen = 0;
+    mKeepRaw = false;
     mBufDataLen = 0;
     mBufUsedLen = 0;
     mNoLineBreakAtEnd = false;
-    init();
+    mInflateThreads = 1;
+    mLineBreaks = new size_t[MAX_LINE_BREAKS_INDEXED];
+    mChunks = NULL;
+    mChunkNum = 0;
+    mFillSeq = 0;
+    mConsumeSeq = 0;
+    mReleasedSeq = 0;
+    mHoldChunk = false;
+    mCurLast = false;
+    mStopFill = false;
+    mFillThread = NULL;
+    mBytesRead = 0;
+    mSpill = NULL;
+    mSpillCap = 0;
 }
 
 FqReader::~FqReader(){
     close();
-    delete mBuf;
     mBuf = nullptr;
+    delete[] mLineBreaks;
+    if(mChunks){
+        for(int i = 0; i < mChunkNum; ++i){
+            delete[] mChunks[i].buf;
+        }
+        delete[] mChunks;
+        mChunks = NULL;
+    }
+    delete[] mSpill;
 }
 
 bool FqReader::hasNoLineBreakAtEnd(){
     return mNoLineBreakAtEnd;
 }
 
-void FqReader::readToBuf(){
-    if(isZipped()){
-        mBufDataLen = ::gzread(mGzipFile, mBuf, mFqBufSize);
-        if(mBufDataLen == -1){
-            std::cerr << "Error to read gzip file" << std::endl;
+size_t FqReader::fillChunk(char* buf, size_t len){
+    size_t total = 0;
+    while(total < len){
+        size_t n = 0;
+        if(mGzRange){
+            n = mGzRange->read(buf + total, len - total);
+        }else if(mBgzfReader){
+            n = mBgzfReader->read(buf + total, len - total);
+        }else if(isZipped()){
+            int ret = ::gzread(mGzipFile, buf + total, len - total);
+            if(ret == -1){
+                std::cerr << "Error to read gzip file" << std::endl;
+                ret = 0;
+            }
+            n = ret;
+        }else{
+            n = std::fread(buf + total, 1, len - total, mFile);
+        }
+        if(n == 0){
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+void FqReader::fillTask(){
+    char lastByte = '\n';
+    while(true){
+        FqChunk* chunk = NULL;
+        {
+            std::unique_lock<std::mutex> lk(mChunkMtx);
+            mFreeCV.wait(lk, [this]{return mStopFill || mFillSeq < mReleasedSeq + mChunkNum;});
+            if(mStopFill){
+                break;
+            }
+            chunk = &mChunks[mFillSeq % mChunkNum];
+        }
+        // the chunk is not visible to the parser until it is marked ready, so fill it without lock
+        chunk->len = fillChunk(chunk->buf + CHUNK_HEADROOM, mFqBufSize);
+        chunk->last = chunk->len < (size_t)mFqBufSize;
+        if(chunk->len > 0){
+            lastByte = chunk->buf[CHUNK_HEADROOM + chunk->len - 1];
         }
+        // the offset goes with the chunk, the parser may be several chunks behind
+        if(mGzRange){
+            chunk->offset = mGzRange->compressedOffset();
+        }else if(mBgzfReader){
+            chunk->offset = mBgzfReader->compressedOffset();
+        }else if(mZipped){
+            chunk->offset = ::gzoffset(mGzipFile);
+        }else{
+            chunk->offset = std::ftell(mFile);
+        }
+        {
+            std::lock_guard<std::mutex> lk(mChunkMtx);
+            if(chunk->last){
+                mNoLineBreakAtEnd = (lastByte != '\n');
+            }
+            chunk->ready = true;
+            ++mFillSeq;
+        }
+        mReadyCV.notify_all();
+        if(chunk->last){
+            break;
+        }
+    }
+}
+
+void FqReader::readToBuf(){
+    if(mMapped){
+        // the whole file is mapped in mBuf already
+        return;
+    }
+    size_t tailLen = mBufUsedLen < mBufDataLen ? mBufDataLen - mBufUsedLen : 0;
+    if(mCurLast){
+        // no more chunks after the last one
+        mBuf += mBufUsedLen;
+        mBufDataLen = tailLen;
+        mBufUsedLen = 0;
+        return;
+    }
+    FqChunk* chunk = &mChunks[mConsumeSeq % mChunkNum];
+    {
+        std::unique_lock<std::mutex> lk(mChunkMtx);
+        mReadyCV.wait(lk, [chunk]{return chunk->ready;});
+    }
+    char* tail = mBuf + mBufUsedLen;
+    size_t dataLen = tailLen + chunk->len;
+    if(tailLen <= CHUNK_HEADROOM){
+        // put the tail in the headroom, so the line crossing two chunks becomes contiguous
+        mBuf = chunk->buf + CHUNK_HEADROOM - tailLen;
+        std::memcpy(mBuf, tail, tailLen);
     }else{
-        mBufDataLen = std::fread(mBuf, 1, mFqBufSize, mFile);
+        // tail too long for the headroom, join it with the chunk in mSpill
+        if(mSpillCap < dataLen){
+            char* spill = new char[dataLen];
+            std::memcpy(spill, tail, tailLen);
+            delete[] mSpill;
+            mSpill = spill;
+            mSpillCap = dataLen;
+        }else{
+            std::memmove(mSpill, tail, tailLen);
+        }
+        std::memcpy(mSpill + tailLen, chunk->buf + CHUNK_HEADROOM, chunk->len);
+        mBuf = mSpill;
     }
+    mBufDataLen = dataLen;
     mBufUsedLen = 0;
-    if(mBufDataLen < mFqBufSize){
-        if(mBuf[mBufDataLen - 1] != '\n'){
-            mNoLineBreakAtEnd = true;
+    mCurLast = chunk->last;
+    mBytesRead = chunk->offset;
+    ++mConsumeSeq;
+    // the previous chunk is no longer referenced, and the new one neither if it went to mSpill
+    {
+        std::lock_guard<std::mutex> lk(mChunkMtx);
+        if(mHoldChunk){
+            mChunks[mReleasedSeq % mChunkNum].ready = false;
+            ++mReleasedSeq;
+        }
+        mHoldChunk = (mBuf != mSpill);
+        if(!mHoldChunk){
+            chunk->ready = false;
+            ++mReleasedSeq;
         }
     }
+    mFreeCV.notify_all();
 }
 
 void FqReader::init(){
-    if(util::endsWith(mFileName, ".gz")){
+    if(mGzIndex){
+        // inflate from the checkpoint before mStartRecord
+        mGzRange = new GzIndexReader(mFileName, mGzIndex, mStartRecord, mEndRecord);
+        mZipped = true;
+    }else if(util::endsWith(mFileName, ".gz") && BgzfReader::isBgzf(mFileName)){
+        // BGZF blocks can be located without inflating, so inflate them in parallel
+        mBgzfReader = new BgzfReader(mFileName, mInflateThreads);
+        mZipped = true;
+    }else if(util::endsWith(mFileName, ".gz")){
         mGzipFile = ::gzopen(mFileName.c_str(), "r");
         mZipped = true;
         ::gzrewind(mGzipFile);
     }else{
+        mZipped = false;
+        if(mFileName != "/dev/stdin" && mapFile()){
+            return;
+        }
         if(mFileName == "/dev/stdin"){
             mFile = stdin;
         }else{
@@ -56,16 +223,141 @@ void FqReader::init(){
         if(mFile == NULL){
             util::errorExit("Failed to open file: " + mFileName);
         }
-        mZipped = false;
     }
+    if(mZipped && mGzipFile == NULL && mBgzfReader == NULL && mGzRange == NULL){
+        return;
+    }
+    // decompress in a separated thread into a ring of recycled chunks, so inflating overlaps parsing
+    mChunkNum = CHUNK_NUM;
+    mChunks = new FqChunk[mChunkNum];
+    for(int i = 0; i < mChunkNum; ++i){
+        mChunks[i].buf = new char[CHUNK_HEADROOM + mFqBufSize];
+        mChunks[i].len = 0;
+        mChunks[i].offset = 0;
+        mChunks[i].last = false;
+        mChunks[i].ready = false;
+    }
+    mFillThread = new std::thread(&FqReader::fillTask, this);
     readToBuf();
 }
 
+bool FqReader::mapFile(){
+    int fd = ::open(mFileName.c_str(), O_RDONLY);
+    if(fd < 0){
+        util::errorExit("Failed to open file: " + mFileName);
+    }
+    struct stat st;
+    // only regular non-empty files can be mapped, pipes and fifos go through fread
+    if(::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0){
+        ::close(fd);
+        return false;
+    }
+    void* addr = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED){
+        return false;
+    }
+    ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+    mBuf = (char*)addr;
+    mBufDataLen = st.st_size;
+    mBufUsedLen = 0;
+    mMapLen = st.st_size;
+    mMapped = true;
+    mNoLineBreakAtEnd = (mBuf[mBufDataLen - 1] != '\n');
+    return true;
+}
+
+bool FqReader::isMapped(){
+    return mMapped;
+}
+
+size_t FqReader::mappedSize(){
+    return mMapLen;
+}
+
+void FqReader::setKeepRaw(bool keep){
+    mKeepRaw = keep;
+}
+
+void FqReader::setRange(size_t begin, size_t end){
+    if(!mMapped){
+        return;
+    }
+    mBufUsedLen = std::min(begin, mMapLen);
+    mBufDataLen = std::min(end, mMapLen);
+}
+
+size_t FqReader::lineEnd(size_t offset){
+    const char* p = (const char*)std::memchr(mBuf + offset, '\n', mMapLen - offset);
+    return p ? p - mBuf : mMapLen;
+}
+
+size_t FqReader::nextRecordStart(size_t offset){
+    if(!mMapped || offset >= mMapLen){
+        return mMapLen;
+    }
+    size_t start = offset;
+    // move to the start of a line
+    if(start > 0 && mBuf[start - 1] != '\n'){
+        start = lineEnd(start) + 1;
+    }
+    while(start < mMapLen){
+        size_t next = lineEnd(start) + 1;
+        if(mBuf[start] == '@'){
+            // name, sequence, strand, quality
+            size_t ends[4];
+            size_t ls = start;
+            int l = 0;
+            for(; l < 4 && ls < mMapLen; ++l){
+                ends[l] = lineEnd(ls);
+                ls = ends[l] + 1;
+            }
+            // a quality line starting with '@' is followed by name and sequence, never by a '+' line
+            if(l == 4 && ends[1] + 1 < mMapLen && mBuf[ends[1] + 1] == '+' &&
+               ends[1] - ends[0] == ends[3] - ends[2] && (ls >= mMapLen || mBuf[ls] == '@')){
+                return start;
+            }
+        }
+        start = next;
+    }
+    return mMapLen;
+}
+
+std::vector<size_t> FqReader::splitRanges(int n){
+    std::vector<size_t> bounds;
+    if(!mMapped){
+        return bounds;
+    }
+    n = std::max((size_t)1, std::min((size_t)n, mMapLen / MIN_PARSE_RANGE_SIZE));
+    bounds.push_back(0);
+    for(int i = 1; i < n; ++i){
+        size_t b = nextRecordStart(mMapLen / n * i);
+        if(b > bounds.back() && b < mMapLen){
+            bounds.push_back(b);
+        }
+    }
+    bounds.push_back(mMapLen);
+    return bounds;
+}
+
+size_t FqReader::countLines(size_t begin, size_t end){
+    return std::count(mBuf + begin, mBuf + end, '\n');
+}
+
+size_t FqReader::skipLines(size_t begin, size_t lines){
+    size_t pos = begin;
+    for(size_t i = 0; i < lines && pos < mMapLen; ++i){
+        pos = lineEnd(pos) + 1;
+    }
+    return std::min(pos, mMapLen);
+}
+
 void FqReader::getBytes(size_t& bytesRead, size_t& bytesTotal){
-    if(mZipped){
-        bytesRead = ::gzoffset(mGzipFile);
+    if(mMapped){
+        bytesRead = mBufUsedLen;
     }else{
-        bytesRead = std::ftell(mFile);
+        // file handlers are owned by mFillThread, it records the offset with each chunk
+        bytesRead = mBytesRead;
     }
     
     // use another ifstream without affecting the current reader
@@ -88,114 +380,219 @@ void FqReader::clearLineBreaks(char* line){
 }
 
 std::string FqReader::getLine(){
-    int start = mBufUsedLen;
-    int end = start;
-    
-    // look for '\r' or '\n' until the end of mBuf
-    while(end < mBufDataLen){
-        if(mBuf[end] != '\r' && mBuf[end] != '\n'){
-            ++end;
-        }else{
-            break;
-        }
-    }
-
-    // if '\r' or '\n' found(this line well contained in this mBuf)
-    // or this is the last mBuf of file
-    if(end < mBufDataLen || mBufDataLen < mFqBufSize){
-        int len = end - start;
-        std::string line(mBuf + start, len);
-        ++end;
-        if(end < mBufDataLen - 1 && mBuf[end] == '\n'){
-            ++end;
-        }
-        mBufUsedLen = end;
-        return line;
-    }
+    std::string line;
+    getLine(line);
+    return line;
+}
 
-    // if '\r' or '\n' not found && this is not the last mBuf of file
-    // then this line is not contained in this mBuf, we should read new mBuf
-    std::string str(mBuf + start, mBufDataLen - start);
+void FqReader::getLine(std::string& line){
+    size_t end = mBufUsedLen;
     while(true){
-        readToBuf();
-        start = 0;
-        end = 0;
         // look for '\r' or '\n' until the end of mBuf
-        while(end < mBufDataLen){
-            if(mBuf[end] != '\r' && mBuf[end] != '\n'){
-                ++end;
-            }else{
-                break;
-            }
+        while(end < mBufDataLen && mBuf[end] != '\r' && mBuf[end] != '\n'){
+            ++end;
         }
-
         // if '\r' or '\n' found(this line well contained in this mBuf)
         // or this is the last mBuf of file
-        if(end < mBufDataLen || mBufDataLen < mFqBufSize){
-            int len = end - start;
-            str.append(mBuf + start, len);
-            ++end;
-            if(end < mBufDataLen - 1 && mBuf[end] == '\n'){
-                ++end;
-            }
-            mBufUsedLen = end;
-            return str;
+        if(end < mBufDataLen || isLastBuf()){
+            break;
         }
-
-        // if '\r' or '\n' not found && this is not the last mBuf of file
-        // then this line is not contained in this mBuf, we should read new mBuf
-        str.append(mBuf + start, mBufDataLen - start);
+        // this line crosses the end of mBuf, readToBuf puts its head in front of the next chunk
+        size_t scanned = end - std::min(mBufUsedLen, end);
+        readToBuf();
+        end = mBufUsedLen + scanned;
     }
-    return std::string();
+    // copy the line into its destination directly, the capacity of line is reused
+    line.assign(mBuf + mBufUsedLen, end - std::min(mBufUsedLen, end));
+    ++end;
+    if(end + 1 < mBufDataLen && mBuf[end] == '\n'){
+        ++end;
+    }
+    mBufUsedLen = end;
+}
+
+bool FqReader::isLastBuf(){
+    return mMapped || mCurLast || mChunks == NULL;
 }
 
 bool FqReader::eof(){
-    if(mZipped){
-        return ::gzeof(mGzipFile);
+    if(mMapped || mChunks == NULL){
+        return true;
     }else{
-        return std::feof(mFile);
+        return mCurLast;
     }
 }
 
 Read* FqReader::read(){
-    if(mZipped && mGzipFile == NULL){
+    Read* r = new Read();
+    if(!read(r)){
+        delete r;
         return NULL;
     }
+    return r;
+}
+
+bool FqReader::read(Read* r){
+    if(mZipped && mGzipFile == NULL && mBgzfReader == NULL && mGzRange == NULL){
+        return false;
+    }
     if(mBufUsedLen >= mBufDataLen && eof()){
-        return NULL;
+        return false;
     }
 
-    std::string name = getLine();
-    while((name.empty() && !(mBufUsedLen >= mBufDataLen && eof())) || (!name.empty() && name[0] !='@')){
-        name = getLine();
+    // parse each line straight into the Read members so every base is copied only once
+    r->raw = NULL;
+    getLine(r->name);
+    while((r->name.empty() && !(mBufUsedLen >= mBufDataLen && eof())) || (!r->name.empty() && r->name[0] !='@')){
+        getLine(r->name);
     }
-    if(name.empty()){
-        return NULL;
+    if(r->name.empty()){
+        return false;
     }
 
-    std::string sequence = getLine();
-    std::string strand = getLine();
+    getLine(r->seq.seqStr);
+    getLine(r->strand);
+    r->hasQuality = true;
     // some fq has no quality, then construct the quality string with all 'K'
     if(!mHasQuality){
-        std::string quality = std::string(sequence.length(), 'K');
-        return new Read(name, sequence, strand, quality, mPhread64);
+        r->quality.assign(r->seq.seqStr.length(), 'K');
     }else{
-        std::string quality = getLine();
-        if(quality.length() != sequence.length()){
+        getLine(r->quality);
+        if(r->quality.length() != r->seq.seqStr.length()){
             std::cerr << "Error: base sequnce and quality sequence have different length: \n";
-            std::cerr << name << "\n";
-            std::cerr << sequence << "\n";
-            std::cerr << quality << "\n";
-            std::cerr << strand << "\n";
-            return NULL;
+            std::cerr << r->name << "\n";
+            std::cerr << r->seq.seqStr << "\n";
+            std::cerr << r->quality << "\n";
+            std::cerr << r->strand << "\n";
+            return false;
         }
-        return new Read(name, sequence, strand, quality, mPhread64);
     }
-    return NULL;
+    if(mPhread64){
+        r->convertPhread64To33();
+    }
+    return true;
+}
+
+int FqReader::cutRecord(Read* r, size_t origin, size_t found, size_t& b){
+    int lineNum = mHasQuality ? 4 : 3;
+    // start and end(line break excluded) of each line in mBuf
+    size_t starts[4];
+    size_t ends[4];
+    size_t start = mBufUsedLen;
+    size_t k = b;
+    for(int l = 0; l < lineNum; ++l){
+        if(k >= found){
+            return 0;
+        }
+        starts[l] = start;
+        ends[l] = origin + mLineBreaks[k];
+        start = ends[l] + 1;
+        ++k;
+        // getLine swallows one '\n' following a line break, unless it is the last byte of mBuf
+        if(start + 1 < mBufDataLen && mBuf[start] == '\n'){
+            if(k >= found){
+                return 0;
+            }
+            ++start;
+            ++k;
+        }
+    }
+    size_t seqLen = ends[1] - starts[1];
+    if(ends[0] == starts[0] || mBuf[starts[0]] != '@'){
+        return -1;
+    }
+    if(mHasQuality && ends[3] - starts[3] != seqLen){
+        // let read() report the malformed record
+        return -1;
+    }
+    r->name.assign(mBuf + starts[0], ends[0] - starts[0]);
+    r->seq.seqStr.assign(mBuf + starts[1], seqLen);
+    r->strand.assign(mBuf + starts[2], ends[2] - starts[2]);
+    r->hasQuality = true;
+    if(!mHasQuality){
+        r->quality.assign(seqLen, 'K');
+    }else if(mPhread64){
+        // convert to phred33 while copying
+        r->quality.resize(seqLen);
+        const char* qual = mBuf + starts[3];
+        for(size_t i = 0; i < seqLen; ++i){
+            r->quality[i] = std::max(33, qual[i] - (64 - 33));
+        }
+    }else{
+        r->quality.assign(mBuf + starts[3], seqLen);
+    }
+    // phred64 quality is converted and a missing quality is made up, so the record is no longer the one in mBuf
+    r->raw = (mMapped && mKeepRaw && mHasQuality && !mPhread64) ? mBuf + starts[0] : NULL;
+    r->rawLen = start - starts[0];
+    mBufUsedLen = start;
+    b = k;
+    return 1;
+}
+
+int FqReader::readBatch(Read* reads, int n){
+    int count = 0;
+    while(count < n){
+        size_t origin = mBufUsedLen;
+        size_t found = 0;
+        if(origin < mBufDataLen){
+            found = simd::indexLineBreaks(mBuf + origin, mBufDataLen - origin, mLineBreaks, MAX_LINE_BREAKS_INDEXED);
+        }
+        size_t b = 0;
+        int ret = 0;
+        while(count < n && (ret = cutRecord(&reads[count], origin, found, b)) > 0){
+            ++count;
+        }
+        if(count == n){
+            break;
+        }
+        if(ret == 0){
+            // the index is exhausted while mBuf has more lines, index again
+            if(found == MAX_LINE_BREAKS_INDEXED){
+                continue;
+            }
+            // the record crosses the end of mBuf, move its head in front of the next chunk
+            if(!isLastBuf()){
+                readToBuf();
+                continue;
+            }
+        }
+        // the last record without line break at end or a record not well formatted
+        if(!read(&reads[count])){
+            break;
+        }
+        ++count;
+    }
+    return count;
+}
+
+int FqReader::readBatch(ReadPack* pack, int limit){
+    int n = readBatch(pack->data + pack->count, limit - pack->count);
+    pack->count += n;
+    return n;
 }
 
 void FqReader::close(){
-    if(mZipped && mGzipFile){
+    if(mFillThread){
+        {
+            std::lock_guard<std::mutex> lk(mChunkMtx);
+            mStopFill = true;
+        }
+        mFreeCV.notify_all();
+        mFillThread->join();
+        delete mFillThread;
+        mFillThread = NULL;
+    }
+    if(mMapped){
+        if(mBuf){
+            ::munmap(mBuf, mMapLen);
+        }
+    }else if(mGzRange){
+        delete mGzRange;
+        mGzRange = NULL;
+    }else if(mBgzfReader){
+        delete mBgzfReader;
+        mBgzfReader = NULL;
+    }else if(mZipped && mGzipFile){
         ::gzclose(mGzipFile);
         mGzipFile = NULL;
     }else if(mFile){
@@ -230,13 +627,13 @@ bool FqReader::isZipped(){
 }
 
 FqReaderPair::FqReaderPair(const std::string& lname, const std::string& rname, const bool& hasQual,
-                           const bool& mPhread64, const bool& interleaved){
+                           const bool& mPhread64, const bool& interleaved, const int& inflateThreads){
     mInterleaved = interleaved;
-    left = new FqReader(lname, hasQual, mPhread64);
+    left = new FqReader(lname, hasQual, mPhread64, inflateThreads);
     if(interleaved){
         right = NULL;
     }else{
-        right = new FqReader(rname, hasQual, mPhread64);
+        right = new FqReader(rname, hasQual, mPhread64, inflateThreads);
     }
 }
 
@@ -251,6 +648,89 @@ FqReaderPair::~FqReaderPair(){
     }
 }
 
+bool FqReaderPair::read(Read* r1, Read* r2){
+    if(!left->read(r1)){
+        return false;
+    }
+    if(mInterleaved){
+        return left->read(r2);
+    }else{
+        return right->read(r2);
+    }
+}
+
+int FqReaderPair::readBatch(ReadPairPack* pack, int limit){
+    int n = 0;
+    if(mInterleaved){
+        while(pack->count + n < limit && read(&pack->left[pack->count + n], &pack->right[pack->count + n])){
+            ++n;
+        }
+    }else{
+        int nl = left->readBatch(pack->left + pack->count, limit - pack->count);
+        // pairs stop at the shorter file
+        n = right->readBatch(pack->right + pack->count, nl);
+    }
+    pack->count += n;
+    return n;
+}
+
+bool FqReaderPair::splitRanges(int n, std::vector<size_t>& leftBounds, std::vector<size_t>& rightBounds){
+    if(mInterleaved || !left->isMapped() || !right->isMapped()){
+        return false;
+    }
+    leftBounds = left->splitRanges(n);
+    int ranges = leftBounds.size() - 1;
+    if(ranges < 2){
+        return false;
+    }
+    // count lines of each read1 range and each read2 chunk in parallel
+    std::vector<size_t> leftLines(ranges, 0);
+    std::vector<size_t> chunkBounds(ranges + 1, 0);
+    std::vector<size_t> chunkLines(ranges, 0);
+    // '\n' can be counted in any chunk, so read2 chunks need not start on line starts
+    for(int i = 1; i < ranges; ++i){
+        chunkBounds[i] = right->mappedSize() / ranges * i;
+    }
+    chunkBounds[ranges] = right->mappedSize();
+    std::vector<std::thread> counters;
+    for(int i = 0; i < ranges; ++i){
+        counters.emplace_back([&, i]{
+            leftLines[i] = left->countLines(leftBounds[i], leftBounds[i + 1]);
+            chunkLines[i] = right->countLines(chunkBounds[i], chunkBounds[i + 1]);
+        });
+    }
+    for(auto& t: counters){
+        t.join();
+    }
+    // read2 is cut at the line number read1 ranges end at
+    rightBounds.assign(1, 0);
+    size_t lineNum = 0;
+    int chunk = 0;
+    size_t chunkStartLine = 0;
+    for(int i = 0; i < ranges - 1; ++i){
+        // every range except the last one ends on a record boundary, so its lines form whole records
+        if(leftLines[i] % 4 != 0){
+            return false;
+        }
+        lineNum += leftLines[i];
+        while(chunk < ranges && chunkStartLine + chunkLines[chunk] < lineNum){
+            chunkStartLine += chunkLines[chunk];
+            ++chunk;
+        }
+        size_t b = right->mappedSize();
+        if(chunk < ranges){
+            // skip to the line start after the (lineNum - chunkStartLine)th '\n' of the chunk
+            b = right->skipLines(chunkBounds[chunk], lineNum - chunkStartLine);
+        }
+        if(b < right->mappedSize() && right->nextRecordStart(b) != b){
+            return false;
+        }
+        rightBounds.push_back(b);
+    }
+    rightBounds.push_back(right->mappedSize());
+    return true;
+}
+
 ReadPair* FqReaderPair::read(){
     Read* pr1 = left->read();
     Read* pr2 = NULL;
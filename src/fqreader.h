@@ -4,35 +4,107 @@
 #include <zlib.h>
 #include "util.h"
 #include "read.h"
+#include "simd.h"
+#include "readpack.h"
+#include "gzindex.h"
+#include "bgzfreader.h"
 #include <cstdio>
 #include <fstream>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/** Class to hold a fastq reader
+/** struct to hold a chunk of input filled by the decompressing thread of FqReader\n
+ * data is stored after CHUNK_HEADROOM bytes of free room, so the unconsumed tail of\n
+ * the previous chunk can be put in front of it and lines never cross two chunks
+ */
+struct FqChunk{
+    char* buf;   ///< buffer of CHUNK_HEADROOM + chunk size bytes
+    size_t len;     ///< length of data filled after the headroom
+    size_t offset;  ///< bytes read from the input file once this chunk is filled
+    bool last;      ///< this is the last chunk of input if true
+    bool ready;     ///< data is filled and can be consumed if true
+};
+
+/** Class to hold a fastq reader\n
+ * compressed or streamed input is read by a decompressing thread into a ring of recycled chunks,\n
+ * so inflating and parsing overlap, plain files are memory mapped instead
  */
 class FqReader{
     std::string mFileName;  ///< name of fastq file
     gzFile mGzipFile;       ///< gzFile to store opened mZipped file handler
+    BgzfReader* mBgzfReader;///< parallel inflating reader used if the mZipped file is in BGZF format
+    GzIndexReader* mGzRange;///< reader of a record range of an indexed gzip file, used if mGzIndex is set
+    const GzIndex* mGzIndex;///< index of the gzip file to start reading from a checkpoint
+    size_t mStartRecord;    ///< number of the first record to read if mGzIndex is set
+    size_t mEndRecord;      ///< number after the last record to read if mGzIndex is set
     FILE* mFile;            ///< FILE pointer to store opened plain file handler
     bool mZipped;           ///< the fastq file is gzipped if true
     bool mHasQuality;       ///< the fastq file has quality sequence if true
     bool mPhread64;         ///< the fastq quality sequence is encoded as ASCII 64 based if true
-    char* mBuf;             ///< mBuffer to store a chunk of characters read from mGzipFile or mFile
-    int mBufDataLen;        ///< the length of characters read into the mBuffer after the last read
-    int mBufUsedLen;        ///< the length of characters already consumed in the mBuffer 
+    char* mBuf;             ///< mBuffer pointing to the chunk being parsed(with the tail of the previous chunk in front), or the whole mapped file
+    size_t mBufDataLen;     ///< the length of characters read into the mBuffer after the last read
+    size_t mBufUsedLen;     ///< the length of characters already consumed in the mBuffer 
+    bool mMapped;           ///< the plain fastq file is memory mapped into mBuf if true
+    size_t mMapLen;         ///< length of the file mapped into mBuf
+    bool mKeepRaw;          ///< reads parsed from a mapped file point to their records in mBuf if true
     bool mStdinMode;        ///< read from stdin if true
     bool mNoLineBreakAtEnd; ///< the fastq file has no '\n' as a line break at the last line if true
     int mFqBufSize;         ///< the mBuffer size used to read
+    int mInflateThreads;    ///< number of threads used to inflate BGZF input
+    size_t* mLineBreaks;    ///< offsets of line breaks in mBuf indexed by readBatch
+    FqChunk* mChunks;       ///< ring of chunks filled by mFillThread
+    int mChunkNum;          ///< number of chunks in mChunks
+    size_t mFillSeq;        ///< sequence number of the next chunk to fill
+    size_t mConsumeSeq;     ///< sequence number of the next chunk to parse
+    size_t mReleasedSeq;    ///< number of chunks released by the parser
+    bool mHoldChunk;        ///< mBuf points into chunk mConsumeSeq - 1 which is not released yet if true
+    bool mCurLast;          ///< mBuf holds the last chunk of input if true
+    bool mStopFill;         ///< mFillThread should quit if true
+    std::thread* mFillThread;          ///< decompressing thread filling mChunks
+    std::mutex mChunkMtx;              ///< mutex to protect chunk states
+    std::condition_variable mReadyCV;  ///< notified when a chunk is filled
+    std::condition_variable mFreeCV;   ///< notified when a chunk is released or mStopFill set
+    size_t mBytesRead;                 ///< bytes read from the input file up to the end of the chunk being parsed
+    char* mSpill;           ///< buffer to join a tail longer than CHUNK_HEADROOM with the next chunk
+    size_t mSpillCap;       ///< capacity of mSpill
+    
+    static const size_t MAX_LINE_BREAKS_INDEXED = 4096; ///< max number of line breaks indexed by readBatch in one sweep
+    static const size_t CHUNK_HEADROOM = (1 << 18);     ///< free room in front of each chunk to hold the tail of the previous one
+    static const int CHUNK_NUM = 4;                     ///< number of chunks in the ring
+
+    public:
+        static const size_t MIN_PARSE_RANGE_SIZE = (1 << 20); ///< min bytes of a range parsed by one producer
     
     public:
         /** Construct a FqReader with filename and hasQuality, phread64 arguments
          * @param filename Name of the fastq file
          * @param hasQuality The fastq has quality sequence if true
          * @param phread64 The fastq quality sequence is encoded as ASCII 64 if true
+         * @param inflateThreads number of threads used to inflate the fastq file if it is in BGZF format
          */
-        FqReader(const std::string& filename, const bool& hasQuality = true, const bool& phread64 = false);
+        FqReader(const std::string& filename, const bool& hasQuality = true, const bool& phread64 = false, const int& inflateThreads = 1);
+
+        /** Construct a FqReader to read a range of records of an indexed gzip fastq file\n
+         * inflating starts from the checkpoint of index nearest to the first record
+         * @param filename Name of the gzip fastq file
+         * @param index pointer to GzIndex of the file
+         * @param startRecord number of the first record to read
+         * @param endRecord number after the last record to read
+         * @param hasQuality The fastq has quality sequence if true
+         * @param phread64 The fastq quality sequence is encoded as ASCII 64 if true
+         */
+        FqReader(const std::string& filename, const GzIndex* index, size_t startRecord, size_t endRecord,
+                 const bool& hasQuality = true, const bool& phread64 = false);
         
         /** FqReader Destructor
          */
@@ -53,6 +125,31 @@ class FqReader{
          */
         Read* read();
 
+        /** Try to parse the next Read record from the current FqReader into an existing Read object\n
+         * the strings of r are overwritten and their capacity reused
+         * @param r pointer to the Read object to fill
+         * @return true if a Read record parsed, false if eof reached or failed during reading
+         */
+        bool read(Read* r);
+
+        /** Try to parse at most n Read records into an array of existing Read objects\n
+         * line breaks of mBuf are located with vector instructions in one sweep, then records well contained\n
+         * in mBuf are cut out directly with quality conversion and length check done while copying,\n
+         * a record crossing the end of mBuf is moved in front of the next chunk and cut out there,\n
+         * the last record without line break or records not well formatted are parsed by read(Read* r)
+         * @param reads array of Read objects to fill
+         * @param n max number of records to parse
+         * @return number of records parsed, less than n only if eof reached or failed during reading
+         */
+        int readBatch(Read* reads, int n);
+
+        /** Try to fill the free Read objects of a ReadPack
+         * @param pack pointer to ReadPack, pack->count is updated
+         * @param limit number of reads the pack should hold at most, no more than pack->capacity
+         * @return number of records parsed
+         */
+        int readBatch(ReadPack* pack, int limit);
+
         /** Tell whether the FqReader has reach the endof file
          * @return true if eof reached
          */
@@ -63,6 +160,57 @@ class FqReader{
          */ 
         bool hasNoLineBreakAtEnd();
 
+        /** Tell whether the fastq file is memory mapped, only mapped file can be parsed by ranges
+         * @return true if the fastq file is memory mapped
+         */
+        bool isMapped();
+
+        /** Get the length of the memory mapped fastq file
+         * @return length of the mapped file, 0 if not mapped
+         */
+        size_t mappedSize();
+
+        /** Let reads parsed from a memory mapped file point to their records in the mapping, see Read::raw\n
+         * the reads should not be output after this FqReader is destroyed, ignored if not mapped
+         * @param keep point to records if true
+         */
+        void setKeepRaw(bool keep);
+
+        /** Restrict parsing of a memory mapped file to bytes in [begin, end)\n
+         * begin and end should be record boundaries, see nextRecordStart
+         * @param begin offset of the first byte to parse
+         * @param end offset after the last byte to parse
+         */
+        void setRange(size_t begin, size_t end);
+
+        /** Find the start of the first record at or after an offset of a memory mapped file\n
+         * a line starting with '@' is accepted only if the next 3 lines look like the rest of a record\n
+         * and the line after them starts with '@' too, so quality lines starting with '@' are skipped
+         * @param offset offset to start searching
+         * @return offset of the record start, mappedSize() if no record found
+         */
+        size_t nextRecordStart(size_t offset);
+
+        /** Split a memory mapped file into at most n ranges starting on record boundaries
+         * @param n max number of ranges
+         * @return boundaries of ranges, range i is [bounds[i], bounds[i+1]), empty if the file is not mapped
+         */
+        std::vector<size_t> splitRanges(int n);
+
+        /** Count '\n' in bytes [begin, end) of a memory mapped file
+         * @param begin offset of the first byte to count
+         * @param end offset after the last byte to count
+         * @return number of '\n' found
+         */
+        size_t countLines(size_t begin, size_t end);
+
+        /** Skip some lines from an offset of a memory mapped file
+         * @param begin offset to start skipping, if it is not a line start the rest of its line counts as one line
+         * @param lines number of '\n' to skip
+         * @return offset of the line start after skipping, mappedSize() if end of file reached
+         */
+        size_t skipLines(size_t begin, size_t lines);
+
     public:
 
         /** tell whether the file is a mZipped fastq file
@@ -81,15 +229,39 @@ class FqReader{
          */
         std::string getLine();
 
+        /** get just one line from the mBuf into line, update the mBuf if needed\n
+         * the characters are copied into line directly and the capacity of line is reused
+         * @param line string to store the line without line breaks
+         */
+        void getLine(std::string& line);
+
     private:
 
+        /** set default values of members, called by constructors
+         * @param filename Name of the fastq file
+         * @param hasQuality The fastq has quality sequence if true
+         * @param phread64 The fastq quality sequence is encoded as ASCII 64 if true
+         */
+        void setDefaults(const std::string& filename, const bool& hasQuality, const bool& phread64);
+
         /** initialize the FqReader:
-         * 1, open file and store file handler into mGzipFile or mFile or read from stdin
+         * 1, open file and store file handler into mGzipFile, mBgzfReader(BGZF input), mGzRange(indexed range) or mFile or read from stdin
          * 2, set the starting position for the next read on compressed file stream file to the beginning of file 
          * 3, update the file format mZipped
          * 4, call readToBuf() to try to fill the mBuf from first reading
          */ 
         void init();
+
+        /** try to map a plain fastq file into mBuf and advise the kernel for sequential access\n
+         * only regular non-empty files can be mapped
+         * @return true if the file is mapped successfully
+         */
+        bool mapFile();
+
+        /** tell whether mBuf holds the last chunk of the file
+         * @return true if the file is mapped or the last reading does not fill mBuf
+         */
+        bool isLastBuf();
         
         /** close the FqReader:
          * 1, close file handler
@@ -97,16 +269,43 @@ class FqReader{
          */
         void close();
 
+        /** get the end(line break excluded) of the line starting at offset of a memory mapped file
+         * @param offset line start
+         * @return offset of the '\n' ending the line, or mappedSize() if the line is the last one without '\n'
+         */
+        size_t lineEnd(size_t offset);
+
         /** trim \n, \r or \r\n in the tail of the line
          */
         void clearLineBreaks(char* line);
         
-        /** try a reading action to fill the mBuf,
-         * update mBufDataLen to Bytes read during this reading action
-         * reset mBufUsedLen to zero
-         * if read the last line(mBuf is not filled), update mNoLineBreakAtEnd
+        /** switch mBuf to the next chunk filled by mFillThread\n
+         * the unconsumed tail of mBuf is moved in front of the next chunk,\n
+         * update mBufDataLen to the length of tail and chunk, reset mBufUsedLen to zero
          */
         void readToBuf();
+
+        /** task run by mFillThread, read or inflate input into free chunks until eof reached\n
+         * if read the last line, update mNoLineBreakAtEnd
+         */
+        void fillTask();
+
+        /** read or inflate at most len bytes of input
+         * @param buf buffer to store data
+         * @param len buffer length
+         * @return number of bytes stored in buf, less than len only if eof reached
+         */
+        size_t fillChunk(char* buf, size_t len);
+
+        /** cut one record out of mBuf using line breaks indexed by readBatch\n
+         * nothing is consumed if the record is not well contained in the indexed lines or not well formatted
+         * @param r pointer to the Read object to fill
+         * @param origin offset in mBuf where indexing of mLineBreaks started
+         * @param found number of line breaks indexed in mLineBreaks
+         * @param b index of the first line break in mLineBreaks not consumed yet, updated if record parsed
+         * @return 1 if record parsed, 0 if more indexed lines needed, -1 if record not well formatted
+         */
+        int cutRecord(Read* r, size_t origin, size_t found, size_t& b);
 };
 
 /** Class to hold a pair end fastq reader
@@ -122,7 +321,7 @@ class FqReaderPair{
          * @param rl Pointer to FqReader of read1
          * @param rr Pointer to FqReader of read2
          */
-        FqReaderPair(FqReader* rl, FqReader* rr) : left(rl), right(rr){}
+        FqReaderPair(FqReader* rl, FqReader* rr) : left(rl), right(rr), mInterleaved(false){}
         
         /** Construct a FqReaderPair from file names
          * @param lname read1 filename
@@ -130,9 +329,10 @@ class FqReaderPair{
          * @param hasQual whether the fastq has quality sequence or not, default true
          * @param mPhread64 whether the fastq quality sequence is encoded in ASCII 64 based chacacters, default false
          * @param interleaved whether the pairend fastq is interleaved(r1/r2 combined into one file) or not(r1/r2 in seperated files), default false
+         * @param inflateThreads number of threads used to inflate each BGZF input file, default 1
          */
         FqReaderPair(const std::string& lname, const std::string& rname, const bool& hasQual = true,
-                     const bool& mPhread64 = false, const bool& interleaved = false);
+                     const bool& mPhread64 = false, const bool& interleaved = false, const int& inflateThreads = 1);
         
         /** Destructor of FqReaderPair
          */ 
@@ -142,6 +342,30 @@ class FqReaderPair{
          * @return Pointer to object of ReadPair
          */
         ReadPair* read();
+
+        /** try to parse a pair of read into two existing Read objects
+         * @param r1 pointer to the Read object to store read1
+         * @param r2 pointer to the Read object to store read2
+         * @return true if a pair of read parsed
+         */
+        bool read(Read* r1, Read* r2);
+
+        /** try to fill the free pairs of a ReadPairPack
+         * @param pack pointer to ReadPairPack, pack->count is updated
+         * @param limit number of pairs the pack should hold at most, no more than pack->capacity
+         * @return number of pairs parsed
+         */
+        int readBatch(ReadPairPack* pack, int limit);
+
+        /** split a pair of memory mapped fastq files into at most n ranges holding the same number of records\n
+         * read1 is split by bytes on record boundaries, lines of each read1 range are counted in parallel,\n
+         * then read2 is cut at the same record numbers with lines counted in parallel too
+         * @param n max number of ranges
+         * @param leftBounds boundaries of read1 ranges
+         * @param rightBounds boundaries of read2 ranges
+         * @return true if both files are mapped, not interleaved and split into more than one range
+         */
+        bool splitRanges(int n, std::vector<size_t>& leftBounds, std::vector<size_t>& rightBounds);
 };
 
 #endif
@@ -0,0 +1,425 @@
+#include "gzindex.h"
+
+GzIndex::GzIndex(){
+    mSpan = 0;
+    mTotalRecords = 0;
+    mFileSize = 0;
+    mFileTime = 0;
+}
+
+GzIndex::~GzIndex(){
+    for(auto& p: mPoints){
+        delete[] p->window;
+        delete p;
+    }
+    mPoints.clear();
+}
+
+std::string GzIndex::indexName(const std::string& filename){
+    return filename + ".fqidx";
+}
+
+bool GzIndex::fileStamp(const std::string& filename, uint64_t& fsize, int64_t& mtime){
+    struct stat st;
+    if(::stat(filename.c_str(), &st) != 0){
+        return false;
+    }
+    fsize = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+void GzIndex::addCheckpoint(size_t in, int bits, size_t out, const unsigned char* window, size_t left){
+    GzCheckpoint* p = new GzCheckpoint;
+    p->in = in;
+    p->bits = bits;
+    p->out = out;
+    p->recordOut = 0;
+    p->records = 0;
+    p->window = new unsigned char[WINDOW_SIZE];
+    // window is circular, the oldest byte is right after the current position
+    if(left){
+        std::memcpy(p->window, window + WINDOW_SIZE - left, left);
+    }
+    if(left < WINDOW_SIZE){
+        std::memcpy(p->window + left, window, WINDOW_SIZE - left);
+    }
+    mPoints.push_back(p);
+}
+
+GzIndex* GzIndex::build(const std::string& filename, size_t span){
+    FILE* fp = std::fopen(filename.c_str(), "rb");
+    if(fp == NULL){
+        util::errorExit("Failed to open file: " + filename);
+    }
+    z_stream strm;
+    std::memset(&strm, 0, sizeof(z_stream));
+    // automatic zlib or gzip decoding
+    if(inflateInit2(&strm, 47) != Z_OK){
+        util::errorExit("Failed to initialize inflating stream");
+    }
+    GzIndex* index = new GzIndex();
+    index->mSpan = span;
+    fileStamp(filename, index->mFileSize, index->mFileTime);
+    unsigned char* input = new unsigned char[1 << 16];
+    unsigned char* window = new unsigned char[WINDOW_SIZE];
+    std::memset(window, 0, WINDOW_SIZE);
+    size_t totin = 0;
+    size_t totout = 0;
+    size_t last = 0;
+    size_t lines = 0;
+    bool atLineStart = true;
+    size_t pending = 0; // index of the first checkpoint whose record boundary not found yet
+    bool ok = true;
+    bool memberEnd = false;
+    strm.avail_out = 0;
+    while(ok){
+        strm.avail_in = std::fread(input, 1, 1 << 16, fp);
+        if(std::ferror(fp)){
+            ok = false;
+            break;
+        }
+        if(strm.avail_in == 0){
+            // the file should not end in the middle of a gzip member
+            ok = memberEnd;
+            break;
+        }
+        strm.next_in = input;
+        do{
+            if(strm.avail_out == 0){
+                strm.avail_out = WINDOW_SIZE;
+                strm.next_out = window;
+            }
+            unsigned char* before = strm.next_out;
+            totin += strm.avail_in;
+            totout += strm.avail_out;
+            int ret = inflate(&strm, Z_BLOCK);
+            totin -= strm.avail_in;
+            totout -= strm.avail_out;
+            if(ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR){
+                ok = false;
+                break;
+            }
+            // track record starts(every 4 lines) in the inflated data
+            unsigned char* pos = before;
+            unsigned char* end = strm.next_out;
+            size_t base = totout - (end - before);
+            while(pos < end){
+                if(atLineStart && lines % 4 == 0){
+                    if(*pos != '@'){
+                        ok = false;
+                        break;
+                    }
+                    size_t o = base + (pos - before);
+                    while(pending < index->mPoints.size()){
+                        index->mPoints[pending]->recordOut = o;
+                        index->mPoints[pending]->records = index->mTotalRecords;
+                        ++pending;
+                    }
+                    ++index->mTotalRecords;
+                }
+                unsigned char* q = (unsigned char*)std::memchr(pos, '\n', end - pos);
+                if(q == NULL){
+                    atLineStart = false;
+                    break;
+                }
+                ++lines;
+                atLineStart = true;
+                pos = q + 1;
+            }
+            if(!ok){
+                break;
+            }
+            memberEnd = (ret == Z_STREAM_END);
+            if(memberEnd){
+                // concatenated gzip members are inflated as one stream
+                inflateReset(&strm);
+                continue;
+            }
+            // a deflate block boundary(not after the last block) is a candidate checkpoint
+            if((strm.data_type & 128) && !(strm.data_type & 64) && (totout == 0 || totout - last >= span)){
+                index->addCheckpoint(totin, strm.data_type & 7, totout, window, strm.avail_out);
+                last = totout;
+            }
+        }while(strm.avail_in != 0);
+    }
+    inflateEnd(&strm);
+    std::fclose(fp);
+    delete[] input;
+    delete[] window;
+    // checkpoints after the last record start point to the end of data
+    while(ok && pending < index->mPoints.size()){
+        index->mPoints[pending]->recordOut = totout;
+        index->mPoints[pending]->records = index->mTotalRecords;
+        ++pending;
+    }
+    if(!ok || index->mPoints.empty()){
+        delete index;
+        return NULL;
+    }
+    return index;
+}
+
+bool GzIndex::save(const std::string& filename){
+    FILE* fp = std::fopen(indexName(filename).c_str(), "wb");
+    if(fp == NULL){
+        return false;
+    }
+    uint64_t header[5] = {mFileSize, (uint64_t)mFileTime, mSpan, mTotalRecords, mPoints.size()};
+    bool ok = std::fwrite("FQGZIDX1", 1, 8, fp) == 8 && std::fwrite(header, sizeof(uint64_t), 5, fp) == 5;
+    uLongf bound = compressBound(WINDOW_SIZE);
+    unsigned char* zwin = new unsigned char[bound];
+    for(size_t i = 0; ok && i < mPoints.size(); ++i){
+        GzCheckpoint* p = mPoints[i];
+        uint64_t fields[5] = {p->in, (uint64_t)p->bits, p->out, p->recordOut, p->records};
+        uLongf zlen = bound;
+        // windows are mostly text, compress them to keep the sidecar small
+        ok = compress2(zwin, &zlen, p->window, WINDOW_SIZE, 9) == Z_OK;
+        uint64_t zlen64 = zlen;
+        ok = ok && std::fwrite(fields, sizeof(uint64_t), 5, fp) == 5 && std::fwrite(&zlen64, sizeof(uint64_t), 1, fp) == 1 &&
+             std::fwrite(zwin, 1, zlen, fp) == zlen;
+    }
+    delete[] zwin;
+    ok = (std::fclose(fp) == 0) && ok;
+    return ok;
+}
+
+GzIndex* GzIndex::load(const std::string& filename){
+    uint64_t fsize = 0;
+    int64_t mtime = 0;
+    if(!fileStamp(filename, fsize, mtime)){
+        return NULL;
+    }
+    FILE* fp = std::fopen(indexName(filename).c_str(), "rb");
+    if(fp == NULL){
+        return NULL;
+    }
+    char magic[8];
+    uint64_t header[5];
+    if(std::fread(magic, 1, 8, fp) != 8 || std::memcmp(magic, "FQGZIDX1", 8) != 0 ||
+       std::fread(header, sizeof(uint64_t), 5, fp) != 5 || header[0] != fsize || (int64_t)header[1] != mtime){
+        // not an index or the gzip file changed after indexing
+        std::fclose(fp);
+        return NULL;
+    }
+    GzIndex* index = new GzIndex();
+    index->mFileSize = header[0];
+    index->mFileTime = header[1];
+    index->mSpan = header[2];
+    index->mTotalRecords = header[3];
+    uLongf bound = compressBound(WINDOW_SIZE);
+    unsigned char* zwin = new unsigned char[bound];
+    bool ok = true;
+    for(uint64_t i = 0; ok && i < header[4]; ++i){
+        uint64_t fields[5];
+        uint64_t zlen = 0;
+        ok = std::fread(fields, sizeof(uint64_t), 5, fp) == 5 && std::fread(&zlen, sizeof(uint64_t), 1, fp) == 1 &&
+             zlen <= bound && std::fread(zwin, 1, zlen, fp) == zlen;
+        if(!ok){
+            break;
+        }
+        GzCheckpoint* p = new GzCheckpoint;
+        p->in = fields[0];
+        p->bits = fields[1];
+        p->out = fields[2];
+        p->recordOut = fields[3];
+        p->records = fields[4];
+        p->window = new unsigned char[WINDOW_SIZE];
+        uLongf wlen = WINDOW_SIZE;
+        index->mPoints.push_back(p);
+        ok = uncompress(p->window, &wlen, zwin, zlen) == Z_OK && wlen == WINDOW_SIZE;
+    }
+    delete[] zwin;
+    std::fclose(fp);
+    if(!ok || index->mPoints.empty()){
+        delete index;
+        return NULL;
+    }
+    return index;
+}
+
+std::vector<size_t> GzIndex::splitRecords(int n){
+    std::vector<size_t> bounds(1, 0);
+    for(int i = 1; i < n; ++i){
+        // start each range at the checkpoint nearest to an even share of records
+        size_t target = mTotalRecords / n * i;
+        const GzCheckpoint* p = findCheckpoint(target);
+        if(p->records > bounds.back() && p->records < mTotalRecords){
+            bounds.push_back(p->records);
+        }
+    }
+    bounds.push_back(mTotalRecords);
+    return bounds;
+}
+
+const GzCheckpoint* GzIndex::findCheckpoint(size_t record) const {
+    size_t lo = 0;
+    size_t hi = mPoints.size();
+    while(hi - lo > 1){
+        size_t mid = (lo + hi) / 2;
+        if(mPoints[mid]->records <= record){
+            lo = mid;
+        }else{
+            hi = mid;
+        }
+    }
+    return mPoints[lo];
+}
+
+size_t GzIndex::size() const {
+    return mPoints.size();
+}
+
+size_t GzIndex::totalRecords() const {
+    return mTotalRecords;
+}
+
+GzIndexReader::GzIndexReader(const std::string& filename, const GzIndex* index, size_t startRecord, size_t endRecord){
+    mFileName = filename;
+    mFile = std::fopen(mFileName.c_str(), "rb");
+    if(mFile == NULL){
+        util::errorExit("Failed to open file: " + mFileName);
+    }
+    const GzCheckpoint* p = index->findCheckpoint(startRecord);
+    std::memset(&mStream, 0, sizeof(z_stream));
+    if(inflateInit2(&mStream, -15) != Z_OK){
+        util::errorExit("Failed to initialize inflating stream");
+    }
+    mRaw = true;
+    mDone = false;
+    mIn = new unsigned char[IN_SIZE];
+    mOut = new unsigned char[OUT_SIZE];
+    mOutLen = 0;
+    mOutPos = 0;
+    mSkipBytes = p->recordOut - p->out;
+    mSkipLines = 4 * (startRecord - std::min(startRecord, p->records));
+    mLeftLines = endRecord > startRecord ? 4 * (endRecord - startRecord) : 0;
+    // restore the inflate state: bits left in the previous byte and the 32KB history
+    mInOffset = p->in - (p->bits ? 1 : 0);
+    if(std::fseek(mFile, mInOffset, SEEK_SET) != 0){
+        util::errorExit("Failed to seek file: " + mFileName);
+    }
+    if(p->bits){
+        int c = std::fgetc(mFile);
+        if(c == EOF){
+            util::errorExit("Failed to read file: " + mFileName);
+        }
+        ++mInOffset;
+        inflatePrime(&mStream, p->bits, c >> (8 - p->bits));
+    }
+    inflateSetDictionary(&mStream, p->window, GzIndex::WINDOW_SIZE);
+}
+
+GzIndexReader::~GzIndexReader(){
+    inflateEnd(&mStream);
+    if(mFile){
+        std::fclose(mFile);
+        mFile = NULL;
+    }
+    delete[] mIn;
+    delete[] mOut;
+}
+
+bool GzIndexReader::inflateMore(){
+    mOutLen = 0;
+    mOutPos = 0;
+    while(!mDone && mOutLen == 0){
+        if(mStream.avail_in == 0){
+            size_t n = std::fread(mIn, 1, IN_SIZE, mFile);
+            mInOffset += n;
+            if(n == 0){
+                mDone = true;
+                break;
+            }
+            mStream.next_in = mIn;
+            mStream.avail_in = n;
+        }
+        mStream.next_out = mOut;
+        mStream.avail_out = OUT_SIZE;
+        int ret = inflate(&mStream, Z_NO_FLUSH);
+        if(ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR){
+            util::errorExit("Failed to inflate gzip file: " + mFileName);
+        }
+        mOutLen = OUT_SIZE - mStream.avail_out;
+        if(ret == Z_STREAM_END){
+            if(mRaw){
+                // skip the 8 bytes trailer of the member, the following members have their own headers
+                size_t trailer = 8;
+                while(trailer > 0){
+                    if(mStream.avail_in == 0){
+                        size_t n = std::fread(mIn, 1, IN_SIZE, mFile);
+                        mInOffset += n;
+                        if(n == 0){
+                            mDone = true;
+                            break;
+                        }
+                        mStream.next_in = mIn;
+                        mStream.avail_in = n;
+                    }
+                    size_t s = std::min((size_t)mStream.avail_in, trailer);
+                    mStream.next_in += s;
+                    mStream.avail_in -= s;
+                    trailer -= s;
+                }
+                inflateReset2(&mStream, 31);
+                mRaw = false;
+            }else{
+                inflateReset(&mStream);
+            }
+            if(mStream.avail_in == 0 && std::feof(mFile)){
+                mDone = true;
+            }
+        }
+    }
+    return mOutLen > 0;
+}
+
+size_t GzIndexReader::read(char* buf, size_t len){
+    size_t total = 0;
+    while(total < len && mLeftLines > 0){
+        if(mOutPos >= mOutLen && !inflateMore()){
+            break;
+        }
+        const char* data = (const char*)mOut + mOutPos;
+        size_t avail = mOutLen - mOutPos;
+        if(mSkipBytes > 0){
+            size_t s = std::min(avail, mSkipBytes);
+            mSkipBytes -= s;
+            mOutPos += s;
+            continue;
+        }
+        if(mSkipLines > 0){
+            const char* q = (const char*)std::memchr(data, '\n', avail);
+            if(q == NULL){
+                mOutPos += avail;
+            }else{
+                mOutPos += q - data + 1;
+                --mSkipLines;
+            }
+            continue;
+        }
+        // output till the last line of the range
+        size_t n = std::min(avail, len - total);
+        const char* p = data;
+        const char* end = data + n;
+        while(p < end){
+            const char* q = (const char*)std::memchr(p, '\n', end - p);
+            if(q == NULL){
+                break;
+            }
+            p = q + 1;
+            if(--mLeftLines == 0){
+                n = p - data;
+                break;
+            }
+        }
+        std::memcpy(buf + total, data, n);
+        total += n;
+        mOutPos += n;
+    }
+    return total;
+}
+
+size_t GzIndexReader::compressedOffset(){
+    return mInOffset - mStream.avail_in;
+}
@@ -0,0 +1,167 @@
+#ifndef GZ_INDEX_H
+#define GZ_INDEX_H
+
+#include <zlib.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "util.h"
+
+/** struct to hold an access point of a gzip file where inflating can restart */
+struct GzCheckpoint{
+    size_t in;              ///< offset in the compressed file of the first byte of a deflate block(the byte holding bits)
+    int bits;               ///< number of bits of the byte before in belonging to the deflate block, 0 if block starts at a byte
+    size_t out;             ///< offset in the inflated data where the deflate block starts
+    size_t recordOut;       ///< offset in the inflated data of the first fastq record start at or after out
+    size_t records;         ///< number of fastq records before recordOut
+    unsigned char* window;  ///< the last 32KB of inflated data before out, used as dictionary to restart inflating
+};
+
+/** Class to hold a random access index of an ordinary gzip fastq file(zran style)\n
+ * checkpoints holding the inflate state(bit offset and 32KB window) are taken at deflate block boundaries\n
+ * every span bytes of inflated data, together with the next fastq record boundary, so inflating and parsing\n
+ * can restart at any checkpoint and several producers can process one file in parallel\n
+ * the index is saved in a sidecar file named after the gzip file with suffix ".fqidx"
+ */
+class GzIndex{
+    public:
+        /** construct an empty GzIndex */
+        GzIndex();
+
+        /** destroy a GzIndex and free checkpoint windows */
+        ~GzIndex();
+
+        /** build a GzIndex by inflating a whole gzip fastq file once\n
+         * every record of the fastq file should consist of 4 lines
+         * @param filename gzip fastq file name
+         * @param span min number of inflated bytes between two checkpoints
+         * @return pointer to GzIndex built, NULL if the file is not a well formatted gzip fastq file
+         */
+        static GzIndex* build(const std::string& filename, size_t span);
+
+        /** load the sidecar index of a gzip fastq file
+         * @param filename gzip fastq file name
+         * @return pointer to GzIndex loaded, NULL if index not exists or out of date
+         */
+        static GzIndex* load(const std::string& filename);
+
+        /** save this index as the sidecar index of a gzip fastq file
+         * @param filename gzip fastq file name
+         * @return true if saved successfully
+         */
+        bool save(const std::string& filename);
+
+        /** get the sidecar index file name of a gzip fastq file
+         * @param filename gzip fastq file name
+         * @return index file name
+         */
+        static std::string indexName(const std::string& filename);
+
+        /** split records into at most n ranges starting at checkpoints
+         * @param n max number of ranges
+         * @return record numbers of range boundaries, range i holds records [bounds[i], bounds[i+1])
+         */
+        std::vector<size_t> splitRecords(int n);
+
+        /** find the last checkpoint before a record
+         * @param record record number
+         * @return pointer to the checkpoint with the largest records not exceeding record
+         */
+        const GzCheckpoint* findCheckpoint(size_t record) const;
+
+        /** get the number of checkpoints
+         * @return number of checkpoints
+         */
+        size_t size() const;
+
+        /** get the number of fastq records of the file
+         * @return number of records
+         */
+        size_t totalRecords() const;
+
+    public:
+        static const size_t WINDOW_SIZE = 32768; ///< size of deflate history window
+
+    private:
+        /** get the size and modification time of a file
+         * @param filename file name
+         * @param fsize to store file size
+         * @param mtime to store modification time
+         * @return true if file stat got
+         */
+        static bool fileStamp(const std::string& filename, uint64_t& fsize, int64_t& mtime);
+
+        /** add a checkpoint
+         * @param in offset in the compressed file
+         * @param bits number of bits in the byte before in
+         * @param out offset in the inflated data
+         * @param window circular buffer of inflated data
+         * @param left number of bytes not filled in window after its current position
+         */
+        void addCheckpoint(size_t in, int bits, size_t out, const unsigned char* window, size_t left);
+
+    private:
+        std::vector<GzCheckpoint*> mPoints; ///< checkpoints in increasing out order
+        size_t mSpan;                       ///< min number of inflated bytes between two checkpoints
+        size_t mTotalRecords;               ///< number of fastq records of the file
+        uint64_t mFileSize;                 ///< size of the indexed gzip file
+        int64_t mFileTime;                  ///< modification time of the indexed gzip file
+};
+
+/** Class to inflate a range of fastq records of an ordinary gzip file starting from a checkpoint of GzIndex */
+class GzIndexReader{
+    public:
+        /** construct a GzIndexReader
+         * @param filename gzip fastq file name
+         * @param index pointer to GzIndex of the file
+         * @param startRecord number of the first record to output
+         * @param endRecord number after the last record to output, records after it are not output
+         */
+        GzIndexReader(const std::string& filename, const GzIndex* index, size_t startRecord, size_t endRecord);
+
+        /** destroy a GzIndexReader */
+        ~GzIndexReader();
+
+        /** read inflated data of the record range in order\n
+         * buf will be filled fully unless the end of range reached
+         * @param buf buffer to store inflated data
+         * @param len buffer length
+         * @return number of bytes read into buf, 0 if the end of range reached
+         */
+        size_t read(char* buf, size_t len);
+
+        /** get the compressed bytes consumed so far
+         * @return offset in the compressed file
+         */
+        size_t compressedOffset();
+
+    private:
+        /** inflate more data into mOut
+         * @return false if no more data can be inflated
+         */
+        bool inflateMore();
+
+    private:
+        std::string mFileName;   ///< gzip file name
+        FILE* mFile;             ///< file handler of the gzip file
+        z_stream mStream;        ///< inflating stream
+        bool mRaw;               ///< inflating raw deflate data of the member the checkpoint in if true, gzip members afterwards
+        bool mDone;              ///< no more data can be inflated if true
+        unsigned char* mIn;      ///< buffer of compressed data
+        unsigned char* mOut;     ///< buffer of inflated data
+        size_t mOutLen;          ///< length of data in mOut
+        size_t mOutPos;          ///< consumed length of data in mOut
+        size_t mSkipBytes;       ///< bytes to skip before the record boundary of the checkpoint
+        size_t mSkipLines;       ///< lines to skip after the record boundary to reach startRecord
+        size_t mLeftLines;       ///< lines left to output before endRecord
+        size_t mInOffset;        ///< offset in the compressed file of the data read into mIn
+
+        static const size_t IN_SIZE = (1 << 18);  ///< size of mIn
+        static const size_t OUT_SIZE = (1 << 18); ///< size of mOut
+};
+
+#endif
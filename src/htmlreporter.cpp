@@ -4,15 +4,17 @@ HtmlReporter::HtmlReporter(Options* opt){
     mOptions = opt;
     mDupHist = NULL;
     mDupRate = 0;
+    mDupRateError = 0;
 }
 
 HtmlReporter::~HtmlReporter(){
 }
 
-void HtmlReporter::setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate){
+void HtmlReporter::setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate, double dupRateError){
     mDupHist = dupHist;
     mDupMeanGC = dupMeanGC;
     mDupRate = dupRate;
+    mDupRateError = dupRateError;
 }
 
 void HtmlReporter::setInsertHist(long* insertHist, int insertSizePeak){
@@ -289,7 +291,11 @@ CTML::Node HtmlReporter::reportDuplication(){
     json_str += "}";
     json_str += "];\n";
     
-    json_str += "var layout={title:'duplication rate (" + std::to_string(mDupRate*100.0) + "%)', xaxis:{title:'duplication level'}, yaxis:{title:'Read percent (%) & GC ratio'}};\n";
+    std::string rateStr = std::to_string(mDupRate*100.0) + "%";
+    if(mDupRateError > 0){
+        rateStr += " +/- " + std::to_string(mDupRateError*100.0) + "%";
+    }
+    json_str += "var layout={title:'duplication rate (" + rateStr + ")', xaxis:{title:'duplication level'}, yaxis:{title:'Read percent (%) & GC ratio'}};\n";
     json_str += "Plotly.newPlot('plot_duplication', data, layout);\n";
     delete[] x;
     delete[] percents;
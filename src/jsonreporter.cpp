@@ -4,15 +4,17 @@ JsonReporter::JsonReporter(Options* opt){
     mOptions = opt;
     mDupHist = NULL;
     mDupRate = 0;
+    mDupRateError = 0;
 }
 
 JsonReporter::~JsonReporter(){
 }
 
-void JsonReporter::setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate){
+void JsonReporter::setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate, double dupRateError){
     mDupHist = dupHist;
     mDupMeanGC = dupMeanGC;
     mDupRate = dupRate;
+    mDupRateError = dupRateError;
 }
 
 void JsonReporter::setInsertHist(long* insertHist, int insertSizePeak){
@@ -100,6 +102,7 @@ void JsonReporter::report(FilterResult* fresult, Stats* preStats1, Stats* postSt
     if(mOptions->duplicate.enabled){
         jsn::json jDupResult;
         jDupResult["Rate"] = mDupRate;
+        jDupResult["RateError"] = mDupRateError;
         std::vector<int32_t> dupVec(mDupHist, mDupHist + mOptions->duplicate.histSize);
         jDupResult["Histogram"] = dupVec;
         std::vector<double> gcVec(mDupMeanGC, mDupMeanGC + mOptions->duplicate.histSize);
@@ -17,6 +17,7 @@ class JsonReporter{
         size_t* mDupHist;///< duplication array
         double* mDupMeanGC;///< duplication mean gc array
         double mDupRate;///< duplication rate
+        double mDupRateError;///< standard error of duplication rate, 0 if all reads counted
         long* mInsertHist;///< insertsize array
         int mInsertSizePeak;///< insert size peak
 
@@ -33,8 +34,9 @@ class JsonReporter{
          * @param dupHist duplication statistics array
          * @param dupMeanGC duplication mean gc array
          * @param dupRate duplication rate
+         * @param dupRateError standard error of duplication rate, 0 if all reads counted
          */
-        void setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate);
+        void setDupHist(size_t* dupHist, double* dupMeanGC, double dupRate, double dupRateError);
         
         /** set insert statistical parameters
          * @param insertHist insert size array
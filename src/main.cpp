@@ -3,6 +3,33 @@
 #include "options.h"
 #include "evaluator.h"
 #include "processor.h"
+#include "gzindex.h"
+
+/** build the sidecar random access index of an ordinary gzip fastq file
+ * @param argc number of arguments after subcommand name
+ * @param argv arguments after subcommand name
+ * @return 0 if index built and saved
+ */
+int buildIndex(int argc, char** argv){
+    std::string in;
+    int span = 16;
+    CLI::App app("program: fqtool index\nbuild random access index(FILE.fqidx) of gzip fastq FILE for parallel processing");
+    app.add_option("-i", in, "gzip fastq file to index")->required(true)->check(CLI::ExistingFile);
+    app.add_option("--span", span, "MB of inflated data between checkpoints", true)->check(CLI::Range(1, 1024));
+    CLI_PARSE(app, argc, argv);
+    std::mutex logmtx;
+    util::loginfo("building index of " + in, logmtx);
+    GzIndex* index = GzIndex::build(in, (size_t)span << 20);
+    if(index == NULL){
+        util::errorExit("Failed to index " + in + ", it should be a gzip fastq file with 4 lines per record");
+    }
+    if(!index->save(in)){
+        util::errorExit("Failed to write index file: " + GzIndex::indexName(in));
+    }
+    util::loginfo(std::to_string(index->size()) + " checkpoints of " + std::to_string(index->totalRecords()) + " records saved to " + GzIndex::indexName(in), logmtx);
+    delete index;
+    return 0;
+}
 
 int main(int argc, char** argv){
     std::string sysCMD = std::string(argv[0]) + " -h";
@@ -10,6 +37,9 @@ int main(int argc, char** argv){
         std::system(sysCMD.c_str());
         return 0;
     }
+    if(std::string(argv[1]) == "index"){
+        return buildIndex(argc - 1, argv + 1);
+    }
     
     Options* opt = new Options();
     // I/O
@@ -27,16 +57,27 @@ int main(int argc, char** argv){
     app.add_option("--merge_output", opt->mergePE.out, "merged output")->needs(pmerge)->group("Merge");
     app.add_flag("--phred64", opt->phred64, "input fastq is phred64")->group("IO");
     app.add_option("-z", opt->compression, "gzip output compress level", true)->check(CLI::Range(1, 9))->group("IO");
+    app.add_flag("--serial_gzip", opt->serialGzip, "compress gzip output in the writer thread as one gzip member instead of a member per pack in worker threads")->group("IO");
+    CLI::Option* pbgzf = app.add_flag("--bgzf", opt->bgzf, "write gzip output in BGZF format, blocks of 64KB each its own gzip member")->group("IO");
+    app.add_flag("--bgzf_index", opt->bgzfIndex, "write a .gzi index alongside each BGZF output")->needs(pbgzf)->group("IO");
+    app.add_option("--prealloc", opt->preallocMBytes, "megabytes to preallocate for each output file not compressed by --serial_gzip, the unused tail is cut at the end, 0 to disable", true)->check(CLI::Range(0, 1048576))->group("IO");
+    app.add_flag("--direct_io", opt->directIO, "write output files not compressed by --serial_gzip with O_DIRECT, bypassing the page cache")->group("IO");
     app.add_flag("--in_fq_interleaved", opt->interleavedInput, "input fastq interleaved")->excludes(pin2)->group("IO");
     // duplication
     CLI::Option* pdupana = app.add_flag("-d", opt->duplicate.enabled, "enable duplication analysis")->group("Duplication");
     app.add_option("--dup_ana_key_len", opt->duplicate.keylen, "duplication analysis key length", true)->check(CLI::Range(12, 31))->needs(pdupana)->group("Duplication");
     app.add_option("--dup_ana_hist_size", opt->duplicate.histSize, "duplicate analysis hist size", true)->check(CLI::Range(1, 10000))->needs(pdupana)->group("Duplication");
+    CLI::Option* pdupsparse = app.add_flag("--dup_ana_sparse", opt->duplicate.sparse, "count duplication by a hash of the whole read in a fixed size table, sampled once it fills up")->needs(pdupana)->group("Duplication");
+    app.add_option("--dup_ana_mem", opt->duplicate.memMBytes, "megabytes of the duplication hash table", true)->check(CLI::Range(1, 1048576))->needs(pdupsparse)->group("Duplication");
+    CLI::Option* pdedup = app.add_flag("--dedup", opt->dedup.enabled, "drop duplicated reads(or pairs) by exact sequence, the first copy processed is kept, the first in input order with --ordered_output")->group("Duplication");
+    app.add_option("--dedup_mem", opt->dedup.memMBytes, "megabytes of the table of reads seen, reads not in a full table are spilled to temp files", true)->check(CLI::Range(1, 1048576))->needs(pdedup)->group("Duplication");
+    app.add_option("--dedup_tmp_dir", opt->dedup.tmpDir, "directory of dedup temp files, $TMPDIR or /tmp by default")->needs(pdedup)->group("Duplication");
     // adapter
     CLI::Option* pcutadapter = app.add_flag("-a", opt->adapter.enableTriming, "enable adapter trimming")->group("Adapter");
     app.add_option("--adapter_of_read1", opt->adapter.inputAdapterSeqR1, "adapter of read1")->needs(pcutadapter)->group("Adapter");
     app.add_option("--adapter_of_read2", opt->adapter.inputAdapterSeqR2, "adapter of read2")->needs(pcutadapter)->group("Adapter");
     app.add_flag("--detect_pe_adapter", opt->adapter.enableDetectForPE, "detect PE adapters")->needs(pin2)->group("Adapter");
+    app.add_flag("--estimate_in_stream", opt->est.inStream, "detect adapters and read length from the first packs instead of a prescan")->group("Adapter");
     // trimming
     app.add_option("-f", opt->trim.front1, "bases trimmed in read1 front", true)->check(CLI::Range(0, 1000))->group("Trim");
     app.add_option("-t", opt->trim.tail1, "bases trimmed in read1 tail", true)->check(CLI::Range(0, 1000))->group("Trim");
@@ -108,6 +149,9 @@ int main(int argc, char** argv){
     app.add_option("-H", opt->htmlFile, "html format report file", true)->group("Report");;
     // threading
     app.add_option("-w", opt->thread, "worker thread number", true)->check(CLI::Range(1, 16))->group("System");
+    app.add_option("--inflate_thread", opt->inflateThread, "threads to inflate BGZF input", true)->check(CLI::Range(1, 32))->group("System");
+    app.add_option("--parse_thread", opt->parseThread, "threads to parse uncompressed or indexed gzip input", true)->check(CLI::Range(1, 16))->group("System");
+    app.add_flag("--ordered_output", opt->orderedOutput, "write output in input order regardless of thread numbers")->group("System");
     // output split
     CLI::Option* split_by_fn = app.add_flag("-s", opt->split.byFileNumber, "split output by file number")->excludes(pmerge)->group("Split");
     app.add_option("--split_file_number", opt->split.number, "total split output file number")->needs(split_by_fn)->group("Split");
@@ -118,28 +162,35 @@ int main(int argc, char** argv){
     app.add_option("--max_packs_in_repo", opt->bufSize.maxPacksInReadPackRepo, "max packs in repo", true)->check(CLI::Range(1, 1000000))->group("System");
     app.add_option("--max_item_in_pack", opt->bufSize.maxReadsInPack, "max read/pairs in pack", true)->check(CLI::Range(1, 1000000))->group("System");
     app.add_option("--max_packs_in_mem", opt->bufSize.maxPacksInMemory, "max packs in memory", true)->check(CLI::Range(1, 1000000))->group("System");
+    CLI::Option* pautopack = app.add_flag("--auto_pack", opt->bufSize.autoPackSize, "adapt reads in pack(at most max_item_in_pack) to processing time, writer backlog and pack_mb")->group("System");
+    app.add_option("--pack_mb", opt->bufSize.packMBytes, "target megabytes of reads in pack", true)->check(CLI::Range(1, 4096))->needs(pautopack)->group("System");
+    app.add_option("--max_memory", opt->bufSize.maxMemoryMBytes, "max megabytes of reads, output buffers and statistics in memory, 0 for no limit", true)->check(CLI::Range(0, 1048576))->group("System");
     // parse args
     CLI_PARSE(app, argc, argv);
     // update options
     opt->update(argc, argv);
     // validate options
     opt->validate();
-    // evaluate read length
-    Evaluator eva(opt);
-    eva.evaluateReadLen();
-    // evaluate read number
-    eva.evaluateReadNum();
-    if(opt->split.byFileNumber){
-        opt->split.size = std::max(opt->est.readsNum / opt->split.number, 1);
-        util::loginfo("total reds: " + std::to_string(opt->est.readsNum) + " split size: " + std::to_string(opt->split.size), opt->logmtx);
-    }
-    if(opt->overRepAna.enabled){
-        eva.evaluateOverRepSeqs();
-    }
-    // evaluate adapter sequence
-    if(opt->adapter.enableDetectForPE){
-        eva.evaluateAdapterSeq(false);
-        eva.evaluateAdapterSeq(true);
+    // estimations are done by the processor on the first packs if input is streaming
+    if(!opt->est.inStream){
+        // decode the head of input once for all evaluations
+        Evaluator eva(opt);
+        eva.prescan();
+        // evaluate read length
+        eva.evaluateReadLen();
+        // evaluate read number
+        eva.evaluateReadNum();
+        if(opt->split.byFileNumber){
+            opt->split.size = std::max(opt->est.readsNum / opt->split.number, 1);
+            util::loginfo("total reds: " + std::to_string(opt->est.readsNum) + " split size: " + std::to_string(opt->split.size), opt->logmtx);
+        }
+        if(opt->overRepAna.enabled){
+            eva.evaluateOverRepSeqs();
+        }
+        // evaluate adapter sequence
+        if(opt->adapter.enableDetectForPE){
+            eva.evaluateAdapterSeq();
+        }
     }
     // setup processor
     Processor p(opt);
@@ -0,0 +1,63 @@
+#include "memorybudget.h"
+
+MemoryBudget::MemoryBudget(size_t limit){
+    mLimit = limit;
+    mTransient = 0;
+    mTables = 0;
+    mPeak = 0;
+    mWaiters = 0;
+}
+
+MemoryBudget::~MemoryBudget(){
+}
+
+void MemoryBudget::charge(size_t bytes){
+    mTransient += bytes;
+    updatePeak();
+}
+
+void MemoryBudget::release(size_t bytes){
+    mTransient -= bytes;
+    // pairs with the fence after a reader registered itself, so either the reader sees the release or we see the reader
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(mWaiters.load(std::memory_order_relaxed) > 0 && !full()){
+        std::lock_guard<std::mutex> lk(mMtx);
+        mCV.notify_all();
+    }
+}
+
+void MemoryBudget::chargeTables(size_t bytes){
+    mTables += bytes;
+    updatePeak();
+}
+
+void MemoryBudget::wait(){
+    if(!full()){
+        return;
+    }
+    std::unique_lock<std::mutex> lk(mMtx);
+    ++mWaiters;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    mCV.wait(lk, [this]{return !full();});
+    --mWaiters;
+}
+
+size_t MemoryBudget::used() const{
+    return mTransient.load() + mTables.load();
+}
+
+size_t MemoryBudget::peak() const{
+    return mPeak.load();
+}
+
+bool MemoryBudget::full() const{
+    size_t transient = mTransient.load();
+    return transient > 0 && transient + mTables.load() >= mLimit;
+}
+
+void MemoryBudget::updatePeak(){
+    size_t now = used();
+    size_t peak = mPeak.load();
+    while(now > peak && !mPeak.compare_exchange_weak(peak, now)){
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/** Class to hold a budget of bytes in flight shared by readers, workers and writers\n
+ * transient bytes(parsed packs and output buffers waiting in writers) are charged when they enter the pipeline and\n
+ * released when they leave it, bytes of statistics tables are charged as they grow and held till the end\n
+ * readers call wait before parsing more reads, which blocks while the budget is used up,\n
+ * workers and writers never wait so the transient bytes always drain
+ */
+class MemoryBudget{
+    public:
+        /** construct a MemoryBudget
+         * @param limit max bytes in flight
+         */
+        MemoryBudget(size_t limit);
+
+        /** destroy a MemoryBudget */
+        ~MemoryBudget();
+
+        /** charge transient bytes
+         * @param bytes bytes entering the pipeline
+         */
+        void charge(size_t bytes);
+
+        /** release transient bytes and wake up readers waiting if the budget is no more used up
+         * @param bytes bytes leaving the pipeline
+         */
+        void release(size_t bytes);
+
+        /** charge bytes of statistics tables, which are held till the end
+         * @param bytes bytes the tables grew by
+         */
+        void chargeTables(size_t bytes);
+
+        /** wait while the budget is used up and some transient bytes are still in flight\n
+         * if tables alone use up the budget nothing else can be freed, so readers go on one pack at a time
+         */
+        void wait();
+
+        /** get the bytes in flight
+         * @return transient bytes plus bytes of tables
+         */
+        size_t used() const;
+
+        /** get the max bytes in flight seen so far
+         * @return peak bytes in flight
+         */
+        size_t peak() const;
+
+    private:
+        /** test whether readers should wait
+         * @return true if the budget is used up and some transient bytes are in flight
+         */
+        bool full() const;
+
+        /** update mPeak with the bytes in flight now */
+        void updatePeak();
+
+    private:
+        size_t mLimit;                   ///< max bytes in flight
+        std::atomic<size_t> mTransient;  ///< bytes of packs and output buffers in flight
+        std::atomic<size_t> mTables;     ///< bytes of statistics tables
+        std::atomic<size_t> mPeak;       ///< max bytes in flight seen so far
+        std::atomic<int> mWaiters;       ///< number of readers parked in wait
+        std::mutex mMtx;                 ///< mutex to park readers
+        std::condition_variable mCV;     ///< condition variable to wake up readers
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/** Class to hold a bounded multi-producer multi-consumer queue\n
+ * tryPush/tryPop are lock free: each cell carries a sequence number telling whether it is ready to be\n
+ * written or read at a given position, producers and consumers claim positions by CAS on two counters\n
+ * push/pop block when the queue is full/empty by parking on a condition variable instead of spinning,\n
+ * the mutex is only touched when some thread is parked\n
+ * after close is called pop drains the items left and then returns false
+ */
+template<typename T>
+class MPMCQueue{
+    public:
+        /** construct a MPMCQueue
+         * @param capacity max number of items the queue can hold, at least 2
+         */
+        MPMCQueue(size_t capacity){
+            // with a single cell "written at pos" and "free at pos + 1" have the same sequence number
+            mCapacity = capacity < 2 ? 2 : capacity;
+            mCells = new Cell[mCapacity];
+            for(size_t i = 0; i < mCapacity; ++i){
+                mCells[i].seq.store(i, std::memory_order_relaxed);
+            }
+            mEnqueuePos = 0;
+            mDequeuePos = 0;
+            mPushWaiters = 0;
+            mPopWaiters = 0;
+            mClosed = false;
+        }
+
+        /** destroy a MPMCQueue, items left are not freed */
+        ~MPMCQueue(){
+            delete[] mCells;
+        }
+
+        /** put an item into the queue if it is not full
+         * @param item item to put
+         * @return true if item put
+         */
+        bool tryPush(const T& item){
+            size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+            Cell* cell = NULL;
+            while(true){
+                cell = &mCells[pos % mCapacity];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+                if(dif == 0){
+                    if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        break;
+                    }
+                }else if(dif < 0){
+                    // the cell still holds the item put one lap before
+                    return false;
+                }else{
+                    pos = mEnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+            cell->data = item;
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** get an item from the queue if it is not empty
+         * @param item to store the item got
+         * @return true if item got
+         */
+        bool tryPop(T& item){
+            size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+            Cell* cell = NULL;
+            while(true){
+                cell = &mCells[pos % mCapacity];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+                if(dif == 0){
+                    if(mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        break;
+                    }
+                }else if(dif < 0){
+                    // the cell has not been written at this position yet
+                    return false;
+                }else{
+                    pos = mDequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+            item = cell->data;
+            cell->seq.store(pos + mCapacity, std::memory_order_release);
+            return true;
+        }
+
+        /** put an item into the queue, wait while the queue is full
+         * @param item item to put
+         */
+        void push(const T& item){
+            if(!tryPush(item)){
+                std::unique_lock<std::mutex> lk(mMtx);
+                ++mPushWaiters;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                mNotFull.wait(lk, [this, &item]{return tryPush(item);});
+                --mPushWaiters;
+            }
+            wake(mPopWaiters, mNotEmpty);
+        }
+
+        /** get an item from the queue, wait while the queue is empty and not closed
+         * @param item to store the item got
+         * @return false if the queue is closed and all items have been got
+         */
+        bool pop(T& item){
+            bool got = tryPop(item);
+            if(!got){
+                std::unique_lock<std::mutex> lk(mMtx);
+                ++mPopWaiters;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                mNotEmpty.wait(lk, [this, &item, &got]{
+                    got = tryPop(item);
+                    return got || mClosed;
+                });
+                --mPopWaiters;
+            }
+            if(got){
+                wake(mPushWaiters, mNotFull);
+            }
+            return got;
+        }
+
+        /** mark no more items will be put, wake up all threads waiting in pop */
+        void close(){
+            std::lock_guard<std::mutex> lk(mMtx);
+            mClosed = true;
+            mNotEmpty.notify_all();
+        }
+
+        /** test whether close has been called
+         * @return true if the queue is closed
+         */
+        bool isClosed(){
+            std::lock_guard<std::mutex> lk(mMtx);
+            return mClosed;
+        }
+
+        /** get the number of items in the queue, only a snapshot if other threads are working on it
+         * @return number of items in the queue
+         */
+        size_t size() const{
+            size_t tail = mDequeuePos.load(std::memory_order_acquire);
+            size_t head = mEnqueuePos.load(std::memory_order_acquire);
+            return head > tail ? head - tail : 0;
+        }
+
+        /** get the max number of items the queue can hold
+         * @return capacity of the queue
+         */
+        size_t capacity() const{
+            return mCapacity;
+        }
+
+    private:
+        /** wake up a thread parked on a condition variable if any
+         * @param waiters number of threads parked on cv
+         * @param cv condition variable to notify
+         */
+        void wake(std::atomic<int>& waiters, std::condition_variable& cv){
+            // pairs with the fence after a waiter registered itself, so either the waiter sees the new state or we see the waiter
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(waiters.load(std::memory_order_relaxed) > 0){
+                std::lock_guard<std::mutex> lk(mMtx);
+                cv.notify_one();
+            }
+        }
+
+    private:
+        /** struct to hold an item and the sequence number of its cell */
+        struct Cell{
+            std::atomic<size_t> seq; ///< position the cell is ready to be written at(seq == pos) or read at(seq == pos + 1)
+            T data;                  ///< item stored
+        };
+
+        Cell* mCells;                      ///< ring of cells
+        size_t mCapacity;                  ///< number of cells
+        std::atomic<size_t> mEnqueuePos;   ///< next position to put into, claimed by producers
+        char mPad[64];                     ///< keep mEnqueuePos and mDequeuePos on different cache lines
+        std::atomic<size_t> mDequeuePos;   ///< next position to get from, claimed by consumers
+        std::atomic<int> mPushWaiters;     ///< number of threads parked in push
+        std::atomic<int> mPopWaiters;      ///< number of threads parked in pop
+        bool mClosed;                      ///< no more items will be put if true
+        std::mutex mMtx;                   ///< mutex to park threads
+        std::condition_variable mNotFull;  ///< condition variable to wake up threads waiting in push
+        std::condition_variable mNotEmpty; ///< condition variable to wake up threads waiting in pop
+};
+
+#endif
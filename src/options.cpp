@@ -9,7 +9,15 @@ Options::Options(){
     out2 = "";
     reportTitle = "Fastq Report";
     thread = 4;
+    inflateThread = 4;
+    parseThread = 2;
+    orderedOutput = false;
     compression = 3;
+    serialGzip = false;
+    bgzf = false;
+    bgzfIndex = false;
+    preallocMBytes = 0;
+    directIO = false;
     phred64 = false;
     inputFromSTDIN = false;
     outputToSTDOUT = false;
@@ -31,6 +39,10 @@ void Options::update(int argc, char** argv){
     if(adapter.enableTriming && (!adapter.adapterSeqR1Provided && !adapter.adapterSeqR2Provided) && isPaired()){
         adapter.enableDetectForPE = true;
     }
+    // streaming input can not be rewound after a prescan, so estimate from the packs flowing through the pipeline
+    if(!util::isfile(in1) || (!in2.empty() && !util::isfile(in2))){
+        est.inStream = true;
+    }
     // update index filtering options
     if(indexFilter.enabled){
         initIndexFilter(indexFilter.index1File, indexFilter.index2File, indexFilter.threshold);
@@ -38,6 +50,11 @@ void Options::update(int argc, char** argv){
     if(indexFilter.enabled){
         initIndexFilter(indexFilter.index1File, indexFilter.index2File, indexFilter.threshold);
     }
+    // update dedup temp directory
+    if(dedup.enabled && dedup.tmpDir.empty()){
+        const char* tmp = std::getenv("TMPDIR");
+        dedup.tmpDir = (tmp && *tmp) ? tmp : "/tmp";
+    }
     // update split potions
     split.enabled = split.byFileLines || split.byFileNumber;
     // update quality filter options
@@ -58,6 +75,25 @@ void Options::update(int argc, char** argv){
 }
 
 void Options::validate(){
+    // validate split by file number
+    if(split.byFileNumber && est.inStream){
+        util::errorExit("split by file number needs read number estimated by a prescan, which is not available for streaming input!");
+    }
+    // validate ordered output
+    if(orderedOutput && split.enabled){
+        util::errorExit("ordered output can not be used with split output, which is written by each worker thread separately!");
+    }
+    // validate duplication analysis
+    if(duplicate.enabled && !duplicate.sparse && duplicate.keylen > 16){
+        util::errorExit("dense duplication analysis table of key length > 16 needs more than 64GB memory, use --dup_ana_sparse instead!");
+    }
+    // validate dedup
+    if(dedup.enabled && split.enabled){
+        util::errorExit("dedup can not be used with split output, reads resolved at the end belong to no worker's file!");
+    }
+    if(dedup.enabled && !util::isdir(dedup.tmpDir)){
+        util::errorExit("dedup temp directory " + dedup.tmpDir + " does not exist!");
+    }
     // validate merged file
     if(mergePE.enabled){
         if(mergePE.out.empty()){
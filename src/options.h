@@ -16,10 +16,16 @@ struct BufferSizeOptions{
     size_t maxPacksInReadPackRepo; ///< max number of ReadPacks a ReadPackRepository can hold
     size_t maxReadsInPack;         ///< max number of reads a ReadPack can hold
     size_t maxPacksInMemory;       ///< max number of ReadPacks in memory allowed
+    bool autoPackSize;             ///< adapt the number of reads in a ReadPack(at most maxReadsInPack) to processing time, writer backlog and packMBytes
+    int packMBytes;                ///< target megabytes of reads in a ReadPack if autoPackSize is true
+    int maxMemoryMBytes;           ///< max megabytes of parsed packs, output buffers and statistics tables in memory, 0 for no limit
     BufferSizeOptions(){
         maxPacksInReadPackRepo = 1000;
         maxReadsInPack = 100000;
         maxPacksInMemory = 5;
+        autoPackSize = false;
+        packMBytes = 32;
+        maxMemoryMBytes = 0;
     }
 };
 
@@ -92,11 +98,27 @@ struct DuplicationAnalysisOptions{
     bool enabled;   ///< enable duplication analysis if true
     int keylen;     ///< key length of read, should be less than (std::numeric_limits<size_t>::digits  - 1) / 2
     int histSize;   ///< hist length to do statistics
+    bool sparse;    ///< count reads by a hash of the whole read in a table of memMBytes, sampled by hash once it fills up
+    int memMBytes;  ///< megabytes of the hash table if sparse is true
     /** construct a DuplicationAnalysisOptions and set default values */
     DuplicationAnalysisOptions(){
         enabled = true;
         keylen = 12;
         histSize = 32;
+        sparse = false;
+        memMBytes = 256;
+    }
+};
+
+/** struct to store duplicate removal options */
+struct DedupOptions{
+    bool enabled;       ///< drop duplicated reads(or pairs) by their exact sequence if true
+    int memMBytes;      ///< megabytes of the table of reads seen, reads not in a full table are spilled to tmpDir
+    std::string tmpDir; ///< directory of temp files reads are spilled to, $TMPDIR or /tmp if empty
+    /** construct a DedupOptions and set default values */
+    DedupOptions(){
+        enabled = false;
+        memMBytes = 1024;
     }
 };
 
@@ -295,6 +317,7 @@ struct EstimateOptions{
     std::string adapter;  ///< estimated adapter sequence
     bool illuminaAdapter; ///< estimated adapter sequnce is from illumina
     bool estimated;       ///< estimation work done already if true
+    bool inStream;        ///< estimate from the first packs flowing through the pipeline instead of a prescan if true
     /** construct an EstimateOptions object and set default values */
     EstimateOptions(){
         seqLen1 = 151;
@@ -304,6 +327,7 @@ struct EstimateOptions{
         adapter = "";
         illuminaAdapter = false;
         estimated = false;
+        inStream = false;
     }
 };
 
@@ -323,11 +347,19 @@ struct Options{
     std::string reportTitle;      ///< html report title
     int digits;                   ///< number of digits for split filename prefix
     int compression;              ///< compression level for gz format output
+    bool serialGzip;              ///< compress gz format output as one gzip member in the writer thread, instead of a member per pack in workers
+    bool bgzf;                    ///< write gz format output in BGZF format
+    bool bgzfIndex;               ///< write a .gzi index alongside each BGZF output
+    int preallocMBytes;           ///< megabytes to preallocate for each output file written as is(not gzipped by zlib), 0 to disable
+    bool directIO;                ///< write output files written as is with O_DIRECT
     bool phred64;                 ///< the input file is using phred64 quality scoring if true 
     bool inputFromSTDIN;          ///< read from STDIN
     bool outputToSTDOUT;          ///< write to STDOUT
     bool interleavedInput;        ///< the input read1(in1) file is an interleaved PE fastq
     int thread;                   ///< number of threads to do paralel work
+    int inflateThread;            ///< number of threads to inflate each BGZF input file
+    int parseThread;              ///< number of threads to parse uncompressed input by byte ranges or indexed gzip input by checkpoints
+    bool orderedOutput;           ///< write output in input order regardless of thread numbers
     int insertSizeMax;            ///< maximum value of insert size
     int overlapRequire;           ///< overlap region minimum length
     int overlapDiffLimit;         ///< overlap region maximum different bases allowed
@@ -345,6 +377,7 @@ struct Options{
     KmerOptions kmer;                                  ///< KmerOptions object
     EstimateOptions est;                               ///< EstimateOptions object
     DuplicationAnalysisOptions duplicate;              ///< DuplicationAnalysisOptions object
+    DedupOptions dedup;                                ///< DedupOptions object
     UMIOptions umi;                                    ///< UMIOptions object 
     PolyGTrimmerOptions polyGTrim;                     ///< PolyGTrimmerOptions object
     PolyXTrimmerOptions polyXTrim;                     ///< PolyXTrimmerOptions object
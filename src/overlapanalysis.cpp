@@ -8,62 +8,86 @@ OverlapResult OverlapAnalysis::analyze(Seq& s1, Seq& s2, int overlapDiffLimit, i
     Seq rs2 = ~s2;
     int len1 = s1.length();
     int len2 = rs2.length();
-    const char* pstr1 = s1.seqStr.c_str();
-    const char* pstr2 = rs2.seqStr.c_str();
+    // padding makes the tail readable for the vector compare
+    std::string pstr1 = s1.seqStr;
+    pstr1.resize(len1 + simd::MISMATCH_WIDTH);
+    rs2.seqStr.resize(len2 + simd::MISMATCH_WIDTH);
+    return OverlapAnalysis::analyze(pstr1.c_str(), len1, rs2.seqStr.c_str(), len2, overlapDiffLimit, overlapRequire);
+}
 
-    int complete_compare_require = 50; //something werid
+bool OverlapAnalysis::overlapAt(const char* p1, const char* p2, int overlapLen, int overlapDiffLimit, int& diff){
+    // a byte by byte scan stops at the overlapDiffLimit-th difference if it is within the first COMPLETE_COMPARE_REQUIRE bases,
+    // otherwise it counts all differences and accepts the offset if few enough or the overlap is long enough
+    uint64_t mask = simd::mismatchMask(p1, p2);
+    if(overlapLen < simd::MISMATCH_WIDTH){
+        mask &= (1ULL << overlapLen) - 1;
+    }
+    int head = __builtin_popcountll(mask & ((1ULL << COMPLETE_COMPARE_REQUIRE) - 1));
+    if(head >= std::max(overlapDiffLimit, 1)){
+        return false;
+    }
+    diff = __builtin_popcountll(mask);
+    for(int i = simd::MISMATCH_WIDTH; i < overlapLen; i += simd::MISMATCH_WIDTH){
+        mask = simd::mismatchMask(p1 + i, p2 + i);
+        if(overlapLen - i < simd::MISMATCH_WIDTH){
+            mask &= (1ULL << (overlapLen - i)) - 1;
+        }
+        diff += __builtin_popcountll(mask);
+    }
+    return diff < overlapDiffLimit || overlapLen > COMPLETE_COMPARE_REQUIRE;
+}
+
+OverlapResult OverlapAnalysis::analyze(const char* pstr1, int len1, const char* pstr2, int len2, int overlapDiffLimit, int overlapRequire){
     int overlapLen = 0;
-    int offset = 0;
     int diff = 0;
-    
+    // most offsets are rejected by their head, so heads of a batch of offsets are counted at once
+    // and only offsets with a close head or an overlap shorter than the head are scored in full
+    int headLimit = std::max(overlapDiffLimit, 1);
+    uint8_t heads[SCAN_BATCH];
+
     // TEMPLATE_LEN >= SEQ_LEN, so the 3' end of s1 and s2 do not have any adaptor sequences
-    while(offset < len1 - overlapRequire){
-        overlapLen = std::min(len1 - offset, len2);
-        diff = 0;
-        int i = 0;
-        for(i = 0; i < overlapLen; ++i){
-            if(pstr1[offset + i] != pstr2[i]){
-               ++diff;
-               if(diff >= overlapDiffLimit && i < complete_compare_require){
-                   break;
-               }
+    int end = len1 - overlapRequire;
+    for(int from = 0; from < end; from += SCAN_BATCH){
+        int n = std::min((int)SCAN_BATCH, end - from);
+        simd::headMismatches(pstr1 + from, pstr2, n, COMPLETE_COMPARE_REQUIRE, headLimit, heads);
+        for(int k = 0; k < n; ++k){
+            int offset = from + k;
+            overlapLen = std::min(len1 - offset, len2);
+            if(overlapLen >= COMPLETE_COMPARE_REQUIRE && heads[k] >= headLimit){
+                continue;
+            }
+            if(overlapAt(pstr1 + offset, pstr2, overlapLen, overlapDiffLimit, diff)){
+                OverlapResult ovr;
+                ovr.overlapped = true;
+                ovr.offset = offset;
+                ovr.overlapLen = overlapLen;
+                ovr.diff = diff;
+                return ovr;
             }
         }
-        if(diff < overlapDiffLimit || (diff >= overlapDiffLimit && i > complete_compare_require)){
-            OverlapResult ovr;
-            ovr.overlapped = true;
-            ovr.offset = offset;
-            ovr.overlapLen = overlapLen;
-            ovr.diff = diff;
-            return ovr;
-        }
-        ++offset;
     }
 
     // TEMPLATE_LEN < SEQ_LEN, so the 3' end of s1 and s2 3' endswith part of adapter sequences
-    offset = 0;
-    while(offset > overlapRequire - len2){
-        overlapLen = std::min(len1, len2 - std::abs(offset));
-        diff = 0;
-        int i = 0;
-        for(i = 0; i < overlapLen; ++i){
-            if(pstr1[i] != pstr2[-offset + i]){
-                ++diff;
-                if(diff >= overlapDiffLimit && i < complete_compare_require){
-                    break;
-                }
+    end = len2 - overlapRequire;
+    for(int from = 0; from < end; from += SCAN_BATCH){
+        int n = std::min((int)SCAN_BATCH, end - from);
+        // differences are symmetric, so read2 is the shifted one here
+        simd::headMismatches(pstr2 + from, pstr1, n, COMPLETE_COMPARE_REQUIRE, headLimit, heads);
+        for(int k = 0; k < n; ++k){
+            int shift = from + k;
+            overlapLen = std::min(len1, len2 - shift);
+            if(overlapLen >= COMPLETE_COMPARE_REQUIRE && heads[k] >= headLimit){
+                continue;
+            }
+            if(overlapAt(pstr1, pstr2 + shift, overlapLen, overlapDiffLimit, diff)){
+                OverlapResult ovr;
+                ovr.overlapped = true;
+                ovr.offset = -shift;
+                ovr.overlapLen = overlapLen;
+                ovr.diff = diff;
+                return ovr;
             }
         }
-
-        if(diff < overlapDiffLimit || (diff >= overlapDiffLimit && i > complete_compare_require)){
-            OverlapResult ovr;
-            ovr.overlapped = true;
-            ovr.offset = offset;
-            ovr.overlapLen = overlapLen;
-            ovr.diff = diff;
-            return ovr;
-        }
-        --offset;
     }
     OverlapResult ovr;
     ovr.overlapped = false;
@@ -81,16 +105,18 @@ Read* OverlapAnalysis::merge(Read* r1, Read* r2, OverlapResult& ov){
     if(ov.offset > 0){
         len2 = r2->length() - ol;
     }
-    Read* rr2 = r2->reverseComplement();
+    // the tail comes from the reverse complement of read2, built in place instead of a reversed copy of read2
     std::string mergedSeq = r1->seq.seqStr.substr(0, len1);
-    if(ov.offset > 0){
-        mergedSeq += rr2->seq.seqStr.substr(ol, len2);
-    }
     std::string mergedQual = r1->quality.substr(0, len1);
-    if(ov.offset > 0){
-        mergedQual += rr2->quality.substr(ol, len2);
+    if(len2 > 0){
+        mergedSeq.reserve(len1 + len2);
+        mergedQual.reserve(len1 + len2);
+        int last = r2->length() - 1 - ol;
+        for(int i = 0; i < len2; ++i){
+            mergedSeq.push_back(util::complement(r2->seq.seqStr[last - i]));
+            mergedQual.push_back(r2->quality[last - i]);
+        }
     }
-    delete rr2;
     std::string name = "";
     std::string::size_type pos = r1->name.find_first_of(" ");
     if(pos == std::string::npos){
@@ -102,3 +128,66 @@ Read* OverlapAnalysis::merge(Read* r1, Read* r2, OverlapResult& ov){
     Read* mergedRead = new Read(name, mergedSeq, r1->strand, mergedQual);
     return mergedRead;
 }
+
+OverlapContext::OverlapContext(int overlapDiffLimit, int overlapRequire){
+    mR1 = NULL;
+    mR2 = NULL;
+    mValid = false;
+    mLen1 = 0;
+    mLen2 = 0;
+    mDiffLimit = overlapDiffLimit;
+    mRequire = overlapRequire;
+    for(int c = 0; c < 256; ++c){
+        mComplement[c] = util::complement(c);
+    }
+}
+
+void OverlapContext::reset(Read* r1, Read* r2){
+    mR1 = r1;
+    mR2 = r2;
+    mValid = false;
+}
+
+void OverlapContext::invalidate(){
+    mValid = false;
+}
+
+OverlapResult& OverlapContext::get(){
+    // reads are only shortened after the pair is reset, so equal lengths mean the reads are untouched
+    if(mValid && mR1->length() == mLen1 && mR2->length() == mLen2){
+        return mResult;
+    }
+    mLen1 = mR1->length();
+    mLen2 = mR2->length();
+    // both buffers keep their padding and capacity from pair to pair
+    if(mSeq1.size() < (size_t)(mLen1 + simd::MISMATCH_WIDTH)){
+        mSeq1.resize(mLen1 + simd::MISMATCH_WIDTH);
+    }
+    if(mRevComp2.size() < (size_t)(mLen2 + simd::MISMATCH_WIDTH)){
+        mRevComp2.resize(mLen2 + simd::MISMATCH_WIDTH);
+    }
+    std::memcpy(&mSeq1[0], mR1->seq.seqStr.c_str(), mLen1);
+    const char* s2 = mR2->seq.seqStr.c_str();
+    for(int i = 0; i < mLen2; ++i){
+        mRevComp2[i] = mComplement[(unsigned char)s2[mLen2 - 1 - i]];
+    }
+    mResult = OverlapAnalysis::analyze(mSeq1.c_str(), mLen1, mRevComp2.c_str(), mLen2, mDiffLimit, mRequire);
+    mValid = true;
+    return mResult;
+}
+
+void OverlapContext::trimmedByOverlap(bool trimmed){
+    if(!trimmed || !mValid){
+        return;
+    }
+    // both reads are cut to the overlap length, if the overlap ran to the 5' end of read2 the reads now fully overlap
+    // at offset 0 with the same bases compared, which is what a new analysis finds at its first try
+    int ol = mResult.overlapLen;
+    if(mResult.offset < 0 && ol == mLen2 + mResult.offset && mR1->length() == ol && mR2->length() == ol){
+        mResult.offset = 0;
+        mLen1 = ol;
+        mLen2 = ol;
+    }else{
+        mValid = false;
+    }
+}
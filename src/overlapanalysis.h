@@ -4,9 +4,13 @@
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include "read.h"
+#include "util.h"
+#include "simd.h"
 
 /** Class to store overlap analysis results.*/
 class OverlapResult{
@@ -48,6 +52,17 @@ class OverlapAnalysis{
          */
         static OverlapResult analyze(Read* r1, Read* r2, int overlapDiffLimit = 5, int overlapRequire = 30);
 
+        /** Do overlap analysis of a sequence and the reverse complement of its mate, the conditions are the same as above\n
+         * heads of a batch of candidate offsets are compared by vector instructions at once, only close ones are scored in full
+         * @param s1 pointer to sequence 1, readable for simd::MISMATCH_WIDTH bytes past its end
+         * @param len1 length of sequence 1
+         * @param rs2 pointer to the reverse complement of sequence 2, readable for simd::MISMATCH_WIDTH bytes past its end
+         * @param len2 length of sequence 2
+         * @param overlapDiffLimit maximum base differences allowed in the overlapped region
+         * @param overlapRequire minimum required length of the overlapped region
+         */
+        static OverlapResult analyze(const char* s1, int len1, const char* rs2, int len2, int overlapDiffLimit, int overlapRequire);
+
         /** Merge read1/2 based on overlap analysis results
          * @param r1 pointer to Read object
          * @param r2 pointer to Read object
@@ -55,6 +70,71 @@ class OverlapAnalysis{
          * @return pointer to merged Read Object
          */
         static Read* merge(Read* r1, Read* r2, OverlapResult& ov); 
+
+    public:
+        static const int COMPLETE_COMPARE_REQUIRE = 50; ///< overlap length from which too many differences do not reject an offset
+        static const int SCAN_BATCH = 64;               ///< number of offsets whose heads are counted at once
+
+    private:
+        /** score one candidate offset, same as comparing byte by byte and stopping early at too many differences near the start
+         * @param p1 pointer to the overlapped region of sequence 1
+         * @param p2 pointer to the overlapped region of the reverse complement of sequence 2
+         * @param overlapLen length of the overlapped region
+         * @param overlapDiffLimit maximum base differences allowed in the overlapped region
+         * @param diff to store the number of differences in the overlapped region if overlapped
+         * @return true if overlapped at this offset
+         */
+        static bool overlapAt(const char* p1, const char* p2, int overlapLen, int overlapDiffLimit, int& diff);
+};
+
+/** Class to hold the overlap analysis result of the pair being processed, shared by all stages using it\n
+ * the result is computed on first use and kept until the pair is changed in a way it can not follow,\n
+ * a pair only trimmed by adapter in overlap analysis is followed exactly, other changes need a new analysis\n
+ * it keeps padded buffers of read1 and the reverse complement of read2 so analysis of one pair after another does not allocate
+ */
+class OverlapContext{
+    public:
+        /** construct an OverlapContext
+         * @param overlapDiffLimit maximum base differences allowed in the overlapped region
+         * @param overlapRequire minimum required length of the overlapped region
+         */
+        OverlapContext(int overlapDiffLimit, int overlapRequire);
+
+        /** destroy an OverlapContext */
+        ~OverlapContext() = default;
+
+        /** start a new pair, the previous result is dropped
+         * @param r1 pointer to read1
+         * @param r2 pointer to read2
+         */
+        void reset(Read* r1, Read* r2);
+
+        /** get the overlap result of the pair, analyze it again if not valid or any read was trimmed since
+         * @return reference to the overlap result
+         */
+        OverlapResult& get();
+
+        /** note that bases of the pair were changed in place, so the result is analyzed again on next use
+         */
+        void invalidate();
+
+        /** follow an adapter trimming by the overlap result, both reads are cut to the overlap length
+         * @param trimmed true if the reads were trimmed
+         */
+        void trimmedByOverlap(bool trimmed);
+
+    private:
+        Read* mR1;              ///< pointer to read1 of the pair
+        Read* mR2;              ///< pointer to read2 of the pair
+        OverlapResult mResult;  ///< overlap result of the pair
+        bool mValid;            ///< mResult matches the pair if true and both lengths are unchanged
+        int mLen1;              ///< length of read1 mResult computed for
+        int mLen2;              ///< length of read2 mResult computed for
+        int mDiffLimit;         ///< maximum base differences allowed in the overlapped region
+        int mRequire;           ///< minimum required length of the overlapped region
+        std::string mSeq1;      ///< padded buffer of read1
+        std::string mRevComp2;  ///< padded buffer of the reverse complement of read2
+        char mComplement[256];  ///< complement of each byte, a lookup instead of a branch per base
 };
 
 #endif
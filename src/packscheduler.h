@@ -0,0 +1,260 @@
+#ifndef PACK_SCHEDULER_H
+#define PACK_SCHEDULER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+/** struct to hold a batch of reads [begin, end) of a pack to be processed by one worker */
+template<typename T>
+struct PackTask{
+    T* pack;   ///< pointer to the pack the reads belong to
+    int begin; ///< index of the first read of the batch
+    int end;   ///< index after the last read of the batch
+};
+
+/** Class to schedule packs to consumer threads by work stealing\n
+ * each worker owns a deque, producers deal packs to the deques in turn, a worker takes tasks from its own deque\n
+ * and steals from the other deques when it runs dry, so a worker stuck on an expensive pack does not hold up the packs queued behind it\n
+ * after close is called(no more packs), a worker still processing a task while others are idle halves the reads left and puts\n
+ * the second half back for an idle worker to steal, so the reads of the last packs are spread over all workers\n
+ * if ordered, all packs go to one deque every worker takes from, so the pack taken is always the oldest one queued:\n
+ * consumers waiting for earlier packs(reorder window, dedup turn) would otherwise hang on a pack stuck behind them in another deque\n
+ * the pack type should have an atomic int member pending counting its tasks not finished yet
+ */
+template<typename T>
+class PackScheduler{
+    public:
+        /** construct a PackScheduler
+         * @param workers number of workers
+         * @param capacity max number of packs queued before producers wait
+         * @param minBatch min number of reads of a task split off at the tail, 0 to disable splitting
+         * @param ordered packs are taken in the order pushed if true, splitting is disabled then
+         */
+        PackScheduler(int workers, size_t capacity, int minBatch, bool ordered = false){
+            mWorkers = workers < 1 ? 1 : workers;
+            mCapacity = capacity < 1 ? 1 : capacity;
+            mOrdered = ordered;
+            mMinBatch = ordered ? 0 : minBatch;
+            for(int i = 0; i < mWorkers; ++i){
+                mLanes.push_back(new Lane());
+            }
+            mNextLane = 0;
+            mSize = 0;
+            mBusy = 0;
+            mIdle = 0;
+            mPushWaiters = 0;
+            mDrainWaiters = 0;
+            mSteals = 0;
+            mSplits = 0;
+            mClosed = false;
+        }
+
+        /** destroy a PackScheduler, packs left are not freed */
+        ~PackScheduler(){
+            for(auto& l: mLanes){
+                delete l;
+            }
+        }
+
+        /** deal a whole pack to the next worker deque, wait while capacity packs are queued
+         * @param pack pointer to the pack
+         */
+        void push(T* pack){
+            PackTask<T> task = {pack, 0, pack->count};
+            pack->pending = 1;
+            if(mSize.load() >= mCapacity){
+                std::unique_lock<std::mutex> lk(mMtx);
+                ++mPushWaiters;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                mNotFull.wait(lk, [this]{return mSize.load() < mCapacity;});
+                --mPushWaiters;
+            }
+            put(mOrdered ? 0 : mNextLane++ % mWorkers, task);
+        }
+
+        /** take a task from the deque of a worker or steal one from other deques, wait while no task is queued\n
+         * finish should be called after the task is processed
+         * @param worker index of the worker
+         * @param task to store the task taken
+         * @return false if closed, no task queued and no worker is busy(so no task will be split off)
+         */
+        bool pop(int worker, PackTask<T>& task){
+            bool got = tryPop(worker, task);
+            if(!got){
+                std::unique_lock<std::mutex> lk(mMtx);
+                ++mIdle;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                mNotEmpty.wait(lk, [this, worker, &task, &got]{
+                    got = tryPop(worker, task);
+                    return got || (mClosed && mSize.load() == 0 && mBusy.load() == 0);
+                });
+                --mIdle;
+            }
+            if(!got){
+                return false;
+            }
+            wake(mPushWaiters, mNotFull, false);
+            return true;
+        }
+
+        /** split off the second half of the reads left in a task for idle workers\n
+         * only done after close is called and no task is queued, i.e. at the tail of input
+         * @param worker index of the worker processing the task
+         * @param task task being processed, its end is moved to the split point if split
+         * @param pos index of the next read to process in the task
+         * @return true if split
+         */
+        bool share(int worker, PackTask<T>& task, int pos){
+            if(mMinBatch == 0 || task.end - pos < 2 * mMinBatch || !mClosed || mIdle.load() == 0 || mSize.load() > 0){
+                return false;
+            }
+            int mid = pos + (task.end - pos) / 2;
+            PackTask<T> rest = {task.pack, mid, task.end};
+            ++task.pack->pending;
+            task.end = mid;
+            ++mSplits;
+            put(worker, rest);
+            return true;
+        }
+
+        /** mark a task taken by pop processed, wake up idle workers and threads waiting in drain if it was the last one */
+        void finish(){
+            if(--mBusy == 0){
+                wake(mIdle, mNotEmpty, true);
+                wake(mDrainWaiters, mDrained, true);
+            }
+        }
+
+        /** wait till no task is queued and no worker is busy, i.e. all packs pushed so far are processed */
+        void drain(){
+            std::unique_lock<std::mutex> lk(mMtx);
+            ++mDrainWaiters;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            mDrained.wait(lk, [this]{return mSize.load() == 0 && mBusy.load() == 0;});
+            --mDrainWaiters;
+        }
+
+        /** mark no more packs will be pushed, wake up all idle workers */
+        void close(){
+            std::lock_guard<std::mutex> lk(mMtx);
+            mClosed = true;
+            mNotEmpty.notify_all();
+        }
+
+        /** get the number of tasks queued, only a snapshot if other threads are working on it
+         * @return number of tasks queued
+         */
+        size_t size() const{
+            return mSize.load();
+        }
+
+        /** get the number of tasks stolen from the deque of another worker
+         * @return number of tasks stolen
+         */
+        size_t steals() const{
+            return mSteals.load();
+        }
+
+        /** get the number of tasks split at the tail
+         * @return number of tasks split
+         */
+        size_t splits() const{
+            return mSplits.load();
+        }
+
+    public:
+        static const int DEFAULT_MIN_BATCH = 1000; ///< default min number of reads of a task split off
+
+    private:
+        /** struct to hold the deque of one worker */
+        struct Lane{
+            std::deque<PackTask<T>> tasks; ///< tasks queued for the worker
+            std::mutex mtx;                ///< mutex to protect tasks
+            char pad[64];                  ///< keep mutexes of different lanes on different cache lines
+        };
+
+        /** put a task into a worker deque and wake up an idle worker
+         * @param lane index of the deque
+         * @param task task to put
+         */
+        void put(int lane, const PackTask<T>& task){
+            // counted before it can be taken, so mSize never drops below zero
+            ++mSize;
+            {
+                std::lock_guard<std::mutex> lk(mLanes[lane]->mtx);
+                mLanes[lane]->tasks.push_back(task);
+            }
+            wake(mIdle, mNotEmpty, false);
+        }
+
+        /** take a task from the deque of a worker, or from the first non empty deque after it, or from the only deque if ordered
+         * @param worker index of the worker
+         * @param task to store the task taken
+         * @return true if a task taken
+         */
+        bool tryPop(int worker, PackTask<T>& task){
+            int lanes = mOrdered ? 1 : mWorkers;
+            for(int i = 0; i < lanes; ++i){
+                Lane* lane = mLanes[mOrdered ? 0 : (worker + i) % mWorkers];
+                std::lock_guard<std::mutex> lk(lane->mtx);
+                if(lane->tasks.empty()){
+                    continue;
+                }
+                task = lane->tasks.front();
+                lane->tasks.pop_front();
+                // counted busy before leaving the queue, so an idle worker never sees neither
+                ++mBusy;
+                --mSize;
+                if(i > 0){
+                    ++mSteals;
+                }
+                return true;
+            }
+            return false;
+        }
+
+        /** wake up threads parked on a condition variable if any
+         * @param waiters number of threads parked on cv
+         * @param cv condition variable to notify
+         * @param all wake up all threads if true, one thread otherwise
+         */
+        void wake(std::atomic<int>& waiters, std::condition_variable& cv, bool all){
+            // pairs with the fence after a waiter registered itself, so either the waiter sees the new state or we see the waiter
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(waiters.load(std::memory_order_relaxed) > 0){
+                std::lock_guard<std::mutex> lk(mMtx);
+                if(all){
+                    cv.notify_all();
+                }else{
+                    cv.notify_one();
+                }
+            }
+        }
+
+    private:
+        std::vector<Lane*> mLanes;         ///< deque of each worker
+        int mWorkers;                      ///< number of workers
+        size_t mCapacity;                  ///< max number of packs queued before producers wait
+        int mMinBatch;                     ///< min number of reads of a task split off, 0 if splitting disabled
+        bool mOrdered;                     ///< all packs are queued in the deque of worker 0 and taken in order if true
+        std::atomic<size_t> mNextLane;     ///< counter to deal packs to deques in turn
+        std::atomic<size_t> mSize;         ///< number of tasks queued in all deques
+        std::atomic<int> mBusy;            ///< number of tasks taken and not finished
+        std::atomic<int> mIdle;            ///< number of workers parked in pop
+        std::atomic<int> mPushWaiters;     ///< number of producers parked in push
+        std::atomic<int> mDrainWaiters;    ///< number of threads parked in drain
+        std::atomic<size_t> mSteals;       ///< number of tasks stolen
+        std::atomic<size_t> mSplits;       ///< number of tasks split
+        std::atomic<bool> mClosed;         ///< no more packs will be pushed if true
+        std::mutex mMtx;                   ///< mutex to park threads
+        std::condition_variable mNotFull;  ///< condition variable to wake up producers waiting in push
+        std::condition_variable mNotEmpty; ///< condition variable to wake up workers waiting in pop
+        std::condition_variable mDrained;  ///< condition variable to wake up threads waiting in drain
+};
+
+#endif
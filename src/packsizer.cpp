@@ -0,0 +1,62 @@
+#include "packsizer.h"
+
+PackSizer::PackSizer(int capacity, size_t targetBytes){
+    mCapacity = capacity;
+    mTargetBytes = targetBytes;
+    mSize = std::min((int)START_READS, mCapacity);
+    mBytesPerRead = 0.0;
+    mSecondsPerRead = 0.0;
+}
+
+PackSizer::~PackSizer(){
+}
+
+int PackSizer::next(){
+    return mSize.load();
+}
+
+void PackSizer::parsed(int reads, size_t bytes){
+    if(reads <= 0){
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mMtx);
+    double bpr = (double)bytes / reads;
+    mBytesPerRead = mBytesPerRead == 0.0 ? bpr : mBytesPerRead * 0.7 + bpr * 0.3;
+    // long reads should not wait for a processed pack to shrink the size
+    int cap = std::max((int)std::min((double)mCapacity, mTargetBytes / mBytesPerRead), std::min((int)MIN_READS, mCapacity));
+    if(mSize.load() > cap){
+        mSize = cap;
+    }
+}
+
+void PackSizer::processed(int reads, double seconds, double backlog){
+    if(reads <= 0){
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mMtx);
+    double spr = seconds / reads;
+    mSecondsPerRead = mSecondsPerRead == 0.0 ? spr : mSecondsPerRead * 0.7 + spr * 0.3;
+    double want = mCapacity;
+    if(mSecondsPerRead > 0.0){
+        want = std::min(want, TARGET_MILLIS / 1000.0 / mSecondsPerRead);
+    }
+    if(mBytesPerRead > 0.0){
+        want = std::min(want, mTargetBytes / mBytesPerRead);
+    }
+    int cur = mSize.load();
+    // the writer is the bottleneck, bigger packs would only take more memory
+    if(backlog > 0.5){
+        want = std::min(want, cur / 2.0);
+    }
+    want = std::max(std::min(want, cur * 2.0), cur / 2.0);
+    mSize = std::max(std::min((int)want, mCapacity), std::min((int)MIN_READS, mCapacity));
+}
+
+size_t PackSizer::bytesOf(Read* reads, int n){
+    size_t bytes = 0;
+    for(int i = 0; i < n; ++i){
+        // 4 line breaks of a record
+        bytes += reads[i].name.size() + reads[i].seq.seqStr.size() + reads[i].strand.size() + reads[i].quality.size() + 4;
+    }
+    return bytes;
+}
@@ -0,0 +1,67 @@
+#ifndef PACK_SIZER_H
+#define PACK_SIZER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include "read.h"
+
+/** Class to adapt the number of reads parsed into each pack at run time\n
+ * packs start with START_READS reads so the first output shows up fast and all workers get work early,\n
+ * producers report bytes of each pack parsed and workers report time of each batch processed, and the pack size moves\n
+ * (at most 2x per batch) towards the size taking TARGET_MILLIS to process and holding the target bytes\n
+ * the size is halved while a writer queue is more than half full, since bigger packs only pile up in front of a slow writer
+ */
+class PackSizer{
+    public:
+        /** construct a PackSizer
+         * @param capacity max number of reads a pack can hold
+         * @param targetBytes target bytes of reads in a pack
+         */
+        PackSizer(int capacity, size_t targetBytes);
+
+        /** destroy a PackSizer */
+        ~PackSizer();
+
+        /** get the number of reads to parse into the next pack
+         * @return number of reads in [1, capacity]
+         */
+        int next();
+
+        /** report a pack parsed
+         * @param reads number of reads parsed
+         * @param bytes bytes of the reads parsed
+         */
+        void parsed(int reads, size_t bytes);
+
+        /** report a batch of reads processed and adjust the pack size
+         * @param reads number of reads processed
+         * @param seconds time used to process them
+         * @param backlog fill ratio of the fullest writer queue, 0 if no writer queue
+         */
+        void processed(int reads, double seconds, double backlog);
+
+        /** get the bytes of a range of reads in fastq format
+         * @param reads pointer to the first Read
+         * @param n number of reads
+         * @return bytes of the n reads
+         */
+        static size_t bytesOf(Read* reads, int n);
+
+    public:
+        static const int START_READS = 64;    ///< number of reads of the first packs
+        static const int MIN_READS = 16;      ///< min number of reads of a pack
+        static const int TARGET_MILLIS = 200; ///< target time in milliseconds to process a pack
+
+    private:
+        int mCapacity;             ///< max number of reads a pack can hold
+        size_t mTargetBytes;       ///< target bytes of reads in a pack
+        std::atomic<int> mSize;    ///< number of reads to parse into the next pack
+        double mBytesPerRead;      ///< moving average of bytes per read, 0 if not measured yet
+        double mSecondsPerRead;    ///< moving average of processing time per read, 0 if not measured yet
+        std::mutex mMtx;           ///< mutex to protect the moving averages
+};
+
+#endif
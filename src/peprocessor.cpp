@@ -2,7 +2,6 @@
 
 PairEndProcessor::PairEndProcessor(Options* opt){
     mOptions = opt;
-    mProduceFinished = false;
     mFinishedThreads = 0;
     mFilter = new Filter(opt);
     mOutStream1 = NULL;
@@ -25,38 +24,85 @@ PairEndProcessor::PairEndProcessor(Options* opt){
     if(mOptions->duplicate.enabled){
         mDuplicate = new Duplicate(mOptions);
     }
+    mDedup = NULL;
+    if(mOptions->dedup.enabled){
+        mDedup = new Deduplicator(mOptions);
+    }
+    mPackPool = new PackPool<ReadPairPack>(mOptions->bufSize.maxReadsInPack);
+    mBufferPool = new BufferPool();
+    mPackSizer = NULL;
+    if(mOptions->bufSize.autoPackSize){
+        mPackSizer = new PackSizer(mOptions->bufSize.maxReadsInPack, (size_t)mOptions->bufSize.packMBytes << 20);
+    }
+    mMemBudget = NULL;
+    if(mOptions->bufSize.maxMemoryMBytes > 0){
+        mMemBudget = new MemoryBudget((size_t)mOptions->bufSize.maxMemoryMBytes << 20);
+        if(mDuplicate){
+            mMemBudget->chargeTables(mDuplicate->getMemoryBytes());
+        }
+        if(mDedup){
+            mMemBudget->chargeTables(mDedup->getMemoryBytes());
+        }
+    }
+    mEvaluator = NULL;
+    mStaging = false;
+    mOrderRange = 0;
+    mProducedPacks = 0;
+    if(mOptions->est.inStream){
+        mEvaluator = new Evaluator(mOptions);
+        mEvaluator->initInStream();
+        mStaging = true;
+    }
 }
 
 PairEndProcessor::~PairEndProcessor(){
-    delete mInsertSizeHist;
+    delete[] mInsertSizeHist;
     delete mUmiProcessor;
     if(mDuplicate){
         delete mDuplicate;
         mDuplicate = NULL;
     }
+    if(mDedup){
+        delete mDedup;
+        mDedup = NULL;
+    }
+    delete mPackPool;
+    delete mBufferPool;
+    if(mPackSizer){
+        delete mPackSizer;
+        mPackSizer = NULL;
+    }
+    if(mMemBudget){
+        delete mMemBudget;
+        mMemBudget = NULL;
+    }
+    if(mEvaluator){
+        delete mEvaluator;
+        mEvaluator = NULL;
+    }
 }
 
 void PairEndProcessor::initOutput(){
     if(!mOptions->unpaired1.empty()){
-        mUnPairedLeftWriter = new WriterThread(mOptions, mOptions->unpaired1);
+        mUnPairedLeftWriter = new WriterThread(mOptions, mOptions->unpaired1, mBufferPool);
     }
     if(!mOptions->unpaired2.empty() && mOptions->unpaired2 != mOptions->unpaired1){
-        mUnPairedRightWriter = new WriterThread(mOptions, mOptions->unpaired2);
+        mUnPairedRightWriter = new WriterThread(mOptions, mOptions->unpaired2, mBufferPool);
     }
     if(mOptions->mergePE.enabled){
         if(!mOptions->mergePE.out.empty()){
-            mMergedWriter = new WriterThread(mOptions, mOptions->mergePE.out);
+            mMergedWriter = new WriterThread(mOptions, mOptions->mergePE.out, mBufferPool);
         }
     }
     if(!mOptions->failedOut.empty()){
-        mFailedWriter = new WriterThread(mOptions, mOptions->failedOut);
+        mFailedWriter = new WriterThread(mOptions, mOptions->failedOut, mBufferPool);
     }
     if(mOptions->out1.empty()){
         return;
     }
-    mLeftWriter = new WriterThread(mOptions, mOptions->out1);
+    mLeftWriter = new WriterThread(mOptions, mOptions->out1, mBufferPool);
     if(!mOptions->out2.empty()){
-        mRightWriter = new WriterThread(mOptions, mOptions->out2);
+        mRightWriter = new WriterThread(mOptions, mOptions->out2, mBufferPool);
     }
 }
 
@@ -100,10 +146,25 @@ bool PairEndProcessor::process(){
     if(!mOptions->split.enabled){
         initOutput();
     }
+    if(mMemBudget){
+        for(WriterThread* w: {mLeftWriter, mRightWriter, mMergedWriter, mFailedWriter, mUnPairedLeftWriter, mUnPairedRightWriter}){
+            if(w){
+                w->setMemoryBudget(mMemBudget);
+            }
+        }
+    }
     initReadPairPackRepository();
     util::loginfo("read pack repo initialized", mOptions->logmtx);
     std::thread producer(&PairEndProcessor::producerTask, this);
     util::loginfo("producer thread started", mOptions->logmtx);
+    // read length and adapters estimated on the first packs are needed by ThreadConfig
+    if(mEvaluator){
+        std::unique_lock<std::mutex> lk(mStageMtx);
+        mStageCV.wait(lk, [this]{return !mStaging;});
+        lk.unlock();
+        mEvaluator->evaluateInStream();
+        util::loginfo("estimated in stream, read length: " + std::to_string(mOptions->est.seqLen1) + " " + std::to_string(mOptions->est.seqLen2), mOptions->logmtx);
+    }
     ThreadConfig** configs = new ThreadConfig*[mOptions->thread];
     for(int t = 0; t < mOptions->thread; ++t){
         configs[t] = new ThreadConfig(mOptions, t, true);
@@ -150,6 +211,10 @@ bool PairEndProcessor::process(){
         threads[t]->join();
     }
     util::loginfo("working threads finished", mOptions->logmtx);
+    for(auto& r: mReaders){
+        delete r;
+    }
+    mReaders.clear();
     if(!mOptions->split.enabled){
         if(leftWriterThread){
             leftWriterThread->join();
@@ -188,6 +253,10 @@ bool PairEndProcessor::process(){
         postStats1.push_back(configs[t]->getPostStats1());
         postStats2.push_back(configs[t]->getPostStats2());
         filterResults.push_back(configs[t]->getFilterResult());
+        long* insertSizeHist = configs[t]->getInsertSizeHist();
+        for(int i = 0; i <= mOptions->insertSizeMax; ++i){
+            mInsertSizeHist[i] += insertSizeHist[i];
+        }
     }
     Stats* finalPreStats1 = Stats::merge(preStats1);
     Stats* finalPreStats2 = Stats::merge(preStats2);
@@ -198,22 +267,23 @@ bool PairEndProcessor::process(){
     size_t* dupHist = NULL;
     double* dupMeanGC = NULL;
     double dupRate = 0.0;
+    double dupRateError = 0.0;
     if(mOptions->duplicate.enabled){
         dupHist = new size_t[mOptions->duplicate.histSize];
         std::memset(dupHist, 0, sizeof(size_t) * mOptions->duplicate.histSize);
         dupMeanGC = new double[mOptions->duplicate.histSize];
         std::memset(dupMeanGC, 0, sizeof(double) * mOptions->duplicate.histSize);
-        dupRate = mDuplicate->statAll(dupHist, dupMeanGC, mOptions->duplicate.histSize);
+        dupRate = mDuplicate->statAll(dupHist, dupMeanGC, mOptions->duplicate.histSize, dupRateError);
     }
 
     int peakInsertSize = getPeakInsertSize();
     JsonReporter jr(mOptions);
-    jr.setDupHist(dupHist, dupMeanGC, dupRate);
+    jr.setDupHist(dupHist, dupMeanGC, dupRate, dupRateError);
     jr.setInsertHist(mInsertSizeHist, peakInsertSize);
     jr.report(finalFilterResult,finalPreStats1, finalPostStats1, finalPreStats2, finalPostStats2);
     HtmlReporter hr(mOptions);
     hr.setInsertHist(mInsertSizeHist, peakInsertSize);
-    hr.setDupHist(dupHist, dupMeanGC, dupRate);
+    hr.setDupHist(dupHist, dupMeanGC, dupRate, dupRateError);
     hr.report(finalFilterResult,finalPreStats1, finalPostStats1, finalPreStats2, finalPostStats2);
     util::loginfo("finish generating reports", mOptions->logmtx);
     // clean up
@@ -243,6 +313,7 @@ bool PairEndProcessor::process(){
     if(!mOptions->split.enabled){
         closeOutput();
     }
+    destroyReadPairPackRepository();
     return true;
 }
 
@@ -258,30 +329,81 @@ int PairEndProcessor::getPeakInsertSize(){
     return peak;
 }
 
-bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
-    std::string outstr1;
-    std::string outstr2;
-    std::string failedOut;
-    std::string unpairedOut1;
-    std::string unpairedOut2;
-    std::string mergedOutput; 
-    std::string singleOutput;
+bool PairEndProcessor::processPairEnd(PackTask<ReadPairPack>& task, ThreadConfig* config){
+    ReadPairPack* pack = task.pack;
+    // serialize reads straight into pooled buffers handed to the writers, sized by the share of the pack bytes this task holds
+    size_t expected = pack->count > 0 ? pack->bytes / pack->count * (task.end - task.begin) : 0;
+    bool merging = mOptions->mergePE.enabled;
+    std::string* outstr1 = mBufferPool->acquire(merging ? 0 : expected / 2);
+    std::string* outstr2 = mBufferPool->acquire(merging ? 0 : expected / 2);
+    std::string* failedOut = mBufferPool->acquire();
+    std::string* unpairedOut1 = mBufferPool->acquire();
+    std::string* unpairedOut2 = mBufferPool->acquire();
+    std::string* mergedOutput = mBufferPool->acquire(merging ? expected : 0);
+    std::string* singleOutput = mBufferPool->acquire();
+    // runs of reads passing unchanged are copied from the input at once
+    RecordRun passed1(outstr1);
+    RecordRun passed2(outstr2);
+    RecordRun unpaired1(unpairedOut1);
+    RecordRun unpaired2(unpairedOut2);
+    RecordRun mergedRun(mergedOutput);
+    std::vector<std::string> spilled(mDedup ? Deduplicator::PARTITIONS : 0);
+    // with ordered output pairs are checked in input order, so the same copies are kept in every run
+    std::vector<int> verdicts;
+    if(mDedup && mOptions->orderedOutput && !pack->replayed){
+        mDedup->checkInOrder(pack->order, pack->left, pack->right, task.begin, task.end, verdicts, spilled);
+    }
     int readPassed = 0;
+    // deferred reads are counted when they are replayed
+    int readDeferred = 0;
     int mergedCount = 0;
-    for(int p = 0; p < pack->count; ++p){
-        ReadPair* pair = pack->data[p];
-        Read* or1 = pair->left;
-        Read* or2 = pair->right;
-        // do preprocess statistics
-        config->getPreStats1()->statRead(or1);
-        config->getPreStats2()->statRead(or2);
-        // do duplicate analysis if enabled
-        if(mOptions->duplicate.enabled){
-            mDuplicate->statPair(or1, or2);
+    OverlapContext overlap(mOptions->overlapDiffLimit, mOptions->overlapRequire);
+    for(int p = task.begin; p < task.end; ++p){
+        // hand half of the reads left to idle threads at the tail of input
+        mRepo.scheduler->share(config->getThreadId(), task, p);
+        Read* or1 = &pack->left[p];
+        Read* or2 = &pack->right[p];
+        // replayed pairs have been counted when they were spilled
+        if(!pack->replayed){
+            // do preprocess statistics
+            config->getPreStats1()->statRead(or1);
+            config->getPreStats2()->statRead(or2);
+            // do duplicate analysis if enabled
+            if(mOptions->duplicate.enabled){
+                mDuplicate->statPair(or1, or2);
+            }
+        }
+        // drop duplicated pairs, pairs not decided yet are replayed at the end
+        if(mDedup){
+            int dup = Deduplicator::UNIQUE;
+            if(!pack->replayed){
+                if(verdicts.empty()){
+                    ReadFingerprint fp = Deduplicator::fingerprint(or1, or2);
+                    dup = mDedup->check(fp);
+                    if(dup == Deduplicator::DEFERRED){
+                        mDedup->spill(fp, or1, or2, spilled);
+                    }
+                }else{
+                    dup = verdicts[p - task.begin];
+                }
+                if(dup == Deduplicator::DEFERRED){
+                    ++readDeferred;
+                    continue;
+                }
+            }else if(p >= pack->dupFrom){
+                dup = Deduplicator::DUPLICATE;
+            }
+            if(dup == Deduplicator::DUPLICATE){
+                config->addFilterResult(COMMONCONST::FAIL_DUPLICATE);
+                if(mFailedWriter){
+                    or1->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[COMMONCONST::FAIL_DUPLICATE]);
+                    or2->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[COMMONCONST::FAIL_DUPLICATE]);
+                }
+                continue;
+            }
         }
         // filter by index if enabled
         if(mOptions->indexFilter.enabled && mFilter->filterByIndex(or1, or2)){
-            delete pair;
             continue;
         }
         // process umi if enabled
@@ -297,23 +419,26 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
                 PolyX::trimPolyG(r1, r2, mOptions->polyGTrim.maxMismatch, mOptions->polyGTrim.allowedOneMismatchForEach, mOptions->polyGTrim.minLen, config->getFilterResult());
             }
         }
-        // do insertsize statistics only in thread 0, do adapter trimming and base correction if enabled
-        bool insertSizeEvaluated = false;
+        // do insertsize statistics in every thread, do adapter trimming and base correction if enabled
+        // all of them and merging share the overlap result of the pair
+        if(r1 && r2){
+            overlap.reset(r1, r2);
+            statInsertSize(r1, r2, overlap.get(), config);
+        }
         if(r1 && r2 && (mOptions->adapter.enableTriming || mOptions->correction.enabled)){
-            OverlapResult ov = OverlapAnalysis::analyze(r1, r2, mOptions->overlapDiffLimit, mOptions->overlapRequire);
-            // first stat insertsize
-            if(config->getThreadId() == 0){
-                statInsertSize(r1, r2, ov);
-                insertSizeEvaluated = true;
-            }
-            // second do base correction
+            // trimming uses the result before correction, so keep a copy
+            OverlapResult ov = overlap.get();
+            // first do base correction
             if(mOptions->correction.enabled){
-                BaseCorrector::correctByOverlapAnalysis(r1, r2, config->getFilterResult(), ov);
+                if(BaseCorrector::correctByOverlapAnalysis(r1, r2, config->getFilterResult(), ov) > 0){
+                    overlap.invalidate();
+                }
             }
             // then do adapter trimming
             if(mOptions->adapter.enableTriming){
                 // trim by overlap analysis firstly
                 bool trimmed = AdapterTrimmer::trimByOverlapAnalysis(r1, r2, config->getFilterResult(), ov);
+                overlap.trimmedByOverlap(trimmed);
                 // if failed, trim by input adapter if possible
                 if(!trimmed){
                     if(mOptions->adapter.adapterSeqR1Provided){
@@ -325,12 +450,6 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
                 }
             }
         }
-        // do insertsize statistics if haven't done in previous step
-        if(config->getThreadId() == 0 && !insertSizeEvaluated && r1 && r2){
-              OverlapResult ov = OverlapAnalysis::analyze(r1, r2, mOptions->overlapDiffLimit, mOptions->overlapRequire);
-              statInsertSize(r1, r2, ov);
-              insertSizeEvaluated = true;
-        }
         // trim polyX if enabled
         if(r1 && r2){
             if(mOptions->polyXTrim.enabled){
@@ -351,13 +470,13 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
         Read* merged = NULL;
         bool mergeProcessed = false;
         if(mOptions->mergePE.enabled && r1 && r2){
-            OverlapResult ov = OverlapAnalysis::analyze(r1, r2, mOptions->overlapDiffLimit, mOptions->overlapRequire);
+            OverlapResult& ov = overlap.get();
             if(ov.overlapped){
                 merged = OverlapAnalysis::merge(r1, r2, ov);
                 int result = mFilter->passFilter(merged);
                 config->addFilterResult(result, 2);
                 if(result == COMMONCONST::PASS_FILTER){
-                    mergedOutput += merged->toString();
+                    mergedRun.append(merged);
                     config->getPostStats1()->statRead(merged);
                     ++readPassed;
                     ++mergedCount;
@@ -368,13 +487,13 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
                 int result1 = mFilter->passFilter(r1);
                 config->addFilterResult(result1, 1);
                 if(result1 == COMMONCONST::PASS_FILTER){
-                    mergedOutput += r1->toString();
+                    mergedRun.append(r1);
                     config->getPostStats1()->statRead(r1);
                 }
                 int result2 = mFilter->passFilter(r2);
                 config->addFilterResult(result2, 1);
                 if(result2 == COMMONCONST::PASS_FILTER){
-                    mergedOutput += r2->toString();
+                    mergedRun.append(r2);
                     config->getPostStats2()->statRead(r2);
                 }
                 if(result1 == COMMONCONST::PASS_FILTER && result2 == COMMONCONST::PASS_FILTER){
@@ -391,10 +510,11 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
 
             if(r1 && result1 == COMMONCONST::PASS_FILTER && r2 && result2 == COMMONCONST::PASS_FILTER){
                 if(mOptions->outputToSTDOUT){
-                    singleOutput += r1->toString() + r2->toString();
+                    r1->appendTo(*singleOutput);
+                    r2->appendTo(*singleOutput);
                 }else{
-                    outstr1 += r1->toString();
-                    outstr2 += r2->toString();
+                    passed1.append(r1);
+                    passed2.append(r2);
                 }
                 if(!mOptions->mergePE.enabled){
                     config->getPostStats1()->statRead(r1);
@@ -403,32 +523,32 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
                 ++readPassed;
             }else if(r1 && result1 == COMMONCONST::PASS_FILTER){
                 if(mUnPairedLeftWriter){
-                    unpairedOut1 += r1->toString();
+                    unpaired1.append(r1);
                     if(mFailedWriter){
-                        failedOut += or2->toStringWithTag(COMMONCONST::FAILED_TYPES[result2]);
+                        or2->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[result2]);
                     }
                 }else{
                     if(mFailedWriter){
-                        failedOut += or1->toStringWithTag("paired_read_is_failing");
-                        failedOut += or2->toStringWithTag(COMMONCONST::FAILED_TYPES[result2]);
+                        or1->appendToWithTag(*failedOut, "paired_read_is_failing");
+                        or2->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[result2]);
                     }
                 }
             }else if(r2 && result2 == COMMONCONST::PASS_FILTER){
                 if(mUnPairedLeftWriter){
-                    unpairedOut2 += r2->toString();
+                    unpaired2.append(r2);
                     if(mFailedWriter){
-                        failedOut += or1->toStringWithTag(COMMONCONST::FAILED_TYPES[result2]);
+                        or1->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[result2]);
                     }
                 }else{
                     if(mFailedWriter){
-                        failedOut += or1->toStringWithTag(COMMONCONST::FAILED_TYPES[result1]);
-                        failedOut += or2->toStringWithTag("paired_read_is_failing");
+                        or1->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[result1]);
+                        or2->appendToWithTag(*failedOut, "paired_read_is_failing");
                     }
                 }
             }
         }
 
-        delete pair;
+        // or1 and or2 are owned by the pack arenas
         if(r1 && r1 != or1){
             delete r1;
         }
@@ -436,78 +556,116 @@ bool PairEndProcessor::processPairEnd(ReadPairPack* pack, ThreadConfig* config){
             delete r2;
         }
     }
-    if(!mOptions->split.enabled){
+    passed1.flush();
+    passed2.flush();
+    unpaired1.flush();
+    unpaired2.flush();
+    mergedRun.flush();
+    if(mDedup){
+        mDedup->flush(spilled);
+    }
+    // deflate gzip output before taking mOutputMtx, so workers compress their packs in parallel
+    if(mMergedWriter){
+        mMergedWriter->compress(mergedOutput);
+    }
+    if(mFailedWriter){
+        mFailedWriter->compress(failedOut);
+    }
+    if(mRightWriter && mLeftWriter){
+        mLeftWriter->compress(outstr1);
+        mRightWriter->compress(outstr2);
+    }else if(mLeftWriter){
+        mLeftWriter->compress(singleOutput);
+    }
+    if(mUnPairedLeftWriter){
+        mUnPairedLeftWriter->compress(unpairedOut1);
+    }
+    if(mUnPairedRightWriter){
+        mUnPairedRightWriter->compress(unpairedOut2);
+    }
+    // if output is ordered, WriterThread puts results in order itself
+    bool needLock = !mOptions->split.enabled && !mOptions->orderedOutput;
+    if(needLock){
         mOutputMtx.lock();
     }
     if(mOptions->outputToSTDOUT){
         if(mOptions->mergePE.enabled){
-            std::fwrite(mergedOutput.c_str(), 1, mergedOutput.length(), stdout);
+            std::fwrite(mergedOutput->c_str(), 1, mergedOutput->length(), stdout);
         }else{
-            std::fwrite(singleOutput.c_str(), 1, singleOutput.size(), stdout);
+            std::fwrite(singleOutput->c_str(), 1, singleOutput->size(), stdout);
         }
     }else if(mOptions->split.enabled){
         if(!mOptions->out1.empty()){
-            config->getWriter1()->writeString(outstr1);
+            config->getWriter1()->writeString(*outstr1);
         }
         if(!mOptions->out2.empty()){
-            config->getWriter2()->writeString(outstr2);
+            config->getWriter2()->writeString(*outstr2);
         }
     }
     
-    if(mMergedWriter && !mergedOutput.empty()){
-        char* mdata = new char[mergedOutput.size()];
-        std::memcpy(mdata, mergedOutput.c_str(), mergedOutput.size());
-        mMergedWriter->input(mdata, mergedOutput.size());
+    // every pack is input to each writer if output is ordered, so the reorder window never waits for a missing pack
+    // a buffer input is owned by its writer from then on
+    bool inputAll = mOptions->orderedOutput;
+    if(mMergedWriter && (inputAll || !mergedOutput->empty())){
+        mMergedWriter->input(pack->order, mergedOutput);
+        mergedOutput = NULL;
     }
 
-    if(mFailedWriter && !failedOut.empty()){
-        char* fdata = new char[failedOut.size()];
-        std::memcpy(fdata, failedOut.c_str(), failedOut.size());
-        mFailedWriter->input(fdata, failedOut.size());
+    if(mFailedWriter && (inputAll || !failedOut->empty())){
+        mFailedWriter->input(pack->order, failedOut);
+        failedOut = NULL;
     }
 
-    if(mRightWriter && mLeftWriter && (!outstr1.empty() || !outstr2.empty())){
-        char* ldata = new char[outstr1.size()];
-        std::memcpy(ldata, outstr1.c_str(), outstr1.size());
-        mLeftWriter->input(ldata, outstr1.size());
-        char* rdata = new char[outstr2.size()];
-        std::memcpy(rdata, outstr2.c_str(), outstr2.size());
-        mRightWriter->input(rdata, outstr2.size());
-    }else if(mLeftWriter && !singleOutput.empty()){
-        char* ldata = new char[singleOutput.size()];
-        std::memcpy(ldata, singleOutput.c_str(), singleOutput.size());
-        mLeftWriter->input(ldata, singleOutput.size());
+    if(mRightWriter && mLeftWriter && (inputAll || !outstr1->empty() || !outstr2->empty())){
+        mLeftWriter->input(pack->order, outstr1);
+        mRightWriter->input(pack->order, outstr2);
+        outstr1 = NULL;
+        outstr2 = NULL;
+    }else if(mLeftWriter && (inputAll || !singleOutput->empty())){
+        mLeftWriter->input(pack->order, singleOutput);
+        singleOutput = NULL;
     }
 
-    if(!unpairedOut1.empty() && mUnPairedLeftWriter){
-        char* unpairedData1 = new char[unpairedOut1.size()];
-        std::memcpy(unpairedData1, unpairedOut1.c_str(), unpairedOut1.size());
-        mUnPairedLeftWriter->input(unpairedData1, unpairedOut1.size());
+    if(mUnPairedLeftWriter && (inputAll || !unpairedOut1->empty())){
+        mUnPairedLeftWriter->input(pack->order, unpairedOut1);
+        unpairedOut1 = NULL;
     }
-    if(!unpairedOut2.empty() && mUnPairedRightWriter){
-        char* unpairedData2 = new char[unpairedOut2.size()];
-        std::memcpy(unpairedData2, unpairedOut2.c_str(), unpairedOut2.size());
-        mUnPairedRightWriter->input(unpairedData2, unpairedOut2.size());
+    if(mUnPairedRightWriter && (inputAll || !unpairedOut2->empty())){
+        mUnPairedRightWriter->input(pack->order, unpairedOut2);
+        unpairedOut2 = NULL;
     }
 
-    if(!mOptions->split.enabled){
+    if(needLock){
         mOutputMtx.unlock();
     }
+    // buffers not handed to a writer go back to the pool
+    mBufferPool->release(outstr1);
+    mBufferPool->release(outstr2);
+    mBufferPool->release(failedOut);
+    mBufferPool->release(unpairedOut1);
+    mBufferPool->release(unpairedOut2);
+    mBufferPool->release(mergedOutput);
+    mBufferPool->release(singleOutput);
     if(mOptions->split.byFileLines){
         config->markProcessed(readPassed);
     }else{
-        config->markProcessed(pack->count);
+        config->markProcessed(task.end - task.begin - readDeferred);
     }
     if(mOptions->mergePE.enabled){
         config->addMergedPairs(mergedCount);
     }
-    delete[] pack->data;
-    delete pack;
+    // hand the whole arenas back for reuse in one step after its last batch
+    if(--pack->pending == 0){
+        if(mMemBudget){
+            mMemBudget->release(pack->bytes);
+        }
+        mPackPool->release(pack);
+    }
     
     return true;
 }
 
-void PairEndProcessor::statInsertSize(Read* r1, Read* r2, OverlapResult& ov){
+void PairEndProcessor::statInsertSize(Read* r1, Read* r2, OverlapResult& ov, ThreadConfig* config){
     int isize = mOptions->insertSizeMax;
     if(ov.overlapped){
         if(ov.offset > 0){
@@ -519,122 +677,273 @@ void PairEndProcessor::statInsertSize(Read* r1, Read* r2, OverlapResult& ov){
     if(isize > mOptions->insertSizeMax){
         isize = mOptions->insertSizeMax;
     }
-    ++mInsertSizeHist[isize];
+    ++config->getInsertSizeHist()[isize];
 }
 
 void PairEndProcessor::initReadPairPackRepository(){
-    mRepo.packBuffer = new ReadPairPack*[mOptions->bufSize.maxPacksInReadPackRepo];
-    std::memset(mRepo.packBuffer, 0, sizeof(ReadPairPack*) * mOptions->bufSize.maxPacksInReadPackRepo);
-    mRepo.writePos = 0;
-    mRepo.readPos = 0;
+    // producers wait when consumers fall behind, so at most maxPacksInMemory parsed packs wait for processing
+    // if output is ordered packs are taken in input order and not split, each pack should reach the writers as a whole
+    mRepo.scheduler = new PackScheduler<ReadPairPack>(mOptions->thread, std::min(mOptions->bufSize.maxPacksInReadPackRepo, mOptions->bufSize.maxPacksInMemory + 1), PackScheduler<ReadPairPack>::DEFAULT_MIN_BATCH, mOptions->orderedOutput);
 }
 
 void PairEndProcessor::destroyReadPairPackRepository(){
-    delete[] mRepo.packBuffer;
-    mRepo.packBuffer = NULL;
+    if(mMemBudget){
+        util::loginfo("peak memory in flight(MB): " + std::to_string(mMemBudget->peak() >> 20) + " of " + std::to_string(mOptions->bufSize.maxMemoryMBytes), mOptions->logmtx);
+    }
+    util::loginfo("packs stolen: " + std::to_string(mRepo.scheduler->steals()) + ", split: " + std::to_string(mRepo.scheduler->splits()), mOptions->logmtx);
+    delete mRepo.scheduler;
+    mRepo.scheduler = NULL;
 }
 
 void PairEndProcessor::producePack(ReadPairPack* pack){
-    while(mRepo.writePos >= mOptions->bufSize.maxPacksInReadPackRepo){
-        usleep(1);
+    if(mOptions->orderedOutput){
+        // ranges produce one after another, so packs enter the queue in input order
+        std::unique_lock<std::mutex> lk(mOrderMtx);
+        mOrderCV.wait(lk, [this, pack]{return pack->range == mOrderRange;});
+        pack->order = mProducedPacks++;
+    }
+    // charged only when it enters the queue, a pack waiting for its range to come holds no budget other readers wait on
+    if(mMemBudget){
+        mMemBudget->charge(pack->bytes);
+    }
+    mRepo.scheduler->push(pack);
+    util::loginfo("producer produced pack(range " + std::to_string(pack->range) + " pack " + std::to_string(pack->seq) + ")", mOptions->logmtx);
+}
+
+bool PairEndProcessor::consumePack(ThreadConfig* config){
+    PackTask<ReadPairPack> task;
+    if(!mRepo.scheduler->pop(config->getThreadId(), task)){
+        return false;
+    }
+    std::string packName = std::to_string(task.pack->range) + ":" + std::to_string(task.pack->seq);
+    if(task.begin > 0 || task.end < task.pack->count){
+        packName += "[" + std::to_string(task.begin) + "," + std::to_string(task.end) + ")";
+    }
+    util::loginfo("thread " + std::to_string(config->getThreadId()) + " start processing pack " + packName, mOptions->logmtx);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    processPairEnd(task, config);
+    mRepo.scheduler->finish();
+    if(mMemBudget){
+        mMemBudget->chargeTables(config->getStatsGrowth());
+    }
+    if(mPackSizer){
+        std::chrono::duration<double> used = std::chrono::steady_clock::now() - start;
+        mPackSizer->processed(task.end - task.begin, used.count(), writerBacklog());
+    }
+    util::loginfo("thread " + std::to_string(config->getThreadId()) + " finish processing pack " + packName, mOptions->logmtx);
+    return true;
+}
+
+void PairEndProcessor::stagePack(ReadPairPack* pack){
+    if(!mStaging){
+        producePack(pack);
+        return;
+    }
+    mStagedPacks.push_back(pack);
+    if(mEvaluator->addInStream(pack)){
+        releaseStagedPacks();
     }
-    mRepo.packBuffer[mRepo.writePos] = pack;
-    util::loginfo("producer produced pack " + std::to_string(mRepo.writePos), mOptions->logmtx);
-    ++mRepo.writePos;
 }
 
-void PairEndProcessor::consumePack(ThreadConfig* config){
-    mInputMtx.lock();
-    while(mRepo.writePos <= mRepo.readPos){
-        usleep(1);
-        if(mProduceFinished){
-            mInputMtx.unlock();
-            return;
-        }
-    }
-    size_t packNum = mRepo.readPos;
-    ReadPairPack* data = mRepo.packBuffer[packNum];
-    ++mRepo.readPos;
-    if(mRepo.readPos >= mOptions->bufSize.maxPacksInReadPackRepo){
-        mRepo.readPos = mRepo.readPos %  mOptions->bufSize.maxPacksInReadPackRepo;
-        mRepo.writePos = mRepo.writePos % mOptions->bufSize.maxPacksInReadPackRepo;
-    }
-    mInputMtx.unlock();
-    util::loginfo("thread " + std::to_string(config->getThreadId()) + " start processing pack " + std::to_string(packNum), mOptions->logmtx);
-    processPairEnd(data, config);
-    util::loginfo("thread " + std::to_string(config->getThreadId()) + " finish processing pack " + std::to_string(packNum), mOptions->logmtx);
+void PairEndProcessor::releaseStagedPacks(){
+    {
+        std::lock_guard<std::mutex> lk(mStageMtx);
+        mStaging = false;
+    }
+    mStageCV.notify_all();
+    util::loginfo("staged packs released: " + std::to_string(mStagedPacks.size()), mOptions->logmtx);
+    for(auto& p: mStagedPacks){
+        producePack(p);
+    }
+    mStagedPacks.clear();
+}
+
+double PairEndProcessor::writerBacklog(){
+    double backlog = 0.0;
+    for(WriterThread* w: {mLeftWriter, mRightWriter, mMergedWriter}){
+        if(w){
+            backlog = std::max(backlog, (double)w->bufferLength() / w->bufferCapacity());
+        }
+    }
+    return backlog;
+}
+
+void PairEndProcessor::finishRange(int range){
+    if(!mOptions->orderedOutput){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mOrderMtx);
+        mOrderRange = range + 1;
+    }
+    mOrderCV.notify_all();
 }
 
 void PairEndProcessor::producerTask(){
     util::loginfo("loading data started", mOptions->logmtx);
-    size_t readNum = 0;
-    ReadPair** data = new ReadPair*[mOptions->bufSize.maxReadsInPack];
-    std::memset(data, 0, sizeof(ReadPair*) * mOptions->bufSize.maxReadsInPack);
-    FqReaderPair reader(mOptions->in1, mOptions->in2, true, mOptions->phred64, mOptions->interleavedInput);
-    size_t count = 0;
-    while(true){
-        ReadPair* readPair = reader.read();
-        ++readNum;
-        if(!readPair){
-            if(count == 0){
-                break;
+    std::vector<FqReaderPair*> readers;
+    // ordinary gzip input with sidecar indexes can be inflated by several producers, each from a checkpoint
+    GzIndex* leftIndex = NULL;
+    GzIndex* rightIndex = NULL;
+    if(mOptions->parseThread > 1 && !mOptions->interleavedInput &&
+       util::endsWith(mOptions->in1, ".gz") && !BgzfReader::isBgzf(mOptions->in1) &&
+       util::endsWith(mOptions->in2, ".gz") && !BgzfReader::isBgzf(mOptions->in2)){
+        leftIndex = GzIndex::load(mOptions->in1);
+        rightIndex = GzIndex::load(mOptions->in2);
+    }
+    if(leftIndex && rightIndex){
+        // read1 ranges start at its checkpoints, read2 starts from the checkpoint before and skips to the same record
+        std::vector<size_t> bounds = leftIndex->splitRecords(mOptions->parseThread);
+        for(size_t i = 0; i + 1 < bounds.size(); ++i){
+            FqReader* left = new FqReader(mOptions->in1, leftIndex, bounds[i], bounds[i + 1], true, mOptions->phred64);
+            FqReader* right = new FqReader(mOptions->in2, rightIndex, bounds[i], bounds[i + 1], true, mOptions->phred64);
+            readers.push_back(new FqReaderPair(left, right));
+        }
+        util::loginfo("indexed input split into " + std::to_string(readers.size()) + " ranges", mOptions->logmtx);
+    }else{
+        readers.push_back(new FqReaderPair(mOptions->in1, mOptions->in2, true, mOptions->phred64, mOptions->interleavedInput, mOptions->inflateThread));
+        // uncompressed input mapped into memory can be parsed by several producers, read1 and read2 ranges hold the same records
+        std::vector<size_t> leftBounds;
+        std::vector<size_t> rightBounds;
+        if(mOptions->parseThread > 1 && readers[0]->splitRanges(mOptions->parseThread, leftBounds, rightBounds)){
+            for(size_t i = 0; i + 2 < leftBounds.size(); ++i){
+                readers.push_back(new FqReaderPair(mOptions->in1, mOptions->in2, true, mOptions->phred64, false, mOptions->inflateThread));
             }
-            ReadPairPack* pack = new ReadPairPack;
-            pack->data = data;
-            pack->count = count;
-            producePack(pack);
-            data = NULL;
-            if(readPair){
-                delete readPair;
-                readPair = NULL;
+            for(size_t i = 0; i < readers.size(); ++i){
+                readers[i]->left->setRange(leftBounds[i], leftBounds[i + 1]);
+                readers[i]->right->setRange(rightBounds[i], rightBounds[i + 1]);
             }
-            break;
+            util::loginfo("input split into " + std::to_string(readers.size()) + " ranges", mOptions->logmtx);
         }
-        data[count] = readPair;
-        ++count;
-        if(count == mOptions->bufSize.maxReadsInPack){
-            ReadPairPack* pack = new ReadPairPack;
-            pack->data = data;
-            pack->count = count;
-            producePack(pack);
-            data = new ReadPair*[mOptions->bufSize.maxReadsInPack];
-            std::memset(data, 0, sizeof(ReadPair*) * mOptions->bufSize.maxReadsInPack);
-            while(mRepo.writePos - mRepo.readPos > mOptions->bufSize.maxPacksInMemory){
-                usleep(1);
+    }
+    // reads of mapped input are output straight from the mapping if unchanged
+    for(auto& r: readers){
+        r->left->setKeepRaw(true);
+        if(r->right){
+            r->right->setKeepRaw(true);
+        }
+    }
+    std::vector<size_t> readNums(readers.size(), 0);
+    std::vector<std::thread> parsers;
+    for(size_t i = 1; i < readers.size(); ++i){
+        parsers.emplace_back(&PairEndProcessor::parseTask, this, readers[i], i, &readNums[i]);
+    }
+    parseTask(readers[0], 0, &readNums[0]);
+    for(auto& t: parsers){
+        t.join();
+    }
+    // reads may point into the readers until processed, so they are deleted after the working threads finish
+    mReaders = readers;
+    if(leftIndex){
+        delete leftIndex;
+    }
+    if(rightIndex){
+        delete rightIndex;
+    }
+    if(mDedup){
+        replaySpilled(readers.size());
+    }
+    mRepo.scheduler->close();
+    util::loginfo("loaded reads: " + std::to_string(std::accumulate(readNums.begin(), readNums.end(), (size_t)0)), mOptions->logmtx);
+}
+
+void PairEndProcessor::replaySpilled(int firstRange){
+    // every pair spilled is on disk once all packs produced so far are processed
+    mRepo.scheduler->drain();
+    if(!mDedup->hasSpilled()){
+        return;
+    }
+    util::loginfo("replaying " + std::to_string(mDedup->getSpilled()) + " pairs spilled by dedup", mOptions->logmtx);
+    std::atomic<int> next(0);
+    std::vector<std::thread> resolvers;
+    for(int t = 0; t < mOptions->thread; ++t){
+        resolvers.emplace_back(&PairEndProcessor::replayTask, this, firstRange, &next);
+    }
+    for(auto& t: resolvers){
+        t.join();
+    }
+}
+
+void PairEndProcessor::replayTask(int firstRange, std::atomic<int>* next){
+    int partition = 0;
+    while((partition = (*next)++) < Deduplicator::PARTITIONS){
+        std::vector<Read> reads1;
+        std::vector<Read> reads2;
+        size_t uniques = mDedup->resolve(partition, reads1, reads2);
+        size_t seq = 0;
+        for(size_t start = 0; start < reads1.size(); start += mOptions->bufSize.maxReadsInPack){
+            if(mMemBudget){
+                mMemBudget->wait();
             }
-            readNum += count;
-            if(readNum % (mOptions->bufSize.maxReadsInPack * mOptions->bufSize.maxPacksInMemory) == 0 && mLeftWriter){
-                while( (mLeftWriter && mLeftWriter->bufferLength() > mOptions->bufSize.maxPacksInMemory) ||
-                       (mRightWriter && mRightWriter->bufferLength() > mOptions->bufSize.maxPacksInMemory)){
-                    usleep(1);
-                }
+            ReadPairPack* pack = mPackPool->acquire();
+            pack->count = std::min(reads1.size() - start, mOptions->bufSize.maxReadsInPack);
+            for(int i = 0; i < pack->count; ++i){
+                pack->left[i].swap(reads1[start + i]);
+                pack->right[i].swap(reads2[start + i]);
             }
-            count = 0;
+            pack->replayed = true;
+            pack->dupFrom = std::min(std::max(uniques, start) - start, (size_t)pack->count);
+            pack->range = firstRange + partition;
+            pack->seq = seq++;
+            pack->bytes = PackSizer::bytesOf(pack->left, pack->count) + PackSizer::bytesOf(pack->right, pack->count);
+            producePack(pack);
+        }
+        finishRange(firstRange + partition);
+        if(!reads1.empty()){
+            util::loginfo("dedup partition " + std::to_string(partition) + " replayed, unique pairs: " + std::to_string(uniques) + ", duplicated: " + std::to_string(reads1.size() - uniques), mOptions->logmtx);
         }
     }
-    mProduceFinished = true;
-    util::loginfo("loaded reads: " + std::to_string(readNum - 1), mOptions->logmtx);
 }
 
-void PairEndProcessor::consumerTask(ThreadConfig* config){
+void PairEndProcessor::parseTask(FqReaderPair* reader, int range, size_t* readNum){
+    size_t seq = 0;
+    ReadPairPack* pack = mPackPool->acquire();
     while(true){
-        if(config->canBeStopped()){
-            ++mFinishedThreads;
-            break;
-        }
-        while(mRepo.writePos <= mRepo.readPos){
-            if(mProduceFinished){
-                break;
+        // parse a whole pack straight into the pack arenas
+        // packs held back for estimation are only released by parsing more, so they are not throttled
+        if(mMemBudget && !(range == 0 && mStaging)){
+            mMemBudget->wait();
+        }
+        int limit = mPackSizer ? mPackSizer->next() : pack->capacity;
+        *readNum += reader->readBatch(pack, limit);
+        pack->range = range;
+        pack->seq = seq;
+        // the size also sets how much output buffer workers reserve for the pack
+        pack->bytes = PackSizer::bytesOf(pack->left, pack->count) + PackSizer::bytesOf(pack->right, pack->count);
+        if(mPackSizer){
+            mPackSizer->parsed(pack->count, pack->bytes);
+        }
+        if(pack->count < limit){
+            if(pack->count == 0){
+                mPackPool->release(pack);
+            }else if(range == 0){
+                stagePack(pack);
+            }else{
+                producePack(pack);
             }
-            usleep(1);
-        }
-        if(mProduceFinished && mRepo.writePos == mRepo.readPos){
-            ++mFinishedThreads;
+            pack = NULL;
             break;
         }
-        consumePack(config);
+        if(range == 0){
+            stagePack(pack);
+        }else{
+            producePack(pack);
+        }
+        ++seq;
+        pack = mPackPool->acquire();
     }
-    if(mFinishedThreads == mOptions->thread){
+    // input shorter than the sample
+    if(range == 0 && mStaging){
+        releaseStagedPacks();
+    }
+    finishRange(range);
+    util::loginfo("loaded reads of range " + std::to_string(range) + ": " + std::to_string(*readNum), mOptions->logmtx);
+}
+
+void PairEndProcessor::consumerTask(ThreadConfig* config){
+    while(!config->canBeStopped() && consumePack(config)){
+    }
+    if(++mFinishedThreads == mOptions->thread){
         if(mLeftWriter){
             mLeftWriter->setInputCompleted();
         }
@@ -658,13 +967,7 @@ void PairEndProcessor::consumerTask(ThreadConfig* config){
 }
 
 void PairEndProcessor::writeTask(WriterThread* config){
-    while(true){
-        if(config->isCompleted()){
-            config->output();
-            break;
-        }
-        config->output();
-    }
+    config->output();
     std::string msg = config->getFilename() + " writer finished";
     util::loginfo(msg, mOptions->logmtx);
 }
@@ -6,6 +6,9 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
 #include <unistd.h>
 #include "read.h"
 #include "util.h"
@@ -14,7 +17,14 @@
 #include "stats.h"
 #include "common.h"
 #include "fqreader.h"
+#include "readpack.h"
+#include "packscheduler.h"
+#include "packsizer.h"
+#include "memorybudget.h"
+#include "bufferpool.h"
 #include "duplicate.h"
+#include "deduplicator.h"
+#include "evaluator.h"
 #include "umiprocessor.h"
 #include "jsonreporter.h"
 #include "writerthread.h"
@@ -24,17 +34,9 @@
 #include "basecorrector.h"
 #include "adaptertrimmer.h"
 
-/** struct to store pointers of ReadPair */
-struct ReadPairPack {
-    ReadPair** data; ///< array to store ReadPair pointers
-    int count;       ///< number of RaedPair pointers stored in data
-};
-   
 /** struct to store pointers of ReadPairPack */
 struct ReadPairPackRepository{
-    ReadPairPack** packBuffer;  ///< array to store ReadPairPack pointers
-    std::atomic<size_t> readPos;  ///< atomic type long integer to store the index next pointer of ReadPairPack will be extracted
-    std::atomic<size_t> writePos; ///< atomic type long integer to store the index next pointer of ReadPairPack will be writen in
+    PackScheduler<ReadPairPack>* scheduler; ///< work stealing scheduler to pass ReadPairPacks from producers to consumers
 };
 
 /** class to process pair end fastq */
@@ -53,39 +55,80 @@ class PairEndProcessor{
          */
         bool process();
 
-        /** process a ReadPairPack 
-         * @param pack pointer to ReadPairPack
+        /** process a batch of pairs of a ReadPairPack, recycle the pack after all its batches processed\n
+         * the end of task is moved back if the second half of the reads left is shared with idle threads at the tail of input
+         * @param task batch of pairs of a ReadPairPack
          * @param config pointer to ThreadConfig
          * @return true if finish process
          */
-        bool processPairEnd(ReadPairPack* pack, ThreadConfig* config);
+        bool processPairEnd(PackTask<ReadPairPack>& task, ThreadConfig* config);
         
         /** initialize ReadPairPackRepository\n
-         * allocate memory to store at most mOptions->bufSize.maxPacksInReadPackRepo ReadPairPack pointers
-         * set readPos and writePos of ReadPairPackRepository to be zero
+         * create a scheduler with a deque for each worker, which queues at most min(mOptions->bufSize.maxPacksInReadPackRepo, mOptions->bufSize.maxPacksInMemory + 1) ReadPairPacks
          */
         void initReadPairPackRepository();
         
         /** destroy ReadPairPackRepository and free memory used */
         void destroyReadPairPackRepository();
 
-        /** put a newly generated ReadPairPack pointer to the proper position in ReadPairPackRepository\n
-         * that is writePos in packBuffer and increase writePos
+        /** put a newly generated ReadPairPack pointer into ReadPairPackRepository, wait while it is full\n
+         * if output is ordered, also wait until all earlier ranges finished and tag the pack with its order
          * @param pack pointer to ReadPairPack
          */
         void producePack(ReadPairPack* pack);
 
-        /** extract a ReadPairPack from ReadPairPackRepository and process in a thread
+        /** hold a ReadPairPack of the first range back until estimations on the first packs are done\n
+         * the pack is passed to producePack directly if estimating in stream is disabled or done
+         * @param pack pointer to ReadPairPack
+         */
+        void stagePack(ReadPairPack* pack);
+
+        /** finish staging, wake up the estimating thread and pass all packs held back to producePack in order */
+        void releaseStagedPacks();
+
+        /** get the fill ratio of the fullest WriterThread queue
+         * @return fill ratio in [0, 1], 0 if output is not written by WriterThreads
+         */
+        double writerBacklog();
+
+        /** mark all packs of a range produced, hand producing over to the next range if output is ordered
+         * @param range index of the range finished
+         */
+        void finishRange(int range);
+
+        /** take a batch of pairs from the deque of a thread or steal one from other threads and process it, wait while none queued
          * @param config pointer to ThreadConfig
+         * @return false if all packs have been consumed
          */
-        void consumePack(ThreadConfig* config);
+        bool consumePack(ThreadConfig* config);
 
         /** a task running asynchronously to read pair of reads into memory\n
          * put into a ReadPairPack firstly, if ReadPairPack filled or finished reading\n
          * put this ReadPairPack into the ReadPairPackRepository\n
+         * uncompressed input is split into at most mOptions->parseThread ranges parsed by parseTask concurrently
          */
         void producerTask();
 
+        /** a task to parse all pairs of a FqReaderPair into ReadPairPacks and store them into ReadPairPackRepository
+         * @param reader pointer to FqReaderPair, maybe restricted to a range of the input
+         * @param range index of the range parsed by reader
+         * @param readNum pointer to store the number of pairs parsed
+         */
+        void parseTask(FqReaderPair* reader, int range, size_t* readNum);
+
+        /** replay pairs spilled by mDedup after all packs produced so far are processed\n
+         * partitions are resolved by mOptions->thread threads running replayTask, partition i is produced as range firstRange + i
+         * @param firstRange index of the range of the first partition
+         */
+        void replaySpilled(int firstRange);
+
+        /** a task to resolve dedup partitions one after another and produce their pairs as replayed ReadPairPacks\n
+         * unique pairs come first in each partition and the duplicates after them
+         * @param firstRange index of the range of the first partition
+         * @param next pointer to the index of the next partition to resolve, shared by all replayTasks
+         */
+        void replayTask(int firstRange, std::atomic<int>* next);
+
         /** a task running asynchronously to process read pairs in a thread
          * @param config pointer to ThreadConfig
          */
@@ -108,8 +151,9 @@ class PairEndProcessor{
          * @param r1 pointer to Read object (read1)
          * @param r2 pointer to Read object (read2)
          * @param ov reference to OverlapResult object
+         * @param config pointer to ThreadConfig of the calling thread, whose histogram is updated
          */
-        void statInsertSize(Read* r1, Read* r2, OverlapResult& ov);
+        void statInsertSize(Read* r1, Read* r2, OverlapResult& ov, ThreadConfig* config);
 
         /** get insert size peak
          * @return inert size peak
@@ -124,17 +168,20 @@ class PairEndProcessor{
     private:
         Options* mOptions;                   ///< a pointer to object Options
         ReadPairPackRepository mRepo;        ///< ReadPairPackRepository object to store pointers of ReadPairPack
-        std::atomic<bool> mProduceFinished;  ///< an atom type bool value to mark all reads have been read if true
+        PackPool<ReadPairPack>* mPackPool;   ///< pool to recycle ReadPairPacks after processing
+        PackSizer* mPackSizer;               ///< pointer to PackSizer to adapt the number of pairs in a pack, NULL if fixed
+        MemoryBudget* mMemBudget;            ///< pointer to MemoryBudget to throttle parsing, NULL if memory not limited
+        BufferPool* mBufferPool;             ///< pool to recycle output buffers after written
+        std::vector<FqReaderPair*> mReaders; ///< readers of the input, kept until all packs processed since reads may point into them
         std::atomic<int> mFinishedThreads;   ///< an atom type int value to store the finished writing threads number
         std::mutex mOutputMtx;               ///< a mutex object to be locked when mRepo is extracted to be processed
-        std::mutex mInputMtx;                ///< a mutex object to be locked when input to the WriterThread 
         Filter* mFilter;                     ///< a pointer to a Filter object to do various filter of pe reads
         gzFile mZipFile1;                    ///< gzFile to output read1 results
         gzFile mZipFile2;                    ///< gzFile to output read2 results
         std::ofstream* mOutStream1;          ///< output filestream to output read1
         std::ofstream* mOutStream2;          ///< output filestream to output read2
         UmiProcessor* mUmiProcessor;         ///< pointer to UmiProcessor to do umi process
-        long* mInsertSizeHist;               ///< array to store different insert size counts
+        long* mInsertSizeHist;               ///< array to store insert size counts merged from all threads
         WriterThread* mLeftWriter;           ///< pointer to a WriterThread object to write read1
         WriterThread* mRightWriter;          ///< pointer to a WriterThread object to write read2
         WriterThread* mMergedWriter;         ///< pointer to a WriterThread object to write merged output
@@ -142,6 +189,16 @@ class PairEndProcessor{
         WriterThread* mUnPairedLeftWriter;   ///< pointer to a WriterThread object to write unpaired read1
         WriterThread* mUnPairedRightWriter;  ///< pointer to a WriterThread object to write unpaired read2
         Duplicate* mDuplicate;               ///< pointer to a Duplicate object to du duplicate analysis
+        Deduplicator* mDedup;                ///< pointer to Deduplicator to drop duplicated pairs, NULL if dedup disabled
+        Evaluator* mEvaluator;               ///< pointer to an Evaluator object to estimate on the first packs if estimating in stream
+        std::vector<ReadPairPack*> mStagedPacks; ///< packs held back until estimations on them are done
+        bool mStaging;                       ///< packs of the first range are held back if true
+        std::mutex mStageMtx;                ///< a mutex object to protect mStaging
+        std::condition_variable mStageCV;    ///< a condition variable to notify staging finished
+        int mOrderRange;                     ///< index of the range allowed to produce packs if output is ordered
+        size_t mProducedPacks;               ///< number of packs produced, used as order of the next pack
+        std::mutex mOrderMtx;                ///< a mutex object to protect mOrderRange and mProducedPacks
+        std::condition_variable mOrderCV;    ///< a condition variable to notify mOrderRange advanced
 };
 
 #endif
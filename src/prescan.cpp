@@ -0,0 +1,87 @@
+#include "prescan.h"
+
+PrescanSample::PrescanSample(){
+    mOffsets.push_back(0);
+    mScannedReads = 0;
+    mScannedBases = 0;
+    mReachedEOF = false;
+    mFirstReadPos = 0;
+    mLastReadPos = 0;
+    mBytesTotal = 0;
+}
+
+PrescanSample::~PrescanSample(){
+}
+
+void PrescanSample::load(const std::string& filename, int inflateThreads){
+    if(filename.empty()){
+        mReachedEOF = true;
+        return;
+    }
+    FqReader fqr(filename, true, false, inflateThreads);
+    // parse the first read alone so the bytes consumed after it are exact for mapped input
+    ReadPack pack(4096);
+    if(!fqr.read(&pack.data[0])){
+        mReachedEOF = true;
+        return;
+    }
+    mFirstName = pack.data[0].name;
+    add(&pack.data[0]);
+    fqr.getBytes(mFirstReadPos, mBytesTotal);
+    while(mScannedReads < SCAN_READ_LIMIT && mScannedBases < SCAN_BASE_LIMIT){
+        // reads beyond the base limit in the last batch are still scanned to keep read number and bytes consumed consistent
+        int n = fqr.readBatch(pack.data, std::min((size_t)pack.capacity, SCAN_READ_LIMIT - mScannedReads));
+        if(n == 0){
+            mReachedEOF = true;
+            break;
+        }
+        for(int i = 0; i < n; ++i){
+            add(&pack.data[i]);
+        }
+    }
+    fqr.getBytes(mLastReadPos, mBytesTotal);
+}
+
+void PrescanSample::add(Read* r){
+    if(!isFull()){
+        mBases.append(r->seq.seqStr);
+        mOffsets.push_back(mBases.size());
+    }
+    ++mScannedReads;
+    mScannedBases += r->length();
+}
+
+bool PrescanSample::isFull() const{
+    size_t kept = mOffsets.size() - 1;
+    return kept >= KEEP_READ_MIN && (kept >= KEEP_READ_LIMIT || mBases.size() >= KEEP_BASE_LIMIT);
+}
+
+size_t PrescanSample::size() const{
+    return mOffsets.size() - 1;
+}
+
+const char* PrescanSample::seq(size_t i) const{
+    return mBases.data() + mOffsets[i];
+}
+
+int PrescanSample::length(size_t i) const{
+    return mOffsets[i + 1] - mOffsets[i];
+}
+
+const std::string& PrescanSample::firstName() const{
+    return mFirstName;
+}
+
+size_t PrescanSample::scannedReads() const{
+    return mScannedReads;
+}
+
+bool PrescanSample::reachedEOF() const{
+    return mReachedEOF;
+}
+
+void PrescanSample::getBytes(size_t& firstReadPos, size_t& lastReadPos, size_t& bytesTotal) const{
+    firstReadPos = mFirstReadPos;
+    lastReadPos = mLastReadPos;
+    bytesTotal = mBytesTotal;
+}
@@ -0,0 +1,99 @@
+#ifndef PRESCAN_H
+#define PRESCAN_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "read.h"
+#include "readpack.h"
+#include "fqreader.h"
+
+/** Class to hold the head of a fastq file decoded once for all evaluations\n
+ * at most SCAN_READ_LIMIT reads or SCAN_BASE_LIMIT bases are scanned to estimate the read number,\n
+ * sequences of the first KEEP_READ_LIMIT reads or KEEP_BASE_LIMIT bases(but at least KEEP_READ_MIN reads) are kept back to back in one buffer\n
+ * so read length, over represented sequence and adapter evaluation can run on them without decoding the file again
+ */
+class PrescanSample{
+    public:
+        /** construct an empty PrescanSample */
+        PrescanSample();
+
+        /** destroy a PrescanSample */
+        ~PrescanSample();
+
+        /** decode the head of a fastq file into this sample
+         * @param filename fastq file name, an empty name leaves the sample empty
+         * @param inflateThreads number of threads to inflate BGZF input
+         */
+        void load(const std::string& filename, int inflateThreads);
+
+        /** scan a read and keep its sequence if keep limits not reached
+         * @param r pointer to Read
+         */
+        void add(Read* r);
+
+        /** test whether keep limits reached
+         * @return true if no more read will be kept
+         */
+        bool isFull() const;
+
+        /** get the number of reads kept
+         * @return number of reads whose sequence kept in this sample
+         */
+        size_t size() const;
+
+        /** get the sequence of a kept read
+         * @param i index of the read
+         * @return pointer to the first base of the sequence, not null terminated
+         */
+        const char* seq(size_t i) const;
+
+        /** get the sequence length of a kept read
+         * @param i index of the read
+         * @return length of the sequence
+         */
+        int length(size_t i) const;
+
+        /** get the name of the first read
+         * @return name of the first read, empty if no read in file
+         */
+        const std::string& firstName() const;
+
+        /** get the number of reads scanned
+         * @return number of reads scanned
+         */
+        size_t scannedReads() const;
+
+        /** test whether the whole file was scanned
+         * @return true if end of file reached before scan limits
+         */
+        bool reachedEOF() const;
+
+        /** get the file bytes consumed after the first read and after the last read scanned
+         * @param firstReadPos to store bytes consumed after the first read
+         * @param lastReadPos to store bytes consumed after the last read scanned
+         * @param bytesTotal to store the file size
+         */
+        void getBytes(size_t& firstReadPos, size_t& lastReadPos, size_t& bytesTotal) const;
+
+    public:
+        static const size_t SCAN_READ_LIMIT = 512 * 1024;       ///< max number of reads scanned
+        static const size_t SCAN_BASE_LIMIT = 151 * 512 * 1024; ///< max number of bases scanned
+        static const size_t KEEP_READ_LIMIT = 256 * 1024;       ///< max number of reads kept
+        static const size_t KEEP_BASE_LIMIT = 151 * 256 * 1024; ///< max number of bases kept
+        static const size_t KEEP_READ_MIN = 1000;               ///< min number of reads kept even if KEEP_BASE_LIMIT reached
+
+    private:
+        std::string mBases;            ///< sequences of kept reads back to back
+        std::vector<size_t> mOffsets;  ///< offset of each kept read in mBases, with one more entry for the end
+        std::string mFirstName;        ///< name of the first read
+        size_t mScannedReads;          ///< number of reads scanned
+        size_t mScannedBases;          ///< number of bases scanned
+        bool mReachedEOF;              ///< end of file reached before scan limits if true
+        size_t mFirstReadPos;          ///< file bytes consumed after the first read
+        size_t mLastReadPos;           ///< file bytes consumed after the last read scanned
+        size_t mBytesTotal;            ///< file size
+};
+
+#endif
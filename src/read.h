@@ -17,6 +17,8 @@ class Read{
         std::string strand; ///< read strand
         std::string quality;///< read quality sequence
         bool hasQuality;    ///< read has quality sequence if true
+        const char* raw = NULL; ///< the record in the input this read was parsed from, NULL if not kept, cleared by stages changing bases in place
+        size_t rawLen = 0;      ///< length of raw with line breaks
 
     public:
         /** default constructor of Read
@@ -174,6 +176,28 @@ class Read{
         inline std::string toStringWithTag(std::string tag){
             return name + " " + tag + "\n" + seq.seqStr + "\n" + strand + "\n" + quality + "\n";
         }
+
+        /** append a Read to an output buffer in fastq format, without building a temporary string
+         * @param out buffer to append to
+         */
+        inline void appendTo(std::string& out){
+            out.append(name).push_back('\n');
+            out.append(seq.seqStr).push_back('\n');
+            out.append(strand).push_back('\n');
+            out.append(quality).push_back('\n');
+        }
+
+        /** append a Read to an output buffer in fastq format with a tag after its name
+         * @param out buffer to append to
+         * @param tag additional string to append to the name
+         */
+        inline void appendToWithTag(std::string& out, const std::string& tag){
+            out.append(name).push_back(' ');
+            out.append(tag).push_back('\n');
+            out.append(seq.seqStr).push_back('\n');
+            out.append(strand).push_back('\n');
+            out.append(quality).push_back('\n');
+        }
         
         /** resize a Read to specified length
          * @param len length
@@ -195,6 +219,68 @@ class Read{
             seq.seqStr = seq.seqStr.substr(len, orilen - len);
             quality = quality.substr(len, orilen - len);
         }
+
+        /** exchange the contents of two Reads without copying strings
+         * @param r Read to exchange with
+         */
+        inline void swap(Read& r){
+            name.swap(r.name);
+            seq.seqStr.swap(r.seq.seqStr);
+            strand.swap(r.strand);
+            quality.swap(r.quality);
+            std::swap(hasQuality, r.hasQuality);
+            std::swap(raw, r.raw);
+            std::swap(rawLen, r.rawLen);
+        }
+
+        /** test whether the record kept in raw is still the fastq format of this Read\n
+         * trimming only shortens a Read, so a Read whose fields add up to rawLen has not been changed
+         * @return true if raw can be output in place of this Read
+         */
+        inline bool rawIntact(){
+            return raw && rawLen == name.length() + seq.seqStr.length() + strand.length() + quality.length() + 4;
+        }
+};
+
+/** class to append Reads to an output buffer, consecutive Reads not changed since parsed\n
+ * are copied from the input as one span, other Reads are serialized from their fields
+ */
+class RecordRun{
+    public:
+        /** construct a RecordRun
+         * @param out buffer to append to
+         */
+        RecordRun(std::string* out) : mOut(out), mStart(NULL), mLen(0){}
+
+        /** append a Read, the span of the input it continues is extended instead if possible
+         * @param r pointer to the Read
+         */
+        inline void append(Read* r){
+            if(!r->rawIntact()){
+                flush();
+                r->appendTo(*mOut);
+            }else if(mStart && mStart + mLen == r->raw){
+                mLen += r->rawLen;
+            }else{
+                flush();
+                mStart = r->raw;
+                mLen = r->rawLen;
+            }
+        }
+
+        /** copy the pending span to the buffer, should be called before the buffer is used */
+        inline void flush(){
+            if(mLen > 0){
+                mOut->append(mStart, mLen);
+            }
+            mStart = NULL;
+            mLen = 0;
+        }
+
+    private:
+        std::string* mOut;  ///< buffer to append to
+        const char* mStart; ///< start of the span of the input not copied yet, NULL if none
+        size_t mLen;        ///< length of the span not copied yet
 };
 
 /** class to represent a pair of read */
@@ -0,0 +1,119 @@
+#ifndef READ_PACK_H
+#define READ_PACK_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include "read.h"
+
+/** Struct to hold a bunch of reads\n
+ * all Read objects of a pack live in one contiguous arena allocated once,\n
+ * the arena(and the string buffers of each Read) is reused when the pack is recycled
+ */
+struct ReadPack{
+    Read* data;    ///< contiguous arena of Read objects
+    int count;     ///< number of Reads filled in data
+    int capacity;  ///< number of Read objects allocated in data
+    int range;     ///< index of the input range this pack parsed from
+    size_t seq;    ///< sequence number of this pack in its input range
+    size_t order;  ///< sequence number of this pack in the whole input, assigned when produced if output is ordered
+    std::atomic<int> pending; ///< number of tasks of this pack not processed yet, the pack is recycled when it drops to 0
+    size_t bytes;  ///< bytes of reads in fastq format, counted when parsed
+    bool replayed; ///< reads replayed from dedup temp files, already counted by pre-filtering stats and checked for duplicates
+    int dupFrom;   ///< index of the first read found duplicated when replayed, reads from it on are dropped
+
+    /** construct a ReadPack with an arena of capacity Reads
+     * @param cap number of Reads the pack can hold
+     */
+    ReadPack(int cap) : data(new Read[cap]), count(0), capacity(cap), range(0), seq(0), order(0), pending(0), bytes(0), replayed(false), dupFrom(0){}
+
+    /** destroy a ReadPack and release its arena in one step */
+    ~ReadPack(){
+        delete[] data;
+    }
+};
+
+/** Struct to hold a bunch of read pairs\n
+ * read1 and read2 of all pairs live in two contiguous arenas allocated once,\n
+ * pair i consists of left[i] and right[i]
+ */
+struct ReadPairPack{
+    Read* left;    ///< contiguous arena of read1
+    Read* right;   ///< contiguous arena of read2
+    int count;     ///< number of pairs filled in left/right
+    int capacity;  ///< number of pairs allocated in left/right
+    int range;     ///< index of the input range this pack parsed from
+    size_t seq;    ///< sequence number of this pack in its input range
+    size_t order;  ///< sequence number of this pack in the whole input, assigned when produced if output is ordered
+    std::atomic<int> pending; ///< number of tasks of this pack not processed yet, the pack is recycled when it drops to 0
+    size_t bytes;  ///< bytes of reads in fastq format, counted when parsed
+    bool replayed; ///< reads replayed from dedup temp files, already counted by pre-filtering stats and checked for duplicates
+    int dupFrom;   ///< index of the first read found duplicated when replayed, reads from it on are dropped
+
+    /** construct a ReadPairPack with arenas of capacity pairs
+     * @param cap number of pairs the pack can hold
+     */
+    ReadPairPack(int cap) : left(new Read[cap]), right(new Read[cap]), count(0), capacity(cap), range(0), seq(0), order(0), pending(0), bytes(0), replayed(false), dupFrom(0){}
+
+    /** destroy a ReadPairPack and release its arenas in one step */
+    ~ReadPairPack(){
+        delete[] left;
+        delete[] right;
+    }
+};
+
+/** Class to recycle packs between the producer and the consumers\n
+ * a released pack keeps its arena and the capacity of its strings,\n
+ * so a steady state run parses reads without touching the allocator
+ */
+template<typename T>
+class PackPool{
+    public:
+        /** construct a PackPool
+         * @param capacity number of reads each pack can hold
+         */
+        PackPool(int capacity) : mCapacity(capacity){}
+
+        /** destroy a PackPool and all packs recycled in it */
+        ~PackPool(){
+            for(auto& p: mFree){
+                delete p;
+            }
+        }
+
+        /** get an empty pack, reuse a recycled one if possible
+         * @return pointer to an empty pack
+         */
+        T* acquire(){
+            T* pack = NULL;
+            mMtx.lock();
+            if(!mFree.empty()){
+                pack = mFree.back();
+                mFree.pop_back();
+            }
+            mMtx.unlock();
+            if(!pack){
+                pack = new T(mCapacity);
+            }
+            pack->count = 0;
+            pack->replayed = false;
+            return pack;
+        }
+
+        /** give a pack back to the pool after it has been processed
+         * @param pack pointer to the pack
+         */
+        void release(T* pack){
+            std::lock_guard<std::mutex> lk(mMtx);
+            mFree.push_back(pack);
+        }
+
+    private:
+        int mCapacity;          ///< number of reads each pack can hold
+        std::vector<T*> mFree;  ///< packs ready to be reused
+        std::mutex mMtx;        ///< mutex to protect mFree
+};
+
+#endif
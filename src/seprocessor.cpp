@@ -2,7 +2,6 @@
 
 SingleEndProcessor::SingleEndProcessor(Options* opt){
     mOptions = opt;
-    mProduceFinished = false;
     mFinishedThreads = 0;
     mFilter = new Filter(mOptions);
     mOutStream = NULL;
@@ -14,6 +13,35 @@ SingleEndProcessor::SingleEndProcessor(Options* opt){
     if(mOptions->duplicate.enabled){
         mDuplicate = new Duplicate(mOptions);
     }
+    mDedup = NULL;
+    if(mOptions->dedup.enabled){
+        mDedup = new Deduplicator(mOptions);
+    }
+    mPackPool = new PackPool<ReadPack>(mOptions->bufSize.maxReadsInPack);
+    mBufferPool = new BufferPool();
+    mPackSizer = NULL;
+    if(mOptions->bufSize.autoPackSize){
+        mPackSizer = new PackSizer(mOptions->bufSize.maxReadsInPack, (size_t)mOptions->bufSize.packMBytes << 20);
+    }
+    mMemBudget = NULL;
+    if(mOptions->bufSize.maxMemoryMBytes > 0){
+        mMemBudget = new MemoryBudget((size_t)mOptions->bufSize.maxMemoryMBytes << 20);
+        if(mDuplicate){
+            mMemBudget->chargeTables(mDuplicate->getMemoryBytes());
+        }
+        if(mDedup){
+            mMemBudget->chargeTables(mDedup->getMemoryBytes());
+        }
+    }
+    mEvaluator = NULL;
+    mStaging = false;
+    mOrderRange = 0;
+    mProducedPacks = 0;
+    if(mOptions->est.inStream){
+        mEvaluator = new Evaluator(mOptions);
+        mEvaluator->initInStream();
+        mStaging = true;
+    }
 }
 
 SingleEndProcessor::~SingleEndProcessor(){
@@ -23,16 +51,34 @@ SingleEndProcessor::~SingleEndProcessor(){
         delete mDuplicate;
         mDuplicate = NULL;
     }
+    if(mDedup){
+        delete mDedup;
+        mDedup = NULL;
+    }
+    delete mPackPool;
+    delete mBufferPool;
+    if(mPackSizer){
+        delete mPackSizer;
+        mPackSizer = NULL;
+    }
+    if(mMemBudget){
+        delete mMemBudget;
+        mMemBudget = NULL;
+    }
+    if(mEvaluator){
+        delete mEvaluator;
+        mEvaluator = NULL;
+    }
 }
 
 void SingleEndProcessor::initOutput(){
     if(!mOptions->failedOut.empty()){
-        mFailedWriter = new WriterThread(mOptions, mOptions->failedOut);
+        mFailedWriter = new WriterThread(mOptions, mOptions->failedOut, mBufferPool);
     }
     if(mOptions->out1.empty()){
         return;
     }
-    mLeftWriter = new WriterThread(mOptions, mOptions->out1);
+    mLeftWriter = new WriterThread(mOptions, mOptions->out1, mBufferPool);
 }
 
 void SingleEndProcessor::closeOutput(){
@@ -57,96 +103,232 @@ void SingleEndProcessor::initConfig(ThreadConfig* config){
 }
 
 void SingleEndProcessor::initReadPackRepository(){
-    mRepo.packBuffer = new ReadPack*[mOptions->bufSize.maxPacksInReadPackRepo];
-    std::memset(mRepo.packBuffer, 0, sizeof(ReadPack*) * mOptions->bufSize.maxPacksInReadPackRepo);
-    mRepo.writePos = 0;
-    mRepo.readPos = 0;
+    // producers wait when consumers fall behind, so at most maxPacksInMemory parsed packs wait for processing
+    // if output is ordered packs are taken in input order and not split, each pack should reach the writers as a whole
+    mRepo.scheduler = new PackScheduler<ReadPack>(mOptions->thread, std::min(mOptions->bufSize.maxPacksInReadPackRepo, mOptions->bufSize.maxPacksInMemory + 1), PackScheduler<ReadPack>::DEFAULT_MIN_BATCH, mOptions->orderedOutput);
 }
 
 void SingleEndProcessor::destroyReadPackRepository(){
-    delete mRepo.packBuffer;
-    mRepo.packBuffer = NULL;
+    if(mMemBudget){
+        util::loginfo("peak memory in flight(MB): " + std::to_string(mMemBudget->peak() >> 20) + " of " + std::to_string(mOptions->bufSize.maxMemoryMBytes), mOptions->logmtx);
+    }
+    util::loginfo("packs stolen: " + std::to_string(mRepo.scheduler->steals()) + ", split: " + std::to_string(mRepo.scheduler->splits()), mOptions->logmtx);
+    delete mRepo.scheduler;
+    mRepo.scheduler = NULL;
 }
 
 void SingleEndProcessor::producePack(ReadPack* pack){
-    while(mRepo.writePos ==  mOptions->bufSize.maxPacksInReadPackRepo){
-        usleep(1);
+    if(mOptions->orderedOutput){
+        // ranges produce one after another, so packs enter the queue in input order
+        std::unique_lock<std::mutex> lk(mOrderMtx);
+        mOrderCV.wait(lk, [this, pack]{return pack->range == mOrderRange;});
+        pack->order = mProducedPacks++;
+    }
+    // charged only when it enters the queue, a pack waiting for its range to come holds no budget other readers wait on
+    if(mMemBudget){
+        mMemBudget->charge(pack->bytes);
+    }
+    mRepo.scheduler->push(pack);
+    util::loginfo("producer produced pack(range " + std::to_string(pack->range) + " pack " + std::to_string(pack->seq) + ")", mOptions->logmtx);
+}
+
+void SingleEndProcessor::stagePack(ReadPack* pack){
+    if(!mStaging){
+        producePack(pack);
+        return;
+    }
+    mStagedPacks.push_back(pack);
+    if(mEvaluator->addInStream(pack)){
+        releaseStagedPacks();
+    }
+}
+
+void SingleEndProcessor::releaseStagedPacks(){
+    {
+        std::lock_guard<std::mutex> lk(mStageMtx);
+        mStaging = false;
+    }
+    mStageCV.notify_all();
+    util::loginfo("staged packs released: " + std::to_string(mStagedPacks.size()), mOptions->logmtx);
+    for(auto& p: mStagedPacks){
+        producePack(p);
+    }
+    mStagedPacks.clear();
+}
+
+double SingleEndProcessor::writerBacklog(){
+    double backlog = 0.0;
+    for(WriterThread* w: {mLeftWriter, mFailedWriter}){
+        if(w){
+            backlog = std::max(backlog, (double)w->bufferLength() / w->bufferCapacity());
+        }
+    }
+    return backlog;
+}
+
+void SingleEndProcessor::finishRange(int range){
+    if(!mOptions->orderedOutput){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mOrderMtx);
+        mOrderRange = range + 1;
     }
-    mRepo.packBuffer[mRepo.writePos] = pack;
-    util::loginfo("producer produced pack " + std::to_string(mRepo.writePos), mOptions->logmtx);
-    ++mRepo.writePos;
+    mOrderCV.notify_all();
 }
 
 void SingleEndProcessor::producerTask(){
     util::loginfo("loading data started", mOptions->logmtx);
-    size_t readNum = 0;
-    Read** data = new Read*[mOptions->bufSize.maxReadsInPack];
-    std::memset(data, 0, sizeof(Read*) * mOptions->bufSize.maxReadsInPack);
-    FqReader reader(mOptions->in1, true, mOptions->phred64);
-    size_t count = 0;
-    while(true){
-        Read* read = reader.read();
-        ++readNum;
-        if(!read){
-            if(count == 0){
-                break;
-            }
-            ReadPack* pack = new ReadPack;
-            pack->data = data;
-            pack->count = count;
-            producePack(pack);
-            data = NULL;
-            if(read){
-                delete read;
-                read = NULL;
-            }
-            mProduceFinished = true;
-            break;
+    std::vector<FqReader*> readers;
+    // ordinary gzip input with a sidecar index can be inflated by several producers, each from a checkpoint
+    GzIndex* index = NULL;
+    if(mOptions->parseThread > 1 && util::endsWith(mOptions->in1, ".gz") && !BgzfReader::isBgzf(mOptions->in1)){
+        index = GzIndex::load(mOptions->in1);
+    }
+    if(index){
+        std::vector<size_t> bounds = index->splitRecords(mOptions->parseThread);
+        for(size_t i = 0; i + 1 < bounds.size(); ++i){
+            readers.push_back(new FqReader(mOptions->in1, index, bounds[i], bounds[i + 1], true, mOptions->phred64));
         }
-        data[count] = read;
-        ++count;
-        if(count == mOptions->bufSize.maxReadsInPack){
-            ReadPack* pack = new ReadPack;
-            pack->data = data;
-            pack->count = count;
-            producePack(pack);
-            data = new Read*[mOptions->bufSize.maxReadsInPack];
-            std::memset(data, 0, sizeof(Read*) * mOptions->bufSize.maxReadsInPack);
-            while(mRepo.writePos - mRepo.readPos > mOptions->bufSize.maxPacksInMemory){
-                usleep(100);
-            }
-            readNum += count;
-            if(readNum % (mOptions->bufSize.maxReadsInPack * mOptions->bufSize.maxPacksInMemory) == 0 && mLeftWriter){
-                while(mLeftWriter->bufferLength() > mOptions->bufSize.maxPacksInMemory){
-                    usleep(100);
-                }
+        util::loginfo("indexed input split into " + std::to_string(readers.size()) + " ranges", mOptions->logmtx);
+    }else{
+        readers.push_back(new FqReader(mOptions->in1, true, mOptions->phred64, mOptions->inflateThread));
+        // uncompressed input mapped into memory can be parsed by several producers, each on a byte range
+        std::vector<size_t> bounds;
+        if(mOptions->parseThread > 1 && readers[0]->isMapped()){
+            bounds = readers[0]->splitRanges(mOptions->parseThread);
+        }
+        for(size_t i = 0; i + 2 < bounds.size(); ++i){
+            readers.push_back(new FqReader(mOptions->in1, true, mOptions->phred64, mOptions->inflateThread));
+        }
+        if(readers.size() > 1){
+            for(size_t i = 0; i < readers.size(); ++i){
+                readers[i]->setRange(bounds[i], bounds[i + 1]);
             }
-            count = 0;
+            util::loginfo("input split into " + std::to_string(readers.size()) + " ranges", mOptions->logmtx);
         }
     }
-    mProduceFinished = true;
-    util::loginfo("loaded reads: " + std::to_string(readNum - 1), mOptions->logmtx);
+    // reads of mapped input are output straight from the mapping if unchanged
+    for(auto& r: readers){
+        r->setKeepRaw(true);
+    }
+    std::vector<size_t> readNums(readers.size(), 0);
+    std::vector<std::thread> parsers;
+    for(size_t i = 1; i < readers.size(); ++i){
+        parsers.emplace_back(&SingleEndProcessor::parseTask, this, readers[i], i, &readNums[i]);
+    }
+    parseTask(readers[0], 0, &readNums[0]);
+    for(auto& t: parsers){
+        t.join();
+    }
+    // reads may point into the readers until processed, so they are deleted after the working threads finish
+    mReaders = readers;
+    if(index){
+        delete index;
+    }
+    if(mDedup){
+        replaySpilled(readers.size());
+    }
+    mRepo.scheduler->close();
+    util::loginfo("loaded reads: " + std::to_string(std::accumulate(readNums.begin(), readNums.end(), (size_t)0)), mOptions->logmtx);
 }
 
-void SingleEndProcessor::consumerTask(ThreadConfig* config){
+void SingleEndProcessor::parseTask(FqReader* reader, int range, size_t* readNum){
+    size_t seq = 0;
+    ReadPack* pack = mPackPool->acquire();
     while(true){
-        if(config->canBeStopped()){
-            ++mFinishedThreads;
+        // parse a whole pack straight into the pack arena
+        // packs held back for estimation are only released by parsing more, so they are not throttled
+        if(mMemBudget && !(range == 0 && mStaging)){
+            mMemBudget->wait();
+        }
+        int limit = mPackSizer ? mPackSizer->next() : pack->capacity;
+        *readNum += reader->readBatch(pack, limit);
+        pack->range = range;
+        pack->seq = seq;
+        // the size also sets how much output buffer workers reserve for the pack
+        pack->bytes = PackSizer::bytesOf(pack->data, pack->count);
+        if(mPackSizer){
+            mPackSizer->parsed(pack->count, pack->bytes);
+        }
+        if(pack->count < limit){
+            if(pack->count == 0){
+                mPackPool->release(pack);
+            }else if(range == 0){
+                stagePack(pack);
+            }else{
+                producePack(pack);
+            }
+            pack = NULL;
             break;
         }
-        while(mRepo.writePos <= mRepo.readPos){
-            if(mProduceFinished){
-                break;
+        if(range == 0){
+            stagePack(pack);
+        }else{
+            producePack(pack);
+        }
+        ++seq;
+        pack = mPackPool->acquire();
+    }
+    // input shorter than the sample
+    if(range == 0 && mStaging){
+        releaseStagedPacks();
+    }
+    finishRange(range);
+    util::loginfo("loaded reads of range " + std::to_string(range) + ": " + std::to_string(*readNum), mOptions->logmtx);
+}
+
+void SingleEndProcessor::replaySpilled(int firstRange){
+    // every read spilled is on disk once all packs produced so far are processed
+    mRepo.scheduler->drain();
+    if(!mDedup->hasSpilled()){
+        return;
+    }
+    util::loginfo("replaying " + std::to_string(mDedup->getSpilled()) + " reads spilled by dedup", mOptions->logmtx);
+    std::atomic<int> next(0);
+    std::vector<std::thread> resolvers;
+    for(int t = 0; t < mOptions->thread; ++t){
+        resolvers.emplace_back(&SingleEndProcessor::replayTask, this, firstRange, &next);
+    }
+    for(auto& t: resolvers){
+        t.join();
+    }
+}
+
+void SingleEndProcessor::replayTask(int firstRange, std::atomic<int>* next){
+    int partition = 0;
+    while((partition = (*next)++) < Deduplicator::PARTITIONS){
+        std::vector<Read> reads;
+        std::vector<Read> unused;
+        size_t uniques = mDedup->resolve(partition, reads, unused);
+        size_t seq = 0;
+        for(size_t start = 0; start < reads.size(); start += mOptions->bufSize.maxReadsInPack){
+            if(mMemBudget){
+                mMemBudget->wait();
+            }
+            ReadPack* pack = mPackPool->acquire();
+            pack->count = std::min(reads.size() - start, mOptions->bufSize.maxReadsInPack);
+            for(int i = 0; i < pack->count; ++i){
+                pack->data[i].swap(reads[start + i]);
             }
-            usleep(1);
+            pack->replayed = true;
+            pack->dupFrom = std::min(std::max(uniques, start) - start, (size_t)pack->count);
+            pack->range = firstRange + partition;
+            pack->seq = seq++;
+            pack->bytes = PackSizer::bytesOf(pack->data, pack->count);
+            producePack(pack);
         }
-        if(mProduceFinished && mRepo.writePos == mRepo.readPos){
-            ++mFinishedThreads;
-            break;
+        finishRange(firstRange + partition);
+        if(!reads.empty()){
+            util::loginfo("dedup partition " + std::to_string(partition) + " replayed, unique reads: " + std::to_string(uniques) + ", duplicated: " + std::to_string(reads.size() - uniques), mOptions->logmtx);
         }
-        consumePack(config);
     }
-    if(mFinishedThreads == mOptions->thread){
+}
+
+void SingleEndProcessor::consumerTask(ThreadConfig* config){
+    while(!config->canBeStopped() && consumePack(config)){
+    }
+    if(++mFinishedThreads == mOptions->thread){
         if(mLeftWriter){
             mLeftWriter->setInputCompleted();
         }
@@ -157,36 +339,53 @@ void SingleEndProcessor::consumerTask(ThreadConfig* config){
     util::loginfo("thread " + std::to_string(config->getThreadId()) + " finished", mOptions->logmtx);
 }
 
-void SingleEndProcessor::consumePack(ThreadConfig* config){
-    mInputMtx.lock();
-    while(mRepo.writePos <= mRepo.readPos){
-        usleep(1);
-        if(mProduceFinished){
-            mInputMtx.unlock();
-            return;
-        }
-    }
-    size_t packNum = mRepo.readPos;
-    ReadPack* data = mRepo.packBuffer[packNum];
-    ++mRepo.readPos;
-    if(mRepo.readPos == mOptions->bufSize.maxPacksInReadPackRepo){
-        mRepo.readPos = mRepo.readPos % mOptions->bufSize.maxPacksInReadPackRepo;
-        mRepo.writePos = mRepo.writePos % mOptions->bufSize.maxPacksInReadPackRepo;
-    }
-    mInputMtx.unlock();
-    util::loginfo("thread " + std::to_string(config->getThreadId()) + " start processing pack " + std::to_string(packNum), mOptions->logmtx);
-    processSingleEnd(data, config);
-    util::loginfo("thread " + std::to_string(config->getThreadId()) + " finish processing pack " + std::to_string(packNum), mOptions->logmtx);
+bool SingleEndProcessor::consumePack(ThreadConfig* config){
+    PackTask<ReadPack> task;
+    if(!mRepo.scheduler->pop(config->getThreadId(), task)){
+        return false;
+    }
+    std::string packName = std::to_string(task.pack->range) + ":" + std::to_string(task.pack->seq);
+    if(task.begin > 0 || task.end < task.pack->count){
+        packName += "[" + std::to_string(task.begin) + "," + std::to_string(task.end) + ")";
+    }
+    util::loginfo("thread " + std::to_string(config->getThreadId()) + " start processing pack " + packName, mOptions->logmtx);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    processSingleEnd(task, config);
+    mRepo.scheduler->finish();
+    if(mMemBudget){
+        mMemBudget->chargeTables(config->getStatsGrowth());
+    }
+    if(mPackSizer){
+        std::chrono::duration<double> used = std::chrono::steady_clock::now() - start;
+        mPackSizer->processed(task.end - task.begin, used.count(), writerBacklog());
+    }
+    util::loginfo("thread " + std::to_string(config->getThreadId()) + " finish processing pack " + packName, mOptions->logmtx);
+    return true;
 }
 
 bool SingleEndProcessor::process(){
     if(!mOptions->split.enabled){
         initOutput();
     }
+    if(mMemBudget){
+        for(WriterThread* w: {mLeftWriter, mFailedWriter}){
+            if(w){
+                w->setMemoryBudget(mMemBudget);
+            }
+        }
+    }
     initReadPackRepository();
     util::loginfo("read pack repo initialized", mOptions->logmtx);
     std::thread producer(std::bind(&SingleEndProcessor::producerTask, this));
     util::loginfo("producer thread started", mOptions->logmtx);
+    // read length and adapters estimated on the first packs are needed by ThreadConfig
+    if(mEvaluator){
+        std::unique_lock<std::mutex> lk(mStageMtx);
+        mStageCV.wait(lk, [this]{return !mStaging;});
+        lk.unlock();
+        mEvaluator->evaluateInStream();
+        util::loginfo("estimated in stream, read length: " + std::to_string(mOptions->est.seqLen1), mOptions->logmtx);
+    }
     ThreadConfig** configs = new ThreadConfig*[mOptions->thread];
     for(int t = 0; t < mOptions->thread; ++t){
         configs[t] = new ThreadConfig(mOptions, t, false);
@@ -213,6 +412,10 @@ bool SingleEndProcessor::process(){
         threads[t]->join();
     }
     util::loginfo("working threads finished", mOptions->logmtx);
+    for(auto& r: mReaders){
+        delete r;
+    }
+    mReaders.clear();
     if(!mOptions->split.enabled){
         if(leftWriterThread){
             leftWriterThread->join();
@@ -239,19 +442,20 @@ bool SingleEndProcessor::process(){
     size_t* dupHist = NULL;
     double* dupMeanGC = NULL;
     double dupRate = 0.0;
+    double dupRateError = 0.0;
     // output duplicate results
     if(mOptions->duplicate.enabled){
         dupHist = new size_t[mOptions->duplicate.histSize];
-        std::memset(dupHist, 0, sizeof(int) * mOptions->duplicate.histSize);
+        std::memset(dupHist, 0, sizeof(size_t) * mOptions->duplicate.histSize);
         dupMeanGC = new double[mOptions->duplicate.histSize];
         std::memset(dupMeanGC, 0, sizeof(double) * mOptions->duplicate.histSize);
-        dupRate = mDuplicate->statAll(dupHist, dupMeanGC, mOptions->duplicate.histSize);
+        dupRate = mDuplicate->statAll(dupHist, dupMeanGC, mOptions->duplicate.histSize, dupRateError);
     }
     JsonReporter jr(mOptions);
-    jr.setDupHist(dupHist, dupMeanGC, dupRate);
+    jr.setDupHist(dupHist, dupMeanGC, dupRate, dupRateError);
     jr.report(finalFilterResult, finalPreStats, finalPostStats);
     HtmlReporter hr(mOptions);
-    hr.setDupHist(dupHist, dupMeanGC, dupRate);
+    hr.setDupHist(dupHist, dupMeanGC, dupRate, dupRateError);
     hr.report(finalFilterResult, finalPreStats, finalPostStats);
     util::loginfo("finish generating reports", mOptions->logmtx);
     // clean up
@@ -283,26 +487,72 @@ bool SingleEndProcessor::process(){
     if(!mOptions->split.enabled){
         closeOutput();
     }
+    destroyReadPackRepository();
 
     return true;
 }
 
-void SingleEndProcessor::processSingleEnd(ReadPack* pack, ThreadConfig *config){
-    std::string outstr;
-    std::string failedOut;
+void SingleEndProcessor::processSingleEnd(PackTask<ReadPack>& task, ThreadConfig *config){
+    ReadPack* pack = task.pack;
+    // serialize reads straight into pooled buffers handed to the writers, sized by the share of the pack bytes this task holds
+    size_t expected = pack->count > 0 ? pack->bytes / pack->count * (task.end - task.begin) : 0;
+    std::string* outstr = mBufferPool->acquire(expected);
+    std::string* failedOut = mBufferPool->acquire();
+    // runs of reads passing unchanged are copied from the input at once
+    RecordRun passed(outstr);
+    std::vector<std::string> spilled(mDedup ? Deduplicator::PARTITIONS : 0);
+    // with ordered output reads are checked in input order, so the same copies are kept in every run
+    std::vector<int> verdicts;
+    if(mDedup && mOptions->orderedOutput && !pack->replayed){
+        mDedup->checkInOrder(pack->order, pack->data, NULL, task.begin, task.end, verdicts, spilled);
+    }
     int readPassed = 0;
-    for(int p = 0; p < pack->count; ++p){
+    // deferred reads are counted when they are replayed
+    int readDeferred = 0;
+    for(int p = task.begin; p < task.end; ++p){
+        // hand half of the reads left to idle threads at the tail of input
+        mRepo.scheduler->share(config->getThreadId(), task, p);
         // original read1
-        Read* or1 = pack->data[p];
-        // stats the original read before trimming 
-        config->getPreStats1()->statRead(or1);
-        // handling the duplication profiling
-        if(mOptions->duplicate.enabled){
-            mDuplicate->statRead(or1);
+        Read* or1 = &pack->data[p];
+        // replayed reads have been counted when they were spilled
+        if(!pack->replayed){
+            // stats the original read before trimming 
+            config->getPreStats1()->statRead(or1);
+            // handling the duplication profiling
+            if(mOptions->duplicate.enabled){
+                mDuplicate->statRead(or1);
+            }
+        }
+        // drop duplicated reads, reads not decided yet are replayed at the end
+        if(mDedup){
+            int dup = Deduplicator::UNIQUE;
+            if(!pack->replayed){
+                if(verdicts.empty()){
+                    ReadFingerprint fp = Deduplicator::fingerprint(or1, NULL);
+                    dup = mDedup->check(fp);
+                    if(dup == Deduplicator::DEFERRED){
+                        mDedup->spill(fp, or1, NULL, spilled);
+                    }
+                }else{
+                    dup = verdicts[p - task.begin];
+                }
+                if(dup == Deduplicator::DEFERRED){
+                    ++readDeferred;
+                    continue;
+                }
+            }else if(p >= pack->dupFrom){
+                dup = Deduplicator::DUPLICATE;
+            }
+            if(dup == Deduplicator::DUPLICATE){
+                config->addFilterResult(COMMONCONST::FAIL_DUPLICATE);
+                if(mFailedWriter){
+                    or1->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[COMMONCONST::FAIL_DUPLICATE]);
+                }
+                continue;
+            }
         }
         // filter by index
         if(mOptions->indexFilter.enabled && mFilter->filterByIndex(or1)){
-            delete or1;
             continue;
         }
         // umi processing
@@ -340,60 +590,73 @@ void SingleEndProcessor::processSingleEnd(ReadPack* pack, ThreadConfig *config){
         config->addFilterResult(result);
         // stats the read after filtering
         if(r1 != NULL && result == COMMONCONST::PASS_FILTER){
-            outstr += r1->toString();
+            passed.append(r1);
             config->getPostStats1()->statRead(r1);
             ++readPassed;
         }else if(mFailedWriter){
-            failedOut += or1->toStringWithTag(COMMONCONST::FAILED_TYPES[result]);
+            or1->appendToWithTag(*failedOut, COMMONCONST::FAILED_TYPES[result]);
         }
-        // cleanup memory
-        delete or1;
+        // cleanup memory, or1 is owned by the pack arena
         if(r1 != or1 && r1 != NULL){
             delete  r1;
         }
     }
+    passed.flush();
+    if(mDedup){
+        mDedup->flush(spilled);
+    }
+    // deflate gzip output before taking mOutputMtx, so workers compress their packs in parallel
+    if(mLeftWriter){
+        mLeftWriter->compress(outstr);
+    }
+    if(mFailedWriter){
+        mFailedWriter->compress(failedOut);
+    }
     // if splitting output, then no lock is need since different threads write different files
-    if(!mOptions->split.enabled){
+    // if output is ordered, WriterThread puts results in order itself
+    bool needLock = !mOptions->split.enabled && !mOptions->orderedOutput;
+    if(needLock){
         mOutputMtx.lock();
     }
     if(mOptions->outputToSTDOUT){
-        std::fwrite(outstr.c_str(), 1, outstr.length(), stdout);
+        std::fwrite(outstr->c_str(), 1, outstr->length(), stdout);
     }else if(mOptions->split.enabled){
         // split output by each worker thread
         if(!mOptions->out1.empty()){
-            config->getWriter1()->writeString(outstr);
+            config->getWriter1()->writeString(*outstr);
         }
     }else{
         if(mLeftWriter){
-            char* ldata = new char[outstr.size()];
-            std::memcpy(ldata, outstr.c_str(), outstr.size());
-            mLeftWriter->input(ldata, outstr.size());
+            mLeftWriter->input(pack->order, outstr);
+            outstr = NULL;
         }
     }
-    if(mFailedWriter && !failedOut.empty()){
-        char* fdata = new char[failedOut.size()];
-        std::memcpy(fdata, failedOut.c_str(), failedOut.size());
-        mFailedWriter->input(fdata, failedOut.size());
+    // every pack is input to each writer if output is ordered, so the reorder window never waits for a missing pack
+    if(mFailedWriter && (mOptions->orderedOutput || !failedOut->empty())){
+        mFailedWriter->input(pack->order, failedOut);
+        failedOut = NULL;
     }
-    if(!mOptions->split.enabled){
+    if(needLock){
         mOutputMtx.unlock();
     }
+    // buffers not handed to a writer go back to the pool
+    mBufferPool->release(outstr);
+    mBufferPool->release(failedOut);
     if(mOptions->split.byFileLines){
         config->markProcessed(readPassed);
     }else{
-        config->markProcessed(pack->count);
+        config->markProcessed(task.end - task.begin - readDeferred);
+    }
+    // hand the whole arena back for reuse in one step after its last batch
+    if(--pack->pending == 0){
+        if(mMemBudget){
+            mMemBudget->release(pack->bytes);
+        }
+        mPackPool->release(pack);
     }
-    delete[] pack->data;
-    delete pack;
 }
 
 void SingleEndProcessor::writeTask(WriterThread* config){
-    while(true){
-        if(config->isCompleted()){
-            config->output();
-            break;
-        }
-        config->output();
-    }
+    config->output();
     util::loginfo(config->getFilename() + " writer finished", mOptions->logmtx);
 }
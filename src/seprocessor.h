@@ -6,6 +6,9 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
 #include <unistd.h>
 #include "util.h"
 #include "read.h"
@@ -13,7 +16,14 @@
 #include "stats.h"
 #include "filter.h"
 #include "fqreader.h"
+#include "readpack.h"
+#include "packscheduler.h"
+#include "packsizer.h"
+#include "memorybudget.h"
+#include "bufferpool.h"
 #include "duplicate.h"
+#include "deduplicator.h"
+#include "evaluator.h"
 #include "jsonreporter.h"
 #include "umiprocessor.h"
 #include "filterresult.h"
@@ -23,17 +33,9 @@
 #include "adaptertrimmer.h"
 
 
-/** Struct to hold a bunch of redas pointers */
-struct ReadPack{
-    Read** data;   ///< array to store Read pointers
-    int count;     ///< number of Read pointers in data
-};
-
 /** Struct to hold a bunch of ReadPack pointers */
 struct ReadPackRepository{
-    ReadPack** packBuffer;        ///< array to store ReadPack pointers
-    std::atomic<size_t> readPos;    ///< the index in packBuffer next ReadPack pointer should read from
-    std::atomic<size_t> writePos;   ///< the index in packBuffer next ReadPack pointer should put into
+    PackScheduler<ReadPack>* scheduler; ///< work stealing scheduler to pass ReadPacks from producers to consumers
 };
 
 /** class to deal with single end fastq processing */
@@ -52,41 +54,80 @@ class SingleEndProcessor{
          */ 
         bool process();
         
-        /** process a pack of single end reads in one thread
-         * @param pack pointer to a ReadPack object 
+        /** process a batch of single end reads in one thread, recycle the pack after all its batches processed\n
+         * the end of task is moved back if the second half of the reads left is shared with idle threads at the tail of input
+         * @param task batch of reads of a ReadPack
          * @param config a pointer to a ThreadConfig object 
          */
-        void processSingleEnd(ReadPack* pack, ThreadConfig* config);
+        void processSingleEnd(PackTask<ReadPack>& task, ThreadConfig* config);
         
         /** initialize a ReadPackRepository object\n
-         * make room for mRepo.packBuffer to store at most mOptions->bufSize.maxPacksInReadPackRepo packs in memory\n
-         * and initialize mRepo.writePos = mRepo.readPos = 0;
+         * create mRepo.scheduler with a deque for each worker, which queues at most min(mOptions->bufSize.maxPacksInReadPackRepo, mOptions->bufSize.maxPacksInMemory + 1) packs
          */
         void initReadPackRepository();
 
         /** destroy a ReadPackRepository and free allocated memory */
         void destroyReadPackRepository();
        
-        /** add a fresh generated ReadPack pointer to ReadPackRepository
+        /** add a fresh generated ReadPack pointer to ReadPackRepository, wait while it is full\n
+         * if output is ordered, also wait until all earlier ranges finished and tag the pack with its order
          * @param pack pointer to a ReadPack object
          */
         void producePack(ReadPack* pack);
+
+        /** hold a ReadPack of the first range back until estimations on the first packs are done\n
+         * the pack is passed to producePack directly if estimating in stream is disabled or done
+         * @param pack pointer to a ReadPack object
+         */
+        void stagePack(ReadPack* pack);
+
+        /** finish staging, wake up the estimating thread and pass all packs held back to producePack in order */
+        void releaseStagedPacks();
+
+        /** get the fill ratio of the fullest WriterThread queue
+         * @return fill ratio in [0, 1], 0 if output is not written by WriterThreads
+         */
+        double writerBacklog();
+
+        /** mark all packs of a range produced, hand producing over to the next range if output is ordered
+         * @param range index of the range finished
+         */
+        void finishRange(int range);
        
         /** instruct a thread to consume a ReadPack\n
-         * the thread will find the next proper mRepo.readPos\n
-         * and extract ReacPack at mRepo.packBuffer[mRepo.readPos] to process\n
+         * the thread takes the next batch from its deque in mRepo.scheduler or steals one from other threads and process it\n
          * @param config pointer to ThreadConfig
+         * @return false if all packs have been consumed
          */
-        void consumePack(ThreadConfig* config);
+        bool consumePack(ThreadConfig* config);
         
         /** a task(running asynchronously) to read fastq\n
+         * uncompressed input is split into at most mOptions->parseThread ranges parsed by parseTask concurrently\n
          * fill a ReadPack and store the ReadPack into ReadPackRepository\n
-         * continously till eof reached, but will pause at sometimes:\n
-         * 1)mRepo.writePos - mRepo.readPos > mOptions->bufSize.maxPacksInMemory)
-         * 2)readNum % (mOptions->bufSize.maxReadsInPack * mOptions->bufSize.maxPacksInMemory) == 0 && mLeftWriter)\n
-         * && mLeftWriter->bufferLength() > mOptions->bufSize.maxPacksInMemory
+         * continously till eof reached, but will pause while ReadPackRepository is full\n
+         * which happens when consumers are busy or wait for a full WriterThread queue
          */ 
         void producerTask();
+
+        /** a task to parse all reads of a FqReader into ReadPacks and store them into ReadPackRepository
+         * @param reader pointer to FqReader, maybe restricted to a range of the input
+         * @param range index of the range parsed by reader
+         * @param readNum pointer to store the number of reads parsed
+         */
+        void parseTask(FqReader* reader, int range, size_t* readNum);
+
+        /** replay reads spilled by mDedup after all packs produced so far are processed\n
+         * partitions are resolved by mOptions->thread threads running replayTask, partition i is produced as range firstRange + i
+         * @param firstRange index of the range of the first partition
+         */
+        void replaySpilled(int firstRange);
+
+        /** a task to resolve dedup partitions one after another and produce their reads as replayed ReadPacks\n
+         * unique reads come first in each partition and the duplicates after them
+         * @param firstRange index of the range of the first partition
+         * @param next pointer to the index of the next partition to resolve, shared by all replayTasks
+         */
+        void replayTask(int firstRange, std::atomic<int>* next);
         
         /** a task(running asynchronously by each writing thread) to process some packs of Reads
          * @param config pointer to ThreadConfig pointer
@@ -116,9 +157,12 @@ class SingleEndProcessor{
         
         Options* mOptions;                   ///< pointer to Options
         ReadPackRepository mRepo;            ///< ReadPackRepository to store ReadPacks
-        std::atomic<bool> mProduceFinished;  ///< if true the thread produce packs have finished work
+        PackPool<ReadPack>* mPackPool;       ///< pool to recycle ReadPacks after processing
+        PackSizer* mPackSizer;               ///< pointer to PackSizer to adapt the number of reads in a pack, NULL if fixed
+        MemoryBudget* mMemBudget;            ///< pointer to MemoryBudget to throttle parsing, NULL if memory not limited
+        BufferPool* mBufferPool;             ///< pool to recycle output buffers after written
+        std::vector<FqReader*> mReaders;     ///< readers of the input, kept until all packs processed since reads may point into them
         std::atomic<int> mFinishedThreads;   ///< number of threads who have finished their work
-        std::mutex mInputMtx;                ///< mutex used to lock ReadPack extraction from ReadPackRepository by ThreadConfig
         std::mutex mOutputMtx;               ///< mutex used to lock WriterThread input when put one pack results into WriterThread 
         Filter* mFilter;                     ///< pointer to Filter to do various filter to each reads processed  
         gzFile mZipFile;                     ///< gzFile pointer used as output
@@ -127,6 +171,16 @@ class SingleEndProcessor{
         WriterThread* mLeftWriter;           ///< pointer to WriterThread to perform writing if split output is disabled
         WriterThread* mFailedWriter;         ///< pointer to WriterThread to perform writing filter failed read
         Duplicate* mDuplicate;               ///< pointer to Duplicate to do duplicate analysis
+        Deduplicator* mDedup;                ///< pointer to Deduplicator to drop duplicated reads, NULL if dedup disabled
+        Evaluator* mEvaluator;               ///< pointer to Evaluator to estimate on the first packs if estimating in stream
+        std::vector<ReadPack*> mStagedPacks; ///< packs held back until estimations on them are done
+        bool mStaging;                       ///< packs of the first range are held back if true
+        std::mutex mStageMtx;                ///< mutex used to protect mStaging
+        std::condition_variable mStageCV;    ///< condition variable to notify staging finished
+        int mOrderRange;                     ///< index of the range allowed to produce packs if output is ordered
+        size_t mProducedPacks;               ///< number of packs produced, used as order of the next pack
+        std::mutex mOrderMtx;                ///< mutex used to protect mOrderRange and mProducedPacks
+        std::condition_variable mOrderCV;    ///< condition variable to notify mOrderRange advanced
 };
 
 #endif
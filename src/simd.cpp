@@ -0,0 +1,212 @@
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+namespace simd{
+    /** collect line breaks byte by byte, used for the tail of a buffer and on cpus without vector support */
+    static size_t indexLineBreaksScalar(const char* buf, size_t len, size_t* pos, size_t maxPos, size_t from){
+        size_t found = 0;
+        for(size_t i = from; i < len && found < maxPos; ++i){
+            if(buf[i] == '\n' || buf[i] == '\r'){
+                pos[found++] = i;
+            }
+        }
+        return found;
+    }
+
+#ifdef SIMD_X86
+    /** turn a mask of matched bytes at offset base into positions
+     * @return number of positions stored
+     */
+    static inline size_t emitMask(uint32_t mask, size_t base, size_t* pos, size_t found, size_t maxPos){
+        while(mask && found < maxPos){
+            pos[found++] = base + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+        return found;
+    }
+
+    __attribute__((target("sse2")))
+    static size_t indexLineBreaksSSE2(const char* buf, size_t len, size_t* pos, size_t maxPos){
+        const __m128i lf = _mm_set1_epi8('\n');
+        const __m128i cr = _mm_set1_epi8('\r');
+        size_t found = 0;
+        size_t i = 0;
+        for(; i + 16 <= len && found < maxPos; i += 16){
+            __m128i v = _mm_loadu_si128((const __m128i*)(buf + i));
+            uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+            found = emitMask(mask, i, pos, found, maxPos);
+        }
+        if(found < maxPos){
+            found += indexLineBreaksScalar(buf, len, pos + found, maxPos - found, i);
+        }
+        return found;
+    }
+
+    __attribute__((target("avx2")))
+    static size_t indexLineBreaksAVX2(const char* buf, size_t len, size_t* pos, size_t maxPos){
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const __m256i cr = _mm256_set1_epi8('\r');
+        size_t found = 0;
+        size_t i = 0;
+        for(; i + 32 <= len && found < maxPos; i += 32){
+            __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+            uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+            found = emitMask(mask, i, pos, found, maxPos);
+        }
+        if(found < maxPos){
+            found += indexLineBreaksScalar(buf, len, pos + found, maxPos - found, i);
+        }
+        return found;
+    }
+#endif
+
+    typedef size_t (*IndexLineBreaksFunc)(const char*, size_t, size_t*, size_t);
+
+    /** pick the widest implementation the running cpu supports */
+    static IndexLineBreaksFunc resolveIndexLineBreaks(){
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")){
+            return indexLineBreaksAVX2;
+        }
+        if(__builtin_cpu_supports("sse2")){
+            return indexLineBreaksSSE2;
+        }
+#endif
+        return [](const char* buf, size_t len, size_t* pos, size_t maxPos){
+            return indexLineBreaksScalar(buf, len, pos, maxPos, 0);
+        };
+    }
+
+    size_t indexLineBreaks(const char* buf, size_t len, size_t* pos, size_t maxPos){
+        static const IndexLineBreaksFunc impl = resolveIndexLineBreaks();
+        return impl(buf, len, pos, maxPos);
+    }
+
+    /** compare bytes one by one, used on cpus without vector support */
+    static uint64_t mismatchMaskScalar(const char* a, const char* b){
+        uint64_t mask = 0;
+        for(int i = 0; i < MISMATCH_WIDTH; ++i){
+            mask |= (uint64_t)(a[i] != b[i]) << i;
+        }
+        return mask;
+    }
+
+#ifdef SIMD_X86
+    __attribute__((target("sse2")))
+    static uint64_t mismatchMaskSSE2(const char* a, const char* b){
+        uint64_t mask = 0;
+        for(int i = 0; i < MISMATCH_WIDTH; i += 16){
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+            mask |= (uint64_t)(~eq & 0xffffu) << i;
+        }
+        return mask;
+    }
+
+    __attribute__((target("avx2")))
+    static uint64_t mismatchMaskAVX2(const char* a, const char* b){
+        __m256i lo = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)a), _mm256_loadu_si256((const __m256i*)b));
+        __m256i hi = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + 32)), _mm256_loadu_si256((const __m256i*)(b + 32)));
+        uint64_t eq = (uint32_t)_mm256_movemask_epi8(lo) | ((uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32);
+        return ~eq;
+    }
+#endif
+
+    typedef uint64_t (*MismatchMaskFunc)(const char*, const char*);
+
+    /** pick the widest implementation the running cpu supports */
+    static MismatchMaskFunc resolveMismatchMask(){
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2")){
+            return mismatchMaskAVX2;
+        }
+        if(__builtin_cpu_supports("sse2")){
+            return mismatchMaskSSE2;
+        }
+#endif
+        return mismatchMaskScalar;
+    }
+
+    uint64_t mismatchMask(const char* a, const char* b){
+        static const MismatchMaskFunc impl = resolveMismatchMask();
+        return impl(a, b);
+    }
+
+    /** count differences byte by byte, used on cpus without vector support */
+    static void headMismatchesScalar(const char* a, const char* b, int shifts, int width, int limit, uint8_t* counts){
+        for(int s = 0; s < shifts; ++s){
+            int diff = 0;
+            for(int i = 0; i < width && diff < limit; ++i){
+                diff += a[s + i] != b[i];
+            }
+            counts[s] = diff;
+        }
+    }
+
+#ifdef SIMD_X86
+    __attribute__((target("sse2")))
+    static void headMismatchesSSE2(const char* a, const char* b, int shifts, int width, int limit, uint8_t* counts){
+        __m128i vb[4];
+        for(int j = 0; j < 4; ++j){
+            vb[j] = _mm_loadu_si128((const __m128i*)(b + 16 * j));
+        }
+        for(int s = 0; s < shifts; ++s){
+            int diff = 0;
+            for(int j = 0; j * 16 < width && diff < limit; ++j){
+                uint32_t ne = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + s + 16 * j)), vb[j])) & 0xffffu;
+                if(width - j * 16 < 16){
+                    ne &= (1u << (width - j * 16)) - 1;
+                }
+                diff += __builtin_popcount(ne);
+            }
+            counts[s] = diff;
+        }
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static void headMismatchesAVX2(const char* a, const char* b, int shifts, int width, int limit, uint8_t* counts){
+        __m256i lo = _mm256_loadu_si256((const __m256i*)b);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(b + 32));
+        uint32_t keepLo = width < 32 ? (1u << width) - 1 : ~0u;
+        uint32_t keepHi = width <= 32 ? 0 : (width < 64 ? (1u << (width - 32)) - 1 : ~0u);
+        for(int s = 0; s < shifts; ++s){
+            uint32_t ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + s)), lo)) & keepLo;
+            int diff = _mm_popcnt_u32(ne);
+            // heads of unrelated sequences differ enough in the low half already
+            if(diff < limit && keepHi){
+                ne = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + s + 32)), hi)) & keepHi;
+                diff += _mm_popcnt_u32(ne);
+            }
+            counts[s] = diff;
+        }
+    }
+#endif
+
+    typedef void (*HeadMismatchesFunc)(const char*, const char*, int, int, int, uint8_t*);
+
+    /** pick the widest implementation the running cpu supports */
+    static HeadMismatchesFunc resolveHeadMismatches(){
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")){
+            return headMismatchesAVX2;
+        }
+        if(__builtin_cpu_supports("sse2")){
+            return headMismatchesSSE2;
+        }
+#endif
+        return headMismatchesScalar;
+    }
+
+    void headMismatches(const char* a, const char* b, int shifts, int width, int limit, uint8_t* counts){
+        static const HeadMismatchesFunc impl = resolveHeadMismatches();
+        impl(a, b, shifts, width, limit, counts);
+    }
+}
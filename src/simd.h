@@ -0,0 +1,45 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+/** vectorized primitives, the widest instruction set supported by the running cpu is chosen at runtime */
+namespace simd{
+    /** collect the positions of line breaks('\r' or '\n') in a buffer\n
+     * scanning stops as soon as maxPos line breaks found
+     * @param buf buffer to scan
+     * @param len length of buf
+     * @param pos array to store offsets of line breaks relative to buf, in increasing order
+     * @param maxPos capacity of pos
+     * @return number of line breaks stored in pos
+     */
+    size_t indexLineBreaks(const char* buf, size_t len, size_t* pos, size_t maxPos);
+
+    const int MISMATCH_WIDTH = 64; ///< number of bytes compared by one mismatchMask call
+
+    /** compare two buffers of MISMATCH_WIDTH bytes byte by byte\n
+     * both buffers must be readable for MISMATCH_WIDTH bytes, callers mask out bits past the region they need
+     * @param a pointer to the first buffer
+     * @param b pointer to the second buffer
+     * @return bit i is set if a[i] != b[i]
+     */
+    uint64_t mismatchMask(const char* a, const char* b);
+
+    /** count differences between the heads of a buffer and shifts of another buffer\n
+     * counts[s] is the number of i < width with a[s + i] != b[i], for s < shifts,\n
+     * counting may stop once limit is reached, so any count not less than limit only means at least limit\n
+     * a must be readable for shifts + MISMATCH_WIDTH bytes and b for MISMATCH_WIDTH bytes
+     * @param a pointer to the shifted buffer
+     * @param b pointer to the fixed buffer
+     * @param shifts number of shifts to count
+     * @param width number of head bytes compared, at most MISMATCH_WIDTH
+     * @param limit number of differences from which exact counts are not needed
+     * @param counts array of shifts counts to store the results
+     */
+    void headMismatches(const char* a, const char* b, int shifts, int width, int limit, uint8_t* counts);
+}
+
+#endif
@@ -326,6 +326,16 @@ int Stats::getCycles(){
     return mCycles;
 }
 
+size_t Stats::getMemoryBytes(){
+    // 4 tables for each of 8 bases plus total base and total quality tables
+    size_t bytes = sizeof(size_t) * mBufLen * (8 * 4 + 2);
+    if(mKmerLen){
+        bytes += sizeof(size_t) * mKmerBufLen;
+    }
+    bytes += sizeof(size_t) * mEvaluatedSeqLen * mOverRepSeqDist.size();
+    return bytes;
+}
+
 size_t Stats::getReads(){
     if(!mSummarized){
         summarize();
@@ -96,6 +96,11 @@ class Stats{
          * @return cycle number 
          */
         int getCycles();
+
+        /** get bytes of the statistics tables allocated now
+         * @return bytes of cycle, kmer and over represented sequence tables
+         */
+        size_t getMemoryBytes();
         
         /** get total raeds number 
          * @return total read number 
@@ -16,11 +16,21 @@ ThreadConfig::ThreadConfig(Options* opt, int threadId, bool paired){
     mWriter1 = NULL;
     mWriter2 = NULL;
     mFilterResult = new FilterResult(mOptions, paired);
+    mInsertSizeHist = NULL;
+    if(paired){
+        mInsertSizeHist = new long[mOptions->insertSizeMax + 1];
+        std::memset(mInsertSizeHist, 0, sizeof(long) * (mOptions->insertSizeMax + 1));
+    }
     mCanBeStopped = false;
+    mStatsBytes = 0;
 }
 
 ThreadConfig::~ThreadConfig(){
     cleanup();
+    if(mInsertSizeHist){
+        delete[] mInsertSizeHist;
+        mInsertSizeHist = NULL;
+    }
 }
 
 void ThreadConfig::cleanup(){
@@ -42,13 +52,13 @@ void ThreadConfig::deleteWriter(){
 
 void ThreadConfig::initWriter(std::string filename1){
     deleteWriter();
-    mWriter1 = new Writer(filename1, mOptions->compression);
+    mWriter1 = new Writer(filename1, mOptions->compression, false, mOptions->bgzf, mOptions->bgzfIndex, (size_t)mOptions->preallocMBytes << 20, mOptions->directIO);
 }
 
 void ThreadConfig::initWriter(std::string filename1, std::string filename2){
     deleteWriter();
-    mWriter1 = new Writer(filename1, mOptions->compression);
-    mWriter2 = new Writer(filename2, mOptions->compression);
+    mWriter1 = new Writer(filename1, mOptions->compression, false, mOptions->bgzf, mOptions->bgzfIndex, (size_t)mOptions->preallocMBytes << 20, mOptions->directIO);
+    mWriter2 = new Writer(filename2, mOptions->compression, false, mOptions->bgzf, mOptions->bgzfIndex, (size_t)mOptions->preallocMBytes << 20, mOptions->directIO);
 }
 
 void ThreadConfig::initWriter(std::ofstream* stream){
@@ -85,6 +95,20 @@ void ThreadConfig::addMergedPairs(int n){
     mFilterResult->addMergedPairs(n);
 }
 
+size_t ThreadConfig::getStatsGrowth(){
+    size_t bytes = 0;
+    Stats* stats[4] = {mPreStats1, mPostStats1, mPreStats2, mPostStats2};
+    for(int i = 0; i < 4; ++i){
+        if(stats[i]){
+            bytes += stats[i]->getMemoryBytes();
+        }
+    }
+    // tables never shrink
+    size_t growth = bytes - mStatsBytes;
+    mStatsBytes = bytes;
+    return growth;
+}
+
 void ThreadConfig::initWriterForSplit(){
     if(mOptions->out1.empty())
         return ;
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <cstring>
 #include "util.h"
 #include "stats.h"
 #include "writer.h"
@@ -58,6 +59,11 @@ public:
      */
     inline FilterResult* getFilterResult() {return mFilterResult;}
 
+    /** get the insert size histogram of pairs processed in this thread
+     * @return pointer to an array of mOptions->insertSizeMax + 1 counts, NULL if single end
+     */
+    inline long* getInsertSizeHist() {return mInsertSizeHist;}
+
     /** initialize a Writer with one filename
      * @param filename1 filename of read1
      */
@@ -108,6 +114,11 @@ public:
     void addMergedPairs(int n);
 
 
+    /** get the growth of statistics tables of this thread since the last call
+     * @return bytes the tables grew by, bytes of all tables on the first call
+     */
+    size_t getStatsGrowth();
+
     /** get the manual crafted thread marker
      * @return mThreadId
      */
@@ -151,11 +162,13 @@ private:
     Writer* mWriter2;            ///< pointer to read2 Writer object
     Options* mOptions;           ///< pointer to Options object
     FilterResult* mFilterResult; ///< pointer to FilterResult
+    long* mInsertSizeHist;       ///< insert size counts of pairs processed in this thread, NULL if single end
     // for spliting output
     int mThreadId;               ///< manual made artificial thread/split marker
     int mWorkingSplit;           ///< initial is just mThreadId, if this thread is full, it may increase mOptions->thread
     size_t mCurrentSplitReads;   ///< reads reads writen to current output part file
     bool mCanBeStopped;          ///< this thread have done work and can be stopped now if true
+    size_t mStatsBytes;          ///< bytes of statistics tables seen by the last getStatsGrowth call
 };
 
 #endif
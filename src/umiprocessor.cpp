@@ -76,6 +76,8 @@ void UmiProcessor::process(Read* r1, Read* r2){
 }
 
 void UmiProcessor::addTagToName(Read* r, const std::string& tag){
+    // the name may keep its length, so the record parsed from input is stale now
+    r->raw = NULL;
     std::string::size_type pos = r->name.find_first_of(" ");
     if(pos == std::string::npos){
         r->name = r->name + tag;
@@ -1,11 +1,24 @@
 #include "writer.h"
 
-Writer::Writer(const std::string& filename, const int& compression){
+Writer::Writer(const std::string& filename, const int& compression, bool precompressed, bool bgzf, bool bgzfIndex,
+               size_t prealloc, bool direct){
     mCompressLevel = compression;
     mFilename = filename;
     mGzFile = NULL;
+    mStream = NULL;
+    mFd = -1;
+    mBuf = NULL;
+    mBufLen = 0;
+    mFileOffset = 0;
+    mPrealloc = prealloc;
+    mDirect = direct;
     mZipped = false;
     mNeedClose = true;
+    mPrecompressed = precompressed;
+    mBgzf = bgzf && util::endsWith(mFilename, ".gz");
+    mBgzfIndex = mBgzf && bgzfIndex;
+    mCompressedOffset = 0;
+    mUncompressedOffset = 0;
     init();
 }
 
@@ -13,14 +26,36 @@ Writer::Writer(std::ofstream* stream){
     mGzFile = NULL;
     mZipped = false;
     mStream = stream;
+    mFd = -1;
+    mBuf = NULL;
+    mBufLen = 0;
+    mFileOffset = 0;
+    mPrealloc = 0;
+    mDirect = false;
     mNeedClose = false;
+    mPrecompressed = false;
+    mBgzf = false;
+    mBgzfIndex = false;
+    mCompressedOffset = 0;
+    mUncompressedOffset = 0;
 }
 
 Writer::Writer(gzFile gzfile){
     mStream = NULL;
     mGzFile = gzfile;
+    mFd = -1;
+    mBuf = NULL;
+    mBufLen = 0;
+    mFileOffset = 0;
+    mPrealloc = 0;
+    mDirect = false;
     mZipped = true;
     mNeedClose = false;
+    mPrecompressed = false;
+    mBgzf = false;
+    mBgzfIndex = false;
+    mCompressedOffset = 0;
+    mUncompressedOffset = 0;
 }
 
 Writer::~Writer(){
@@ -34,31 +69,135 @@ std::string Writer::getFilename(){
 }
 
 void Writer::init(){
-    if(util::endsWith(mFilename, ".gz")){
+    if(util::endsWith(mFilename, ".gz") && !mPrecompressed && !mBgzf){
         mGzFile = gzopen(mFilename.c_str(), "w");
         gzsetparams(mGzFile, mCompressLevel, Z_DEFAULT_STRATEGY);
         gzbuffer(mGzFile, 1024 * 1024);
         mZipped = true;
     }else{
-        mStream = new std::ofstream();
-        mStream->open(mFilename.c_str(), std::ios::out);
+        openFd();
         mZipped = false;
     }
 }
 
+void Writer::openFd(){
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+    if(mDirect){
+        mFd = ::open(mFilename.c_str(), flags | O_DIRECT, 0666);
+    }
+#endif
+    // not every filesystem supports O_DIRECT, write through the page cache then
+    if(mFd < 0){
+        mDirect = false;
+        mFd = ::open(mFilename.c_str(), flags, 0666);
+    }
+    if(mFd < 0){
+        util::errorExit("can not open output file: " + mFilename);
+    }
+    if(posix_memalign((void**)&mBuf, DIRECT_ALIGN, WRITE_BUFFER_SIZE) != 0){
+        util::errorExit("can not allocate output buffer for " + mFilename);
+    }
+    // preallocation is only a hint, pipes and some filesystems do without it
+    if(mPrealloc > 0 && ::posix_fallocate(mFd, 0, mPrealloc) != 0){
+        mPrealloc = 0;
+    }
+}
+
+bool Writer::writeRaw(const char* data, size_t size){
+    if(mStream){
+        mStream->write(data, size);
+        return !mStream->fail();
+    }
+    // data too big to join the buffer goes out with it in one call without being copied, O_DIRECT only writes from mBuf
+    if(!mDirect && mBufLen + size > WRITE_BUFFER_SIZE){
+        struct iovec iov[2];
+        iov[0].iov_base = mBuf;
+        iov[0].iov_len = mBufLen;
+        iov[1].iov_base = (void*)data;
+        iov[1].iov_len = size;
+        mBufLen = 0;
+        return writeAll(iov, 2);
+    }
+    bool status = true;
+    while(size > 0){
+        size_t n = std::min(size, WRITE_BUFFER_SIZE - mBufLen);
+        std::memcpy(mBuf + mBufLen, data, n);
+        mBufLen += n;
+        data += n;
+        size -= n;
+        if(mBufLen == WRITE_BUFFER_SIZE){
+            status = flushBuf(false) && status;
+        }
+    }
+    return status;
+}
+
+bool Writer::writeAll(struct iovec* iov, int n){
+    while(true){
+        while(n > 0 && iov->iov_len == 0){
+            ++iov;
+            --n;
+        }
+        if(n == 0){
+            return true;
+        }
+        ssize_t ret = ::writev(mFd, iov, n);
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+        if(ret <= 0){
+            return false;
+        }
+        mFileOffset += ret;
+        // skip what has been written
+        size_t done = ret;
+        while(done > 0){
+            size_t k = std::min(done, iov->iov_len);
+            iov->iov_base = (char*)iov->iov_base + k;
+            iov->iov_len -= k;
+            done -= k;
+            if(iov->iov_len == 0){
+                ++iov;
+                --n;
+            }
+        }
+    }
+}
+
+bool Writer::flushBuf(bool all){
+    size_t len = mBufLen;
+    if(mDirect){
+        if(all){
+            // the tail is not a whole block, write it through the page cache
+            ::fcntl(mFd, F_SETFL, ::fcntl(mFd, F_GETFL) & ~O_DIRECT);
+            mDirect = false;
+        }else{
+            len = mBufLen / DIRECT_ALIGN * DIRECT_ALIGN;
+        }
+    }
+    struct iovec iov;
+    iov.iov_base = mBuf;
+    iov.iov_len = len;
+    bool status = writeAll(&iov, 1);
+    std::memmove(mBuf, mBuf + len, mBufLen - len);
+    mBufLen -= len;
+    return status;
+}
+
 bool Writer::writeLine(const std::string& linestr){
     const char* line = linestr.c_str();
     size_t size = linestr.length();
     size_t written = 0;
     bool status = true;
-    if(mZipped){
+    if(mBgzf){
+        status = writeBgzf(line, size) && writeBgzf("\n", 1);
+    }else if(mZipped){
         written = gzwrite(mGzFile, line, size);
         gzputc(mGzFile, '\n');
         status = size == written;
     }else{
-        mStream->write(line, size);
-        mStream->put('\n');
-        status = !mStream->fail();
+        status = writeRaw(line, size) && writeRaw("\n", 1);
     }
     return status;
 }
@@ -68,12 +207,13 @@ bool Writer::writeString(const std::string& str){
     size_t size = str.length();
     size_t written = 0;
     bool status = true;
-    if(mZipped){
+    if(mBgzf){
+        status = writeBgzf(cstr, size);
+    }else if(mZipped){
         written = gzwrite(mGzFile, cstr, size);
         status = size == written;
     }else{
-        mStream->write(cstr, size);
-        status = !mStream->fail();
+        status = writeRaw(cstr, size);
     }
     return status;
 }
@@ -81,24 +221,50 @@ bool Writer::writeString(const std::string& str){
 bool Writer::write(char* cstr, size_t size){
     size_t written = 0;
     bool status = true;
-    if(mZipped){
+    if(mBgzf){
+        status = writeBgzf(cstr, size);
+    }else if(mZipped){
         written = gzwrite(mGzFile, cstr, size);
         status = size == written;
     }else{
-        mStream->write(cstr, size);
-        status = !mStream->fail();
+        status = writeRaw(cstr, size);
     }
     return status;
 }
 
 void Writer::close(){
+    if(mBgzf && mFd >= 0){
+        if(!mBlockData.empty()){
+            std::string blocks;
+            deflateBgzf(mBlockData.c_str(), mBlockData.size(), mCompressLevel, blocks);
+            writeBlocks(blocks.c_str(), blocks.size());
+            mBlockData.clear();
+        }
+        // an empty block marks the end of a BGZF file
+        static const unsigned char eofBlock[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67, 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        writeRaw((const char*)eofBlock, sizeof(eofBlock));
+        if(mBgzfIndex){
+            writeIndex();
+        }
+    }
     if(mZipped){
         if(mGzFile){
             gzflush(mGzFile, Z_FINISH);
             gzclose(mGzFile);
             mGzFile = NULL;
         }
+    }else if(mFd >= 0){
+        flushBuf(true);
+        // give back the preallocated space not used
+        if(mPrealloc > mFileOffset && ::ftruncate(mFd, mFileOffset) != 0){
+            std::cerr << "Warning: can not truncate preallocated output " << mFilename << std::endl;
+        }
+        ::close(mFd);
+        mFd = -1;
+        std::free(mBuf);
+        mBuf = NULL;
     }else if(mStream){
+        // the stream is owned by the caller
         if(mStream->is_open()){
             mStream->flush();
             mStream = NULL;
@@ -109,3 +275,101 @@ void Writer::close(){
 bool Writer::isZipped(){
     return mZipped;
 }
+
+void Writer::deflateBgzf(const char* data, size_t size, int level, std::string& out){
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // raw deflate, the gzip header with the BC extra field and the footer are written here
+    if(deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+        util::errorExit("can not initialize BGZF compression");
+    }
+    const size_t headerLen = 18;
+    const size_t footerLen = 8;
+    for(size_t pos = 0; pos < size; pos += BGZF_BLOCK_DATA){
+        size_t len = std::min(size - pos, (size_t)BGZF_BLOCK_DATA);
+        size_t start = out.size();
+        out.resize(start + BGZF_BLOCK_SIZE);
+        unsigned char* block = (unsigned char*)&out[start];
+        int ret = Z_BUF_ERROR;
+        // data hardly compressible may not fit in a block, store it then
+        for(int l = level; ret != Z_STREAM_END; l = 0){
+            deflateReset(&zs);
+            deflateParams(&zs, l, Z_DEFAULT_STRATEGY);
+            zs.next_in = (Bytef*)(data + pos);
+            zs.avail_in = len;
+            zs.next_out = block + headerLen;
+            zs.avail_out = BGZF_BLOCK_SIZE - headerLen - footerLen;
+            ret = deflate(&zs, Z_FINISH);
+            if(ret != Z_STREAM_END && l == 0){
+                util::errorExit("can not compress BGZF block");
+            }
+        }
+        size_t blockSize = headerLen + zs.total_out + footerLen;
+        static const unsigned char header[16] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67, 2, 0};
+        std::memcpy(block, header, 16);
+        block[16] = (blockSize - 1) & 0xff;
+        block[17] = (blockSize - 1) >> 8;
+        uint32_t crc = crc32(crc32(0L, Z_NULL, 0), (const Bytef*)(data + pos), len);
+        unsigned char* footer = block + headerLen + zs.total_out;
+        for(int i = 0; i < 4; ++i){
+            footer[i] = (crc >> (8 * i)) & 0xff;
+            footer[4 + i] = ((uint32_t)len >> (8 * i)) & 0xff;
+        }
+        out.resize(start + blockSize);
+    }
+    deflateEnd(&zs);
+}
+
+bool Writer::writeBgzf(const char* data, size_t size){
+    if(mPrecompressed){
+        return writeBlocks(data, size);
+    }
+    mBlockData.append(data, size);
+    if(mBlockData.size() < BGZF_BLOCK_DATA){
+        return true;
+    }
+    // compress whole blocks, keep the tail for the next write
+    size_t whole = mBlockData.size() / BGZF_BLOCK_DATA * BGZF_BLOCK_DATA;
+    std::string blocks;
+    deflateBgzf(mBlockData.c_str(), whole, mCompressLevel, blocks);
+    mBlockData.erase(0, whole);
+    return writeBlocks(blocks.c_str(), blocks.size());
+}
+
+bool Writer::writeBlocks(const char* blocks, size_t size){
+    if(mBgzfIndex){
+        const unsigned char* p = (const unsigned char*)blocks;
+        for(size_t pos = 0; pos + 18 <= size; ){
+            size_t blockSize = (p[pos + 16] | (p[pos + 17] << 8)) + 1;
+            const unsigned char* isize = p + pos + blockSize - 4;
+            if(mCompressedOffset > 0){
+                mBlockOffsets.push_back(std::make_pair(mCompressedOffset, mUncompressedOffset));
+            }
+            mCompressedOffset += blockSize;
+            mUncompressedOffset += isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+            pos += blockSize;
+        }
+    }
+    return writeRaw(blocks, size);
+}
+
+void Writer::writeIndex(){
+    std::ofstream ofs((mFilename + ".gzi").c_str(), std::ios::out | std::ios::binary);
+    if(!ofs.is_open()){
+        util::errorExit("can not write BGZF index " + mFilename + ".gzi");
+    }
+    // little endian uint64 count followed by pairs of compressed and uncompressed offsets
+    std::vector<uint64_t> values;
+    values.push_back(mBlockOffsets.size());
+    for(auto& e: mBlockOffsets){
+        values.push_back(e.first);
+        values.push_back(e.second);
+    }
+    for(uint64_t v: values){
+        unsigned char buf[8];
+        for(int i = 0; i < 8; ++i){
+            buf[i] = (v >> (8 * i)) & 0xff;
+        }
+        ofs.write((const char*)buf, 8);
+    }
+}
@@ -7,24 +7,61 @@
 #include <cstring>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cerrno>
 #include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
 #include "util.h"
 
-/** Class to write to gz file or ofstream */
+/** Class to write to gz file or ofstream\n
+ * a file written as is(plain, precompressed or BGZF) is written to its file descriptor through an aligned buffer of WRITE_BUFFER_SIZE,\n
+ * data too big to join the buffer goes out with it in one writev, optionally the file is preallocated and written with O_DIRECT\n
+ * gz output can also be written in BGZF format: blocks of at most BGZF_BLOCK_DATA bytes, each its own gzip member\n
+ * with the compressed block size in the BC extra field, ended by an empty EOF block, and optionally a .gzi index of\n
+ * the compressed and uncompressed offset of each block after the first(the format of bgzip -i)
+ */
 class Writer{
         std::string mFilename;  ///< output filename
         gzFile mGzFile;        ///< gzFile file handler
-        std::ofstream* mStream; ///< pointer to ofstream
+        std::ofstream* mStream; ///< pointer to ofstream given by the caller, NULL if not used
+        int mFd;                ///< file descriptor of a file written as is, -1 if not used
+        char* mBuf;             ///< aligned buffer of WRITE_BUFFER_SIZE bytes to gather data for mFd
+        size_t mBufLen;         ///< bytes held in mBuf
+        uint64_t mFileOffset;   ///< bytes written to mFd
+        size_t mPrealloc;       ///< bytes preallocated for mFd, 0 if not preallocated
+        bool mDirect;           ///< mFd is opened with O_DIRECT, so only whole aligned blocks are written until closed
         bool mZipped;           ///< output file is mZipped or not
         int mCompressLevel;     ///< compression level for gz file
         bool mNeedClose;        ///< needed to be closed or not
+        bool mPrecompressed;    ///< data written is gzip compressed already, so it is written as is
+        bool mBgzf;             ///< output is in BGZF format
+        bool mBgzfIndex;        ///< write a .gzi index of BGZF blocks when closed
+        std::string mBlockData; ///< data not compressed into a BGZF block yet, if not precompressed
+        uint64_t mCompressedOffset;   ///< bytes of BGZF blocks written
+        uint64_t mUncompressedOffset; ///< uncompressed bytes of BGZF blocks written
+        std::vector<std::pair<uint64_t, uint64_t>> mBlockOffsets; ///< compressed and uncompressed offset of each BGZF block after the first
 
     public:
+        static const size_t BGZF_BLOCK_DATA = 0xff00;  ///< max uncompressed bytes in a BGZF block
+        static const size_t BGZF_BLOCK_SIZE = 0x10000; ///< max bytes of a BGZF block
+        static const size_t WRITE_BUFFER_SIZE = 1UL << 22; ///< bytes of mBuf, a multiple of DIRECT_ALIGN
+        static const size_t DIRECT_ALIGN = 4096;       ///< alignment of memory, offsets and lengths written with O_DIRECT
+
         /** Writer constructor
          * @param filename output filename
          * @param compression compression level for gzFile
+         * @param precompressed if true data written is gzip members(or BGZF blocks) already, it is written as is even if filename ends with .gz
+         * @param bgzf if true and filename ends with .gz the output is in BGZF format
+         * @param bgzfIndex if true a .gzi index is written alongside BGZF output
+         * @param prealloc bytes to preallocate for a file written as is, the unused tail is cut when closed, 0 to disable
+         * @param direct if true a file written as is is opened with O_DIRECT if the filesystem supports it
          */
-        Writer(const std::string& filename, const int& compression = 3);
+        Writer(const std::string& filename, const int& compression = 3, bool precompressed = false, bool bgzf = false, bool bgzfIndex = false,
+               size_t prealloc = 0, bool direct = false);
         
         /** Writer constructor
          * @param mStream pointer to ofstream
@@ -76,6 +113,55 @@ class Writer{
         /** flush buffer and close file handler
          */
         void close();
+
+        /** compress data into BGZF blocks
+         * @param data pointer to data
+         * @param size length of data
+         * @param level compression level
+         * @param out string to append the blocks to
+         */
+        static void deflateBgzf(const char* data, size_t size, int level, std::string& out);
+
+    private:
+        /** write data to a BGZF output, compress it into blocks first if not precompressed
+         * @param data pointer to data
+         * @param size length of data
+         * @return true if successfully written
+         */
+        bool writeBgzf(const char* data, size_t size);
+
+        /** write BGZF blocks and record their offsets
+         * @param blocks pointer to whole blocks
+         * @param size length of blocks
+         * @return true if successfully written
+         */
+        bool writeBlocks(const char* blocks, size_t size);
+
+        /** write the .gzi index of the BGZF blocks written */
+        void writeIndex();
+
+        /** open mFd for a file written as is, preallocate mPrealloc bytes and try O_DIRECT if mDirect, both are dropped if not supported */
+        void openFd();
+
+        /** write data to a file written as is, through mBuf or along with it
+         * @param data pointer to data
+         * @param size length of data
+         * @return true if successfully written
+         */
+        bool writeRaw(const char* data, size_t size);
+
+        /** write the whole of some buffers to mFd, retrying short writes
+         * @param iov buffers to write, modified
+         * @param n number of buffers
+         * @return true if successfully written
+         */
+        bool writeAll(struct iovec* iov, int n);
+
+        /** write out mBuf, with O_DIRECT only the whole aligned blocks in it unless all is true
+         * @param all write the unaligned tail too, O_DIRECT is turned off first
+         * @return true if successfully written
+         */
+        bool flushBuf(bool all);
 };
 
 #endif
@@ -1,55 +1,128 @@
 #include "writerthread.h"
 
-WriterThread::WriterThread(Options* opt, const std::string& filename){
+WriterThread::WriterThread(Options* opt, const std::string& filename, BufferPool* pool){
     mOptions = opt;
     mWriter = NULL;
-    mInputCounter = 0;
-    mOutputCounter = 0;
-    mInputCompleted = false;
     mFilename = filename;
-
-    mRingBuffer = new char*[mOptions->bufSize.maxPacksInReadPackRepo];
-    std::memset(mRingBuffer, 0, sizeof(char*) * mOptions->bufSize.maxPacksInReadPackRepo);
-    mRingBufferSizes = new size_t[mOptions->bufSize.maxPacksInReadPackRepo];
-    std::memset(mRingBufferSizes, 0, sizeof(size_t) * mOptions->bufSize.maxPacksInReadPackRepo);
+    mPool = pool;
+    // workers wait when the writer falls behind, so at most maxPacksInMemory results pile up
+    mQueue = new MPMCQueue<std::string*>(std::min(mOptions->bufSize.maxPacksInReadPackRepo, mOptions->bufSize.maxPacksInMemory + 1));
+    mNextOrder = 0;
+    mBudget = NULL;
+    mDeflateInput = !mOptions->serialGzip && util::endsWith(mFilename, ".gz");
+    mWritten = false;
+    if(mOptions->orderedOutput){
+        // every worker can run a memory budget ahead of a straggler before waiting
+        mWindow.resize(mOptions->bufSize.maxPacksInMemory + mOptions->thread, NULL);
+    }
     iniWriter(mFilename);
 }
 
 WriterThread::~WriterThread(){
     cleanup();
-    delete mRingBuffer;
-    delete mRingBufferSizes;
+    std::string* buf = NULL;
+    while(mQueue->tryPop(buf)){
+        mPool->release(buf);
+    }
+    delete mQueue;
+    for(size_t i = 0; i < mWindow.size(); ++i){
+        mPool->release(mWindow[i]);
+    }
 }
 
 bool WriterThread::isCompleted(){
-    return mInputCompleted && (mOutputCounter == mInputCounter);
+    return mQueue->isClosed() && mQueue->size() == 0;
 }
 
 bool WriterThread::setInputCompleted(){
-    mInputCompleted = true;
+    mQueue->close();
     return true;
 }
 
 void WriterThread::output(){
-    while(mOutputCounter < mInputCounter){
-        mWriter->write(mRingBuffer[mOutputCounter], mRingBufferSizes[mOutputCounter]);
-        delete mRingBuffer[mOutputCounter];
-        mRingBuffer[mOutputCounter] = NULL;
-        ++mOutputCounter;
+    std::string* buf = NULL;
+    while(mQueue->pop(buf)){
+        size_t size = buf->size();
+        mWriter->writeString(*buf);
+        mWritten = mWritten || size > 0;
+        mPool->release(buf);
+        if(mBudget){
+            mBudget->release(size);
+        }
     }
-    if(mOutputCounter >= mOptions->bufSize.maxPacksInReadPackRepo){
-        mOutputCounter = mOutputCounter % mOptions->bufSize.maxPacksInReadPackRepo;
-        mInputCounter = mInputCounter % mOptions->bufSize.maxPacksInReadPackRepo;
+    // an empty gzip file still holds one empty member, the Writer ends BGZF output with an empty block itself
+    if(mDeflateInput && !mOptions->bgzf && !mWritten){
+        buf = mPool->acquire();
+        deflateMember(buf);
+        mWriter->writeString(*buf);
+        mPool->release(buf);
     }
 }
 
-void WriterThread::input(char* cstr, size_t size){
-    while(mInputCounter >= mOptions->bufSize.maxPacksInReadPackRepo){
-        usleep(1);
+void WriterThread::deflateBlocks(std::string*& buf){
+    std::string* blocks = mPool->acquire();
+    Writer::deflateBgzf(buf->c_str(), buf->size(), mOptions->compression, *blocks);
+    mPool->release(buf);
+    buf = blocks;
+}
+
+void WriterThread::deflateMember(std::string*& buf){
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // 16 + MAX_WBITS writes a gzip header and trailer around the deflate stream
+    if(deflateInit2(&zs, mOptions->compression, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+        util::errorExit("can not initialize gzip compression for " + mFilename);
+    }
+    std::string* member = mPool->acquire();
+    member->resize(deflateBound(&zs, buf->size()));
+    zs.next_in = (Bytef*)buf->c_str();
+    zs.avail_in = buf->size();
+    zs.next_out = (Bytef*)&(*member)[0];
+    zs.avail_out = member->size();
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END){
+        util::errorExit("can not compress gzip output for " + mFilename);
+    }
+    member->resize(zs.total_out);
+    deflateEnd(&zs);
+    mPool->release(buf);
+    buf = member;
+}
+
+void WriterThread::compress(std::string*& buf){
+    if(!mDeflateInput || buf->empty()){
+        return;
+    }
+    if(mOptions->bgzf){
+        deflateBlocks(buf);
+    }else{
+        deflateMember(buf);
     }
-    mRingBuffer[mInputCounter] = cstr;
-    mRingBufferSizes[mInputCounter] = size;
-    ++mInputCounter;
+}
+
+void WriterThread::input(size_t order, std::string* buf){
+    if(mBudget){
+        mBudget->charge(buf->size());
+    }
+    if(mWindow.empty()){
+        mQueue->push(buf);
+        return;
+    }
+    std::unique_lock<std::mutex> lk(mWindowMtx);
+    // the pack at mNextOrder always fits, so the window keeps advancing
+    mWindowCV.wait(lk, [this, order]{return order < mNextOrder + mWindow.size();});
+    size_t slot = order % mWindow.size();
+    mWindow[slot] = buf;
+    if(order != mNextOrder){
+        return;
+    }
+    // pass the packs now in order to mQueue, later workers wait on the mutex only as long as the writer keeps up
+    while(mWindow[slot]){
+        mQueue->push(mWindow[slot]);
+        mWindow[slot] = NULL;
+        ++mNextOrder;
+        slot = mNextOrder % mWindow.size();
+    }
+    mWindowCV.notify_all();
 }
 
 void WriterThread::cleanup(){
@@ -65,7 +138,8 @@ void WriterThread::deleteWriter(){
 
 void WriterThread::iniWriter(const std::string& mFilename){
     deleteWriter();
-    mWriter = new Writer(mFilename, mOptions->compression);
+    mWriter = new Writer(mFilename, mOptions->compression, mDeflateInput, mOptions->bgzf, mOptions->bgzfIndex,
+                         (size_t)mOptions->preallocMBytes << 20, mOptions->directIO);
 }
 
 void WriterThread::iniWriter(std::ofstream* ofs){
@@ -79,5 +153,13 @@ void WriterThread::iniWriter(gzFile gzfile){
 }
 
 size_t WriterThread::bufferLength(){
-    return mInputCounter - mOutputCounter;
+    return mQueue->size();
+}
+
+size_t WriterThread::bufferCapacity(){
+    return mQueue->capacity();
+}
+
+void WriterThread::setMemoryBudget(MemoryBudget* budget){
+    mBudget = budget;
 }
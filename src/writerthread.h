@@ -8,18 +8,30 @@
 #include <vector>
 #include <mutex>
 #include <atomic>
+#include <utility>
+#include <condition_variable>
 #include "util.h"
 #include "writer.h"
 #include "options.h"
+#include "mpmcqueue.h"
+#include "memorybudget.h"
+#include "bufferpool.h"
 
-/** class to hold a writer thread to write to one file from ring buffer */
+/** class to hold a writer thread to write to one file from a bounded queue\n
+ * if output is ordered, results are put through a reorder window keyed by pack order first,\n
+ * so they reach the queue in input order whichever worker finishes first\n
+ * workers serialize reads straight into buffers from a BufferPool, a buffer input is owned by this thread until written and then goes back to the pool,\n
+ * gzip output is deflated by each worker calling compress on its buffer into a gzip member(or BGZF blocks) of its own before input,\n
+ * the writer thread only appends finished members, and the members make up a valid multi-member gzip file
+ */
 class WriterThread{
     public:
         /** construct a WriterThread object
          * @param opt pointer to Options object
          * @param filename output filename
+         * @param pool pointer to BufferPool buffers are input from and given back to
          */
-        WriterThread(Options* opt, const std::string& filename);
+        WriterThread(Options* opt, const std::string& filename, BufferPool* pool);
        
         /** destroy a WriterThread object
          */ 
@@ -40,38 +52,55 @@ class WriterThread{
          */
         void iniWriter(gzFile gzfile);
 
-        /** free resources used by ringbuffer
+        /** free resources used by writer
          */ 
         void cleanup();
 
         /** test wheather this writing thread compoleted its work
-         * @return true if mInputCompleted && (mOutputCounter == mInputCounter)
+         * @return true if input completed and all buffers in mQueue written
          */
         bool isCompleted();
 
-        /** write mRingBuffer[mOutputCounter] to output if possible\n
-         * if(if(mOutputCounter >= mInputCounter){waiting for 100s for input}\n
-         * then try to write mRingBuffer[mOutputCounter] to output while(mOutputCounter < mInputCounter)\n
-         * increase mOutputCounter after each writting
+        /** write buffers in mQueue to output in the order they are put, and give them back to mPool\n
+         * sleep while mQueue is empty, return after input completed and all buffers written
          */
         void output();
 
-        /** feed C string to mRingBuffer and increase mInputCounter
-         * @param cstr C string to add into mRingBuffer
-         * @param size C string length
+        /** deflate a buffer into a gzip member(or BGZF blocks) if this WriterThread writes gzip output, do nothing otherwise\n
+         * called by workers before input and outside any lock shared by workers, so packs are compressed in parallel
+         * @param buf buffer from mPool, given back and replaced by another one holding the compressed data
          */
-        void input(char* cstr, size_t size);
+        void compress(std::string*& buf);
+
+        /** feed a buffer to mQueue, wait while mQueue is full\n
+         * if output is ordered, the buffer is held in the reorder window until all packs before it are input,\n
+         * a worker only waits when its pack is a whole window ahead of the oldest pack not input yet\n
+         * buf is owned by this WriterThread from now on, for gzip output it should be passed through compress first
+         * @param order order of the pack the buffer comes from, every pack should be input once if output is ordered
+         * @param buf buffer acquired from mPool
+         */
+        void input(size_t order, std::string* buf);
         
-        /** set mInputCompleted = true;
+        /** mark no more buffers will be input and wake up the writing thread
          * return true
          */
         bool setInputCompleted();
         
-        /** get number of C strings in this thread ringbuffer to be written to output
-         * @return mInputCounter - mOutputCounter
+        /** get number of buffers in this thread queue to be written to output
+         * @return number of buffers in mQueue
          */ 
         size_t bufferLength();
+
+        /** get max number of buffers this thread queue can hold
+         * @return capacity of mQueue
+         */
+        size_t bufferCapacity();
         
+        /** charge buffers input to a MemoryBudget until they are written
+         * @param budget pointer to MemoryBudget
+         */
+        void setMemoryBudget(MemoryBudget* budget);
+
         /** get output fiilename
          * @return filename
          */
@@ -84,16 +113,29 @@ class WriterThread{
          */
         void deleteWriter();
 
+        /** deflate a buffer into a gzip member
+         * @param buf buffer from mPool, given back and replaced by another one holding the member
+         */
+        void deflateMember(std::string*& buf);
+
+        /** compress a buffer into BGZF blocks
+         * @param buf buffer from mPool, given back and replaced by another one holding the blocks
+         */
+        void deflateBlocks(std::string*& buf);
+
     private:
         Options* mOptions;                  ///< pointer to Options
-        Writer* mWriter;                    ///< Writer object to write cstring in ringbuffer into output
+        Writer* mWriter;                    ///< Writer object to write buffers in mQueue into output
         std::string mFilename;              ///< output filename of this thread
-        // for spliting control
-        bool mInputCompleted;               ///< if true this thread have finished all writting
-        std::atomic<size_t> mInputCounter;  ///< atomic type long integer to mark the index of input position in ringbuffer
-        std::atomic<size_t> mOutputCounter; ///< atomic type long integer to mark the index of output position in ringbuffer
-        char** mRingBuffer;                 ///< array to store pointer to C string to be written
-        size_t* mRingBufferSizes;           ///< array to store the length of each C string to be written
+        BufferPool* mPool;                  ///< pointer to BufferPool buffers are given back to after written
+        bool mDeflateInput;                 ///< buffers are deflated into gzip members by compress in the worker threads
+        bool mWritten;                      ///< some bytes have been written to output
+        MPMCQueue<std::string*>* mQueue;    ///< queue of buffers to be written
+        MemoryBudget* mBudget;              ///< pointer to MemoryBudget charged with buffers not written yet, NULL if memory not limited
+        std::vector<std::string*> mWindow;  ///< reorder window, buffer of pack order is held at order % size, NULL if not input yet
+        size_t mNextOrder;                  ///< order of the next pack to pass from mWindow to mQueue
+        std::mutex mWindowMtx;              ///< mutex to protect mWindow
+        std::condition_variable mWindowCV;  ///< condition variable to notify mWindow advanced
 };
 
 #endif
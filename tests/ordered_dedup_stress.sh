@@ -0,0 +1,37 @@
+#!/bin/sh
+# stress --ordered_output --dedup with many workers and small packs:
+# every run should finish and write the same output as a single worker run,
+# a run hanging on a pack queued behind newer ones is killed by timeout
+
+srcdir=${srcdir:-.}
+fqtool=${FQTOOL:-./src/fqtool}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# 250000 reads with unique names and 125000 distinct sequences(each read rotated 10 ways, every rotation twice),
+# more than a 1MB dedup table holds, so reads are spilled and replayed
+gzip -dc "$srcdir/testdata/r1.fq.gz" | awk '
+    NR % 4 == 1 {name = substr($1, 2)}
+    NR % 4 == 2 {seq = $0}
+    NR % 4 == 0 {
+        n = length(seq)
+        for(c = 0; c < 10; ++c){
+            s = substr(seq, c + 1) substr(seq, 1, c)
+            q = substr($0, c + 1) substr($0, 1, c)
+            for(r = 0; r < 2; ++r){
+                print "@" name ":" c ":" r; print s; print "+"; print q
+            }
+        }
+    }' > "$work/in.fq" || exit 1
+
+run(){
+    timeout 300 "$fqtool" -i "$work/in.fq" -o "$work/$1.fq" --dedup --dedup_mem 1 --ordered_output \
+        --max_item_in_pack 500 -w "$2" -J "$work/$1.json" -H "$work/$1.html" > /dev/null 2>&1
+}
+
+run ref 1 || { echo "single worker run failed"; exit 1; }
+for i in 1 2 3 4 5; do
+    run out 16 || { echo "run $i with 16 workers failed or hung"; exit 1; }
+    cmp -s "$work/ref.fq" "$work/out.fq" || { echo "run $i with 16 workers differs from the single worker run"; exit 1; }
+done
+exit 0